@@ -0,0 +1,157 @@
+/*
+ * Object creation and teardown microbenchmark.
+ *
+ * Usage: alloc_bench [-n <objects>] [-t <threads>]
+ *
+ * Times the life cycles that the server goes through for every game:
+ *
+ *   game        game_create() and game_unref();
+ *   played      the same, with a move made and a snapshot of the state
+ *               taken and released in between, as for a MOVED packet;
+ *   invitation  inv_create(), inv_accept() (which creates the game),
+ *               inv_close() and inv_unref();
+ *   player      player_create() and player_unref();
+ *   malloc      for reference, what game_create() and game_unref() used
+ *               to cost: two malloc()/free() pairs, for the game and its
+ *               state, and a pthread_mutex_init()/pthread_mutex_destroy();
+ *
+ * and then the first and the last of these again on <threads> threads at
+ * once, to show how they scale.  Each thread frees what it allocates,
+ * as a service thread mostly does.  The slab allocator's statistics are
+ * printed at the end (see slab.h).
+ */
+#include "client_registry.h"
+#include "invitation_ext.h"
+#include "player.h"
+#include "slab.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+static long nobjects = 1000000;
+
+static double elapsed(struct timespec *start) {
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void *run_games(void *arg) {
+	for(long i = 0; i < nobjects; i++)
+		game_unref(game_create(), "end of benchmark game");
+	return NULL;
+}
+
+static void *run_played(void *arg) {
+	char move[] = "5";
+	for(long i = 0; i < nobjects; i++) {
+		GAME *game = game_create();
+		game_play_move(game, FIRST_PLAYER_ROLE, move);
+		game_state_unref(game_get_state(game));
+		game_unref(game, "end of benchmark game");
+	}
+	return NULL;
+}
+
+static void *run_malloc(void *arg) {
+	for(long i = 0; i < nobjects; i++) {
+		// Go through volatile pointers, so that the compiler cannot
+		// drop the allocations altogether.
+		void *volatile game = malloc(160), *volatile state = malloc(64);
+		pthread_mutex_t *mutex = game;
+		pthread_mutex_init(mutex, NULL);
+		pthread_mutex_destroy(mutex);
+		free(state);
+		free(game);
+	}
+	return NULL;
+}
+
+static CLIENT *source, *target;
+
+static void *run_invitations(void *arg) {
+	for(long i = 0; i < nobjects; i++) {
+		INVITATION *inv = inv_create(source, target, FIRST_PLAYER_ROLE, SECOND_PLAYER_ROLE);
+		inv_accept(inv);
+		inv_close(inv, FIRST_PLAYER_ROLE);
+		inv_unref(inv, "end of benchmark invitation");
+	}
+	return NULL;
+}
+
+static void *run_players(void *arg) {
+	char name[] = "player";
+	for(long i = 0; i < nobjects; i++)
+		player_unref(player_create(name), "end of benchmark player");
+	return NULL;
+}
+
+/*
+ * Run a benchmark on a number of threads at once.
+ *
+ * @return  The time per object, in nanoseconds, over all threads.
+ */
+static double run(void *(*fn)(void *), int nthreads) {
+	pthread_t tids[nthreads];
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(int i = 0; i < nthreads; i++) {
+		if(pthread_create(&tids[i], NULL, fn, NULL)) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+	for(int i = 0; i < nthreads; i++)
+		pthread_join(tids[i], NULL);
+	return elapsed(&start) * 1e9 / (nobjects * nthreads);
+}
+
+int main(int argc, char *argv[]) {
+	int nthreads = 4;
+	int opt;
+	while((opt = getopt(argc, argv, "n:t:")) != -1) {
+		switch(opt) {
+		case 'n': nobjects = atol(optarg); break;
+		case 't': nthreads = atoi(optarg); break;
+		default: nobjects = 0; break;
+		}
+	}
+	if(nobjects <= 0 || nthreads <= 0) {
+		fprintf(stderr, "Usage: %s [-n <objects>] [-t <threads>]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	// Invitations need two clients with different descriptors, which
+	// are never written to.
+	if(!(source = client_create(NULL, open("/dev/null", O_WRONLY))) ||
+	   !(target = client_create(NULL, open("/dev/null", O_WRONLY)))) {
+		fprintf(stderr, "Failed to create clients\n");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("game:       %7.1f ns\n", run(run_games, 1));
+	printf("played:     %7.1f ns\n", run(run_played, 1));
+	printf("invitation: %7.1f ns\n", run(run_invitations, 1));
+	printf("player:     %7.1f ns\n", run(run_players, 1));
+	printf("malloc:     %7.1f ns\n", run(run_malloc, 1));
+	printf("%d threads:\n", nthreads);
+	printf("game:       %7.1f ns\n", run(run_games, nthreads));
+	printf("malloc:     %7.1f ns\n", run(run_malloc, nthreads));
+
+	static const char *names[SLAB_COUNT] = {
+		[SLAB_GAME] = "game",
+		[SLAB_GAME_STATE] = "game state",
+		[SLAB_INVITATION] = "invitation",
+		[SLAB_PLAYER] = "player",
+	};
+	for(int type = 0; type < SLAB_COUNT; type++) {
+		SLAB_STATS stats;
+		slab_get_stats(type, &stats);
+		printf("%-10s  %9ld allocs %9ld frees %4ld slabs %6ld transfers\n", names[type],
+		       stats.allocs, stats.frees, stats.slabs, stats.transfers);
+	}
+	return 0;
+}
@@ -0,0 +1,138 @@
+/*
+ * Connection-rate benchmark for the Jeux server.
+ *
+ * Usage: connect_bench -p <port> [-h <host>] [-c <clients>] [-d <seconds>]
+ *
+ * Each of <clients> threads repeatedly opens a connection to the server,
+ * sends a USERS request (which, not being logged in, is answered with a
+ * NACK), waits for the reply, and closes the connection.  Waiting for the
+ * reply means that every connection counted has actually been accepted
+ * and serviced by the server, not merely queued by the kernel.  At the end
+ * the sustained rate of completed connections per second is reported.
+ *
+ * To compare acceptor configurations, run the server with e.g. "-a 1" and
+ * then "-a 4", and run this against each.
+ */
+#include "protocol.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+static char *host = "localhost";
+static char *port = NULL;
+static int nclients = 8;
+static int duration = 5;
+static volatile int stop;
+
+typedef struct bench_thread {
+	pthread_t tid;
+	long completed;
+	long failed;
+} BENCH_THREAD;
+
+static int connect_server(void) {
+	struct addrinfo hints, *listp, *p;
+	int fd = -1;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+	if(getaddrinfo(host, port, &hints, &listp) != 0)
+		return -1;
+	for(p = listp; p; p = p->ai_next) {
+		if((fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0)
+			continue;
+		if(connect(fd, p->ai_addr, p->ai_addrlen) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(listp);
+	return fd;
+}
+
+/*
+ * One connect/request/reply/close cycle.
+ */
+static int bench_once(void) {
+	int fd;
+	if((fd = connect_server()) < 0)
+		return -1;
+	JEUX_PACKET_HEADER hdr = { .type = JEUX_USERS_PKT };
+	if(write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+		close(fd);
+		return -1;
+	}
+	size_t got = 0;
+	while(got < sizeof(hdr)) {
+		ssize_t n = read(fd, (char *)&hdr + got, sizeof(hdr) - got);
+		if(n <= 0) {
+			close(fd);
+			return -1;
+		}
+		got += n;
+	}
+	close(fd);
+	return hdr.type == JEUX_NACK_PKT ? 0 : -1;
+}
+
+static void *bench_thread(void *arg) {
+	BENCH_THREAD *bt = arg;
+	while(!stop) {
+		if(bench_once() == 0)
+			bt->completed++;
+		else
+			bt->failed++;
+	}
+	return NULL;
+}
+
+int main(int argc, char *argv[]) {
+	int opt;
+	while((opt = getopt(argc, argv, "h:p:c:d:")) != -1) {
+		switch(opt) {
+		case 'h': host = optarg; break;
+		case 'p': port = optarg; break;
+		case 'c': nclients = atoi(optarg); break;
+		case 'd': duration = atoi(optarg); break;
+		default: port = NULL; break;
+		}
+	}
+	if(!port || nclients <= 0 || duration <= 0) {
+		fprintf(stderr, "Usage: %s -p <port> [-h <host>] [-c <clients>] [-d <seconds>]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	BENCH_THREAD *threads;
+	if(!(threads = calloc(nclients, sizeof(BENCH_THREAD)))) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(int i = 0; i < nclients; i++) {
+		if(pthread_create(&threads[i].tid, NULL, bench_thread, &threads[i])) {
+			fprintf(stderr, "pthread_create failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	sleep(duration);
+	stop = 1;
+	long completed = 0, failed = 0;
+	for(int i = 0; i < nclients; i++) {
+		pthread_join(threads[i].tid, NULL);
+		completed += threads[i].completed;
+		failed += threads[i].failed;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%d clients, %.2f s: %ld connections (%ld failed), %.0f connections/s\n",
+	       nclients, secs, completed, failed, completed / secs);
+	free(threads);
+	return 0;
+}
@@ -0,0 +1,268 @@
+/*
+ * Game engine microbenchmark.
+ *
+ * Usage: game_bench [-n <games>] [-s <seed>] [-g <m,n,k>]
+ *
+ * Plays <games> random games of tic-tac-toe to completion four ways and
+ * reports the time per move of each:
+ *
+ *   legacy    the original engine's end-of-game test, kept here for
+ *             comparison: a board of nine ints (X = -1, O = 1) whose rows,
+ *             columns and diagonals are summed after every move, followed
+ *             by a scan for an empty square to detect a draw;
+ *   bitboard  the current engine's test: one 9-bit mask per side, checked
+ *             against the eight line masks, with a popcount for a draw;
+ *   api       complete games through game.h (parse, apply, unparse), to
+ *             put the cost of the end-of-game test in context;
+ *   play      complete games through the allocation-free path the server
+ *             uses (game_play_move() and a shared state snapshot).
+ *
+ * All four play the same move sequences, and the legacy and bitboard
+ * results are cross-checked against each other.  The api and play runs
+ * stop where the engine ends the game, which for a draw may be before
+ * the board is full (see game_apply_move()); the moves this saves are
+ * reported too.
+ *
+ * Then, to show how the engine scales with the board, it plays one game
+ * in a hundred as many through game_play_move() on a board of the given
+ * geometry (by default 15,15,5, gomoku), and checks each result against
+ * a plain scan of the final board.
+ */
+#include "game_ext.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+static const unsigned short win_masks[] = {
+	0x007, 0x038, 0x1c0, 0x049, 0x092, 0x124, 0x111, 0x054
+};
+
+/*
+ * Legacy test: returns 1 or 2 for a win by X or O, 3 for a draw, else 0.
+ */
+static int legacy_result(int board[9]) {
+	int winner = 0;
+	for(int i = 0; i < 9; i += 3) {
+		int sum = board[i] + board[i + 1] + board[i + 2];
+		if(sum == 3) winner = 2; else if(sum == -3) winner = 1;
+	}
+	for(int i = 0; i < 3; i++) {
+		int sum = board[i] + board[i + 3] + board[i + 6];
+		if(sum == 3) winner = 2; else if(sum == -3) winner = 1;
+	}
+	int sum = board[0] + board[4] + board[8];
+	if(sum == 3) winner = 2; else if(sum == -3) winner = 1;
+	sum = board[2] + board[4] + board[6];
+	if(sum == 3) winner = 2; else if(sum == -3) winner = 1;
+	if(winner)
+		return winner;
+	for(int i = 0; i < 9; i++) {
+		if(board[i] == 0)
+			return 0;
+	}
+	return 3;
+}
+
+/*
+ * Bitboard test, for the side that just moved.
+ */
+static int bitboard_result(unsigned short mine, unsigned short theirs, int side) {
+	int won = 0;
+	for(int i = 0; i < 8; i++)
+		won |= (mine & win_masks[i]) == win_masks[i];
+	if(won)
+		return side;
+	return __builtin_popcount(mine | theirs) == 9 ? 3 : 0;
+}
+
+/*
+ * Plain test for a line of k on an m,n board of cells (0 = empty,
+ * 1 = X, 2 = O), for the given side.
+ */
+static int scan_line(const unsigned char *cells, GAME_GEOMETRY *g, int side) {
+	static const int dr[] = { 0, 1, 1, 1 }, dc[] = { 1, 0, 1, -1 };
+	for(int r = 0; r < g->rows; r++) {
+		for(int c = 0; c < g->columns; c++) {
+			for(int d = 0; d < 4; d++) {
+				int n = 0, rr = r, cc = c;
+				while(n < g->line && rr >= 0 && rr < g->rows && cc >= 0 && cc < g->columns &&
+				      cells[rr * g->columns + cc] == side) {
+					n++;
+					rr += dr[d];
+					cc += dc[d];
+				}
+				if(n == g->line)
+					return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+static double elapsed(struct timespec *start) {
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+	long ngames = 1000000;
+	unsigned int seed = 1;
+	GAME_GEOMETRY geometry = { .rows = 15, .columns = 15, .line = 5 };
+	int opt;
+	while((opt = getopt(argc, argv, "n:s:g:")) != -1) {
+		switch(opt) {
+		case 'n': ngames = atol(optarg); break;
+		case 's': seed = atoi(optarg); break;
+		case 'g': if(game_parse_geometry(optarg, &geometry) < 0) ngames = 0; break;
+		default: ngames = 0; break;
+		}
+	}
+	if(ngames <= 0) {
+		fprintf(stderr, "Usage: %s [-n <games>] [-s <seed>] [-g <m,n,k>]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	// Each game is a random permutation of the squares, played until it ends.
+	unsigned char (*games)[9];
+	int *lengths;
+	int *results;
+	if(!(games = malloc(ngames * sizeof(*games))) || !(lengths = malloc(ngames * sizeof(int)))
+	   || !(results = malloc(ngames * sizeof(int)))) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	srand(seed);
+	for(long g = 0; g < ngames; g++) {
+		for(int i = 0; i < 9; i++)
+			games[g][i] = i;
+		for(int i = 8; i > 0; i--) {
+			int j = rand() % (i + 1);
+			unsigned char t = games[g][i];
+			games[g][i] = games[g][j];
+			games[g][j] = t;
+		}
+	}
+
+	struct timespec start;
+	long moves = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(long g = 0; g < ngames; g++) {
+		int board[9] = { 0 };
+		int result = 0, n = 0;
+		while(!result) {
+			board[games[g][n]] = (n & 1) ? 1 : -1;
+			result = legacy_result(board);
+			n++;
+		}
+		lengths[g] = n;
+		results[g] = result;
+		moves += n;
+	}
+	double legacy_secs = elapsed(&start);
+
+	long mismatches = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(long g = 0; g < ngames; g++) {
+		unsigned short side[2] = { 0, 0 };
+		int result = 0, n = 0;
+		while(!result) {
+			int s = n & 1;
+			side[s] |= 1 << games[g][n];
+			result = bitboard_result(side[s], side[!s], s + 1);
+			n++;
+		}
+		mismatches += n != lengths[g] || result != results[g];
+	}
+	double bitboard_secs = elapsed(&start);
+
+	char move[2] = { 0, 0 };
+	long saved = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(long g = 0; g < ngames; g++) {
+		GAME *game = game_create();
+		int n;
+		for(n = 0; n < lengths[g] && !game_is_over(game); n++) {
+			GAME_ROLE role = (n & 1) ? SECOND_PLAYER_ROLE : FIRST_PLAYER_ROLE;
+			move[0] = '1' + games[g][n];
+			GAME_MOVE *gm = game_parse_move(game, role, move);
+			game_apply_move(game, gm);
+			free(gm);
+			free(game_unparse_state(game));
+		}
+		saved += lengths[g] - n;
+		int winner = game_get_winner(game);
+		mismatches += !game_is_over(game) || winner != (results[g] == 3 ? NULL_ROLE : results[g]);
+		game_unref(game, "end of benchmark game");
+	}
+	double api_secs = elapsed(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(long g = 0; g < ngames; g++) {
+		GAME *game = game_create();
+		for(int n = 0; n < lengths[g] && !game_is_over(game); n++) {
+			GAME_ROLE role = (n & 1) ? SECOND_PLAYER_ROLE : FIRST_PLAYER_ROLE;
+			move[0] = '1' + games[g][n];
+			game_play_move(game, role, move);
+			game_state_unref(game_get_state(game));
+		}
+		int winner = game_get_winner(game);
+		mismatches += !game_is_over(game) || winner != (results[g] == 3 ? NULL_ROLE : results[g]);
+		game_unref(game, "end of benchmark game");
+	}
+	double play_secs = elapsed(&start);
+
+	long mnk_games = ngames / 100 + 1, mnk_moves = 0;
+	int squares = geometry.rows * geometry.columns;
+	unsigned short order[GAME_MAX_SQUARES];
+	unsigned char cells[GAME_MAX_SQUARES];
+	char square[8];
+	double mnk_secs = 0;
+	for(long g = 0; g < mnk_games; g++) {
+		for(int i = 0; i < squares; i++)
+			order[i] = i;
+		for(int i = squares - 1; i > 0; i--) {
+			int j = rand() % (i + 1);
+			unsigned short t = order[i];
+			order[i] = order[j];
+			order[j] = t;
+		}
+		memset(cells, 0, sizeof(cells));
+		GAME *game = game_create_geometry(&geometry);
+		int n;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for(n = 0; n < squares && !game_is_over(game); n++) {
+			GAME_ROLE role = (n & 1) ? SECOND_PLAYER_ROLE : FIRST_PLAYER_ROLE;
+			snprintf(square, sizeof(square), "%d", order[n] + 1);
+			game_play_move(game, role, square);
+		}
+		mnk_secs += elapsed(&start);
+		for(int i = 0; i < n; i++)
+			cells[order[i]] = (i & 1) ? 2 : 1;
+		// A win must be a line for the winner, and an early draw must
+		// leave no line for either side.
+		GAME_ROLE winner = game_get_winner(game);
+		mismatches += !game_is_over(game) ||
+			(winner != NULL_ROLE ? !scan_line(cells, &geometry, winner)
+					     : scan_line(cells, &geometry, 1) || scan_line(cells, &geometry, 2));
+		mnk_moves += n;
+		game_unref(game, "end of benchmark game");
+	}
+
+	printf("%ld games, %ld moves\n", ngames, moves);
+	printf("legacy:   %6.2f ns/move\n", legacy_secs * 1e9 / moves);
+	printf("bitboard: %6.2f ns/move\n", bitboard_secs * 1e9 / moves);
+	printf("api:      %6.2f ns/move\n", api_secs * 1e9 / (moves - saved));
+	printf("play:     %6.2f ns/move\n", play_secs * 1e9 / (moves - saved));
+	printf("%ld moves saved by adjudicating draws early\n", saved);
+	printf("%d,%d,%d:  %6.2f ns/move (%ld games, %ld moves)\n", geometry.rows, geometry.columns,
+	       geometry.line, mnk_secs * 1e9 / mnk_moves, mnk_games, mnk_moves);
+	if(mismatches)
+		printf("%ld mismatched games\n", mismatches);
+	free(games);
+	free(lengths);
+	free(results);
+	return mismatches ? EXIT_FAILURE : 0;
+}
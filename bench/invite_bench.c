@@ -0,0 +1,191 @@
+/*
+ * INVITE latency benchmark for the Jeux server.
+ *
+ * Usage: invite_bench -p <port> [-h <address>] [-u <users>] [-n <invites>]
+ *
+ * Logs in <users> idle clients, then from one further client repeatedly
+ * invites a randomly chosen one of them and revokes the invitation,
+ * timing each INVITE from the moment it is sent until its ACK arrives.
+ * The idle clients never read, but each only receives a few dozen bytes
+ * per invitation, which the socket buffers absorb.  Running this with
+ * increasing <users> shows how INVITE latency depends on the number of
+ * connected users.
+ *
+ * Large populations need a high enough open file limit (ulimit -n) in
+ * both this program and the server.  To get past the number of ephemeral
+ * ports available between one pair of addresses, connections to a
+ * loopback address are spread over several loopback source addresses.
+ */
+#include "protocol.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#define USERS_PER_SOURCE 20000
+
+static struct sockaddr_in server;
+
+static int connect_server(int n) {
+	int fd;
+	if((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+		return -1;
+	if((ntohl(server.sin_addr.s_addr) >> 24) == 127) {
+		struct sockaddr_in local = {
+			.sin_family = AF_INET,
+			.sin_addr.s_addr = htonl(0x7f010000 + n / USERS_PER_SOURCE + 1)
+		};
+		if(bind(fd, (struct sockaddr *)&local, sizeof(local)) < 0) {
+			close(fd);
+			return -1;
+		}
+	}
+	if(connect(fd, (struct sockaddr *)&server, sizeof(server)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int send_packet(int fd, int type, int id, int role, char *payload) {
+	char buf[sizeof(JEUX_PACKET_HEADER) + 64];
+	size_t len = payload ? strlen(payload) : 0;
+	JEUX_PACKET_HEADER hdr = {
+		.type = type,
+		.id = id,
+		.role = role,
+		.size = htons(len)
+	};
+	memcpy(buf, &hdr, sizeof(hdr));
+	memcpy(buf + sizeof(hdr), payload, len);
+	return write(fd, buf, sizeof(hdr) + len) == sizeof(hdr) + len ? 0 : -1;
+}
+
+static int read_fully(int fd, void *buf, size_t len) {
+	size_t got = 0;
+	while(got < len) {
+		ssize_t n = read(fd, (char *)buf + got, len - got);
+		if(n <= 0)
+			return -1;
+		got += n;
+	}
+	return 0;
+}
+
+/*
+ * Receive a packet, discarding its payload.
+ */
+static int recv_packet(int fd, JEUX_PACKET_HEADER *hdr) {
+	char payload[UINT16_MAX];
+	if(read_fully(fd, hdr, sizeof(*hdr)) < 0)
+		return -1;
+	return read_fully(fd, payload, ntohs(hdr->size));
+}
+
+static double now_usec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int compare_double(const void *a, const void *b) {
+	double x = *(double *)a, y = *(double *)b;
+	return x < y ? -1 : x > y;
+}
+
+int main(int argc, char *argv[]) {
+	char *host = "127.0.0.1";
+	int port = 0, nusers = 64, ninvites = 20000;
+	int opt;
+	while((opt = getopt(argc, argv, "h:p:u:n:")) != -1) {
+		switch(opt) {
+		case 'h': host = optarg; break;
+		case 'p': port = atoi(optarg); break;
+		case 'u': nusers = atoi(optarg); break;
+		case 'n': ninvites = atoi(optarg); break;
+		default: port = 0; break;
+		}
+	}
+	server = (struct sockaddr_in) {
+		.sin_family = AF_INET,
+		.sin_port = htons(port)
+	};
+	if(!port || nusers <= 0 || ninvites <= 0 || inet_pton(AF_INET, host, &server.sin_addr) != 1) {
+		fprintf(stderr, "Usage: %s -p <port> [-h <address>] [-u <users>] [-n <invites>]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	struct rlimit rl;
+	if(getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	// Log everybody in, pipelining the LOGINs and then collecting the ACKs.
+	int *fds;
+	if(!(fds = malloc(nusers * sizeof(int)))) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	char name[32];
+	for(int i = 0; i < nusers; i++) {
+		snprintf(name, sizeof(name), "user%d", i);
+		if((fds[i] = connect_server(i)) < 0 || send_packet(fds[i], JEUX_LOGIN_PKT, 0, 0, name) < 0) {
+			fprintf(stderr, "Connecting user %d: %s\n", i, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+	JEUX_PACKET_HEADER hdr;
+	for(int i = 0; i < nusers; i++) {
+		if(recv_packet(fds[i], &hdr) < 0 || hdr.type != JEUX_ACK_PKT) {
+			fprintf(stderr, "Login of user %d failed\n", i);
+			exit(EXIT_FAILURE);
+		}
+	}
+	int fd;
+	if((fd = connect_server(nusers)) < 0 || send_packet(fd, JEUX_LOGIN_PKT, 0, 0, "inviter") < 0
+	   || recv_packet(fd, &hdr) < 0 || hdr.type != JEUX_ACK_PKT) {
+		fprintf(stderr, "Login of inviter failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	double *lat;
+	if(!(lat = malloc(ninvites * sizeof(double)))) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	srand(1);
+	double total = 0;
+	for(int i = 0; i < ninvites; i++) {
+		snprintf(name, sizeof(name), "user%d", rand() % nusers);
+		double start = now_usec();
+		if(send_packet(fd, JEUX_INVITE_PKT, 0, 1, name) < 0 || recv_packet(fd, &hdr) < 0
+		   || hdr.type != JEUX_ACK_PKT) {
+			fprintf(stderr, "INVITE failed\n");
+			exit(EXIT_FAILURE);
+		}
+		lat[i] = now_usec() - start;
+		total += lat[i];
+		if(send_packet(fd, JEUX_REVOKE_PKT, hdr.id, 0, NULL) < 0 || recv_packet(fd, &hdr) < 0
+		   || hdr.type != JEUX_ACK_PKT) {
+			fprintf(stderr, "REVOKE failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	qsort(lat, ninvites, sizeof(double), compare_double);
+	printf("%d users, %d invites: mean %.1f us, p50 %.1f us, p99 %.1f us\n", nusers, ninvites,
+	       total / ninvites, lat[ninvites / 2], lat[ninvites * 99 / 100]);
+
+	close(fd);
+	for(int i = 0; i < nusers; i++)
+		close(fds[i]);
+	free(fds);
+	free(lat);
+	return 0;
+}
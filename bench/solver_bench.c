@@ -0,0 +1,147 @@
+/*
+ * Tic-tac-toe solver microbenchmark.
+ *
+ * Usage: solver_bench [-n <lookups>] [-s <seed>]
+ *
+ * Builds the solver's position table, checks that it has the expected
+ * number of positions and that its solutions agree with a plain minimax
+ * search for every position, and then reports the time taken to build
+ * the table and, for random reachable positions, the time per solution
+ * by table lookup and by search.
+ */
+#include "game_solver.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+static const unsigned short win_masks[] = {
+	0x007, 0x038, 0x1c0, 0x049, 0x092, 0x124, 0x111, 0x054
+};
+
+static int has_line(unsigned int board) {
+	for(int i = 0; i < 8; i++) {
+		if((board & win_masks[i]) == win_masks[i])
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Plain minimax: the winner under perfect play (0 for a draw), and the
+ * mask of moves that keep to it.
+ */
+static int search(unsigned int x, unsigned int o, unsigned int *bestp) {
+	*bestp = 0;
+	if(has_line(x))
+		return 1;
+	if(has_line(o))
+		return 2;
+	if((x | o) == 0x1ff)
+		return 0;
+	int x_to_move = __builtin_popcount(x) == __builtin_popcount(o);
+	int me = x_to_move ? 1 : 2;
+	int best_score = -1, winner = 0;
+	unsigned int dummy;
+	for(unsigned int bit = 1; bit <= 0x1ff; bit <<= 1) {
+		if((x | o) & bit)
+			continue;
+		int w = x_to_move ? search(x | bit, o, &dummy) : search(x, o | bit, &dummy);
+		int score = w == me ? 2 : w == 0 ? 1 : 0;
+		if(score > best_score) {
+			best_score = score;
+			winner = w;
+			*bestp = bit;
+		} else if(score == best_score) {
+			*bestp |= bit;
+		}
+	}
+	return winner;
+}
+
+static double now_nsec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+	int nlookups = 1000000, seed = 1;
+	int opt;
+	while((opt = getopt(argc, argv, "n:s:")) != -1) {
+		switch(opt) {
+		case 'n': nlookups = atoi(optarg); break;
+		case 's': seed = atoi(optarg); break;
+		default:
+			fprintf(stderr, "Usage: %s [-n <lookups>] [-s <seed>]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	double start = now_nsec();
+	int npositions = game_solver_init();
+	double init = now_nsec() - start;
+	if(npositions != GAME_SOLVER_POSITIONS) {
+		fprintf(stderr, "Solved %d positions, expected %d\n", npositions, GAME_SOLVER_POSITIONS);
+		exit(EXIT_FAILURE);
+	}
+
+	// Collect the reachable positions, checking each against the search.
+	unsigned int *positions;
+	if(!(positions = malloc(npositions * sizeof(unsigned int)))) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	int n = 0;
+	for(unsigned int x = 0; x <= 0x1ff; x++) {
+		for(unsigned int o = 0; o <= 0x1ff; o++) {
+			const GAME_SOLUTION *s = game_solve(x, o);
+			if(!s)
+				continue;
+			unsigned int best;
+			int winner = search(x, o, &best);
+			if(winner != s->winner || best != s->best) {
+				fprintf(stderr, "Mismatch at x=%03x o=%03x: table %d/%03x, search %d/%03x\n",
+					x, o, s->winner, s->best, winner, best);
+				exit(EXIT_FAILURE);
+			}
+			positions[n++] = x | o << 9;
+		}
+	}
+	if(n != npositions) {
+		fprintf(stderr, "Found %d positions in the table, expected %d\n", n, npositions);
+		exit(EXIT_FAILURE);
+	}
+
+	srand(seed);
+	unsigned int *sample;
+	if(!(sample = malloc(nlookups * sizeof(unsigned int)))) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	for(int i = 0; i < nlookups; i++)
+		sample[i] = positions[rand() % npositions];
+
+	unsigned long check = 0;
+	start = now_nsec();
+	for(int i = 0; i < nlookups; i++)
+		check += game_solve(sample[i] & 0x1ff, sample[i] >> 9)->best;
+	double lookup = (now_nsec() - start) / nlookups;
+
+	int nsearches = nlookups / 100 + 1;
+	start = now_nsec();
+	for(int i = 0; i < nsearches; i++) {
+		unsigned int best;
+		search(sample[i] & 0x1ff, sample[i] >> 9, &best);
+		check += best;
+	}
+	double searched = (now_nsec() - start) / nsearches;
+
+	printf("%d positions, table built in %.0f us\n", npositions, init / 1e3);
+	printf("lookup %8.1f ns/position\n", lookup);
+	printf("search %8.1f ns/position\n", searched);
+	printf("(checksum %lu)\n", check);
+	free(positions);
+	free(sample);
+	return 0;
+}
@@ -0,0 +1,48 @@
+#ifndef ACCEPTOR_H
+#define ACCEPTOR_H
+
+/*
+ * Acceptor threads.  Each acceptor has its own listening socket, bound to
+ * the same port with SO_REUSEPORT, so the kernel spreads incoming
+ * connections across the acceptors instead of funnelling them all through
+ * a single accept queue and a single accepting thread.
+ */
+
+/*
+ * Function called by an acceptor for each connection it accepts.  It takes
+ * over responsibility for the file descriptor.
+ */
+typedef void ACCEPT_HANDLER(int connfd);
+
+/*
+ * Open a listening socket on a port that can be shared with other
+ * sockets opened in the same way (SO_REUSEPORT).
+ *
+ * @param port  The port, as a decimal string.
+ * @return  The listening socket, or -1 with errno set on error.
+ */
+int open_reuseport_listenfd(char *port);
+
+/*
+ * Accept connections on a listening socket forever, passing each one to
+ * a handler.
+ *
+ * @param listenfd  The listening socket.
+ * @param handler  The function to be called for each connection.
+ */
+void acceptor_loop(int listenfd, ACCEPT_HANDLER *handler);
+
+/*
+ * Open one SO_REUSEPORT listening socket per acceptor, and start a thread
+ * running acceptor_loop() on each of them but the last, which is left for
+ * the caller to run.
+ *
+ * @param port  The port to listen on.
+ * @param nacceptors  The number of acceptors.
+ * @param handler  The function to be called for each connection.
+ * @return  The listening socket for the caller's own acceptor, or -1 if
+ * the acceptors could not be set up.
+ */
+int acceptor_init(char *port, int nacceptors, ACCEPT_HANDLER *handler);
+
+#endif
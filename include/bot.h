@@ -0,0 +1,74 @@
+#ifndef BOT_H
+#define BOT_H
+
+#include "client_registry.h"
+#include "player_registry.h"
+
+/*
+ * Built-in bot opponents.
+ *
+ * A bot is an ordinary CLIENT, registered in the client registry and
+ * logged in under a name of the form "bot<n>", so it shows up in USERS
+ * and can be invited like anybody else.  It has no connection: packets
+ * sent to it are handed to bot_deliver() instead, and a small pool of
+ * bot worker threads, shared by all bots, reacts to them.  A bot accepts
+ * every invitation to tic-tac-toe, and declines any other, and whenever it is its turn it chooses a move and
+ * makes it with client_make_move(), just as the server does for a MOVE
+ * packet.
+ *
+ * A bot's level, from 0 to BOT_LEVEL_PERFECT, is the number of times in
+ * BOT_LEVEL_PERFECT that it plays a move found by the solver (see
+ * game_solver.h) rather than a random one; at level 0 it plays at
+ * random, and at BOT_LEVEL_PERFECT it never loses.
+ */
+#define BOT_LEVEL_PERFECT 10
+
+/*
+ * Number of bot worker threads.
+ */
+#define BOT_WORKERS 2
+
+typedef struct bot BOT;
+
+/*
+ * Start the bot workers and log in a number of bots.
+ *
+ * @param creg  The client registry in which the bots are registered.
+ * @param preg  The player registry from which their players come.
+ * @param nbots  The number of bots.
+ * @param level  The level at which they play.
+ * @return 0 if the bots were started, otherwise -1.
+ */
+int bot_init(CLIENT_REGISTRY *creg, PLAYER_REGISTRY *preg, int nbots, int level);
+
+/*
+ * Log out and unregister all the bots, resigning any games they are
+ * playing, and stop the bot workers.  This does nothing if bot_init()
+ * was never called.
+ */
+void bot_fini(void);
+
+/*
+ * Hand a bot packets that were sent to it, as client_send_packets() does
+ * for a CLIENT that is a bot.  The bot reacts to them later, on a bot
+ * worker thread, once the calling thread has called bot_flush().
+ *
+ * @param bot  The bot.
+ * @param hdrs  The packet headers, in network byte order.
+ * @param data  The corresponding payloads, which are not used.
+ * @param n  The number of packets.
+ * @return 0 if the packets were taken, -1 if the bots are shutting down.
+ */
+int bot_deliver(BOT *bot, JEUX_PACKET_HEADER **hdrs, void **data, int n);
+
+/*
+ * Pass the packets delivered to bots by the calling thread on to the bot
+ * workers.  The server calls this after replying to each request, so
+ * that a bot's answer to a request (e.g. accepting an invitation) can
+ * never reach the client that made it before the reply does.  This never
+ * waits for the bot workers: if their queue is full, the bot declines
+ * the invitation or resigns the game instead.
+ */
+void bot_flush(void);
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef CLIENT_EXT_H
+#define CLIENT_EXT_H
+
+#include "client_registry.h"
+#include "game_ext.h"
+#include "bot.h"
+
+/*
+ * Additional CLIENT operations, beyond those in client.h.
+ */
+
+/*
+ * Size of a buffer large enough for a game state in either format.
+ */
+#define CLIENT_STATE_MAX GAME_STATE_SIZE
+
+/*
+ * Get the slot that the client registry has assigned to a client.
+ * Only the client registry uses this, under its own lock.
+ *
+ * @param client  The CLIENT.
+ * @return  The slot, or -1 if the client is not registered.
+ */
+int client_get_slot(CLIENT *client);
+
+/*
+ * Record the slot that the client registry has assigned to a client.
+ *
+ * @param client  The CLIENT.
+ * @param slot  The slot, or -1 if the client is no longer registered.
+ */
+void client_set_slot(CLIENT *client, int slot);
+
+/*
+ * Make a CLIENT a bot (see bot.h): from now on packets sent to it are
+ * handed to bot_deliver() instead of being written to a connection.
+ *
+ * @param client  The CLIENT, which should have no connection.
+ * @param bot  The bot that is to receive its packets.
+ */
+void client_set_bot(CLIENT *client, BOT *bot);
+
+/*
+ * Get the GAME in an INVITATION of a client, and the role that the
+ * client plays in it.
+ *
+ * @param client  The CLIENT.
+ * @param id  The ID assigned by the CLIENT to the INVITATION.
+ * @param rolep  Set to the GAME_ROLE of the CLIENT in the game.
+ * @return  The GAME, with its reference count incremented, or NULL if
+ * the ID does not refer to an INVITATION that has been accepted.
+ */
+GAME *client_get_game(CLIENT *client, int id, GAME_ROLE *rolep);
+
+/*
+ * Get the geometry of the game offered by an INVITATION of a client.
+ *
+ * @param client  The CLIENT.
+ * @param id  The ID assigned by the CLIENT to the INVITATION.
+ * @param geometry  Set to the geometry of the game.
+ * @return 0 if the ID refers to an INVITATION, otherwise -1.
+ */
+int client_get_geometry(CLIENT *client, int id, GAME_GEOMETRY *geometry);
+
+/*
+ * Make a new invitation, as for client_make_invitation(), to a game of a
+ * given geometry.  Unless the game is tic-tac-toe, the payload of the
+ * INVITED packet is the source's name and the geometry, separated by a
+ * tab, as in the payload of an INVITE.
+ *
+ * @param source  The CLIENT that is the source of the INVITATION.
+ * @param target  The CLIENT that is the target of the INVITATION.
+ * @param source_role  The GAME_ROLE to be played by the source of the INVITATION.
+ * @param target_role  The GAME_ROLE to be played by the target of the INVITATION.
+ * @param geometry  The geometry of the game.
+ * @return the ID assigned by the source to the INVITATION, if the operation
+ * is successful, otherwise -1.
+ */
+int client_make_invitation_geometry(CLIENT *source, CLIENT *target, GAME_ROLE source_role,
+				    GAME_ROLE target_role, const GAME_GEOMETRY *geometry);
+
+/*
+ * Choose the format in which game states are sent to a client.
+ *
+ * @param client  The CLIENT.
+ * @param compact  Nonzero for the compact binary format produced by
+ * game_pack_state(), zero for the text format of game_unparse_state().
+ */
+void client_set_compact_state(CLIENT *client, int compact);
+
+/*
+ * Accept an INVITATION, as for client_accept_invitation(), but produce
+ * the payload of the ACK to the accepting client in that client's own
+ * state format.
+ *
+ * @param client  The CLIENT that is the target of the INVITATION to be
+ * accepted.
+ * @param id  The ID assigned by the target to the INVITATION.
+ * @param buf  Storage for at least CLIENT_STATE_MAX bytes, into which
+ * the initial game state is rendered if the accepting client is the
+ * first player to move.
+ * @param lenp  Pointer to a variable into which is stored the length of
+ * the payload (including the terminator of a text state), or 0 if there
+ * is none.
+ * @return 0 if the INVITATION is successfully accepted, otherwise -1.
+ */
+int client_accept_invitation_state(CLIENT *client, int id, char *buf, size_t *lenp);
+
+/*
+ * Send an ACK packet to a client, as for client_send_ack(), with a
+ * given value in its role field.
+ *
+ * @param client  The CLIENT who should be sent the packet.
+ * @param role  The value of the role field.
+ * @param data  Pointer to the optional data payload for this packet,
+ * or NULL if there is to be no payload.
+ * @param datalen  Length of the data payload, or 0 if there is none.
+ * @return 0 if transmission succeeds, -1 otherwise.
+ */
+int client_send_ack_role(CLIENT *client, int role, void *data, size_t datalen);
+
+/*
+ * Send several packets to a client, back-to-back and with as few system
+ * calls as possible.  No other packet can be interleaved with the batch.
+ *
+ * @param client  The CLIENT who should be sent the packets.
+ * @param pkts  The headers of the packets to be sent.
+ * @param data  The corresponding payloads, any of which may be NULL.
+ * @param n  The number of packets.
+ * @return 0 if transmission succeeds, -1 otherwise.
+ */
+int client_send_packets(CLIENT *client, JEUX_PACKET_HEADER **pkts, void **data, int n);
+
+/*
+ * Start holding back packets for a client, so that the responses to a
+ * run of pipelined requests can be sent together by client_uncork().
+ * Notifications from other clients are held back along with them, so a
+ * client must not be left corked while waiting for input.
+ *
+ * @param client  The CLIENT to be corked.
+ */
+void client_cork(CLIENT *client);
+
+/*
+ * Send everything held back since client_cork(), in one gather write if
+ * the socket will take it.
+ *
+ * @param client  The CLIENT to be uncorked.
+ * @return 0 if the packets were sent or queued, -1 if the connection has
+ * failed.
+ */
+int client_uncork(CLIENT *client);
+
+/*
+ * Close the network connection of a client.  Packets still waiting to be
+ * sent are discarded, and any later attempt to send to the client fails.
+ *
+ * @param client  The CLIENT whose connection is to be closed.
+ */
+void client_disconnect(CLIENT *client);
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef CLIENT_REGISTRY_EXT_H
+#define CLIENT_REGISTRY_EXT_H
+
+#include "client_registry.h"
+#include <stddef.h>
+
+/*
+ * Additional CLIENT_REGISTRY operations, beyond those in
+ * client_registry.h.
+ *
+ * Besides the registered clients, the registry keeps an index from the
+ * username of each logged-in client to the client, so that creg_lookup()
+ * takes constant time however many clients are connected.  The index is
+ * maintained by client_login() and client_logout().
+ *
+ * The registry also publishes the listing of logged-in users sent in
+ * reply to USERS.  The listing is rebuilt, at most once per change, by
+ * the first request after a login, a logout or a change of rating, and
+ * between changes every request is served from the same copy without
+ * taking any lock.
+ */
+
+/*
+ * Record that a CLIENT is logged in under a username, so that it can be
+ * found by creg_lookup().  No other CLIENT may be logged in under the
+ * same name.
+ *
+ * @param cr  The client registry.
+ * @param client  The CLIENT that is logging in.
+ * @param user  The username, which must remain valid until the CLIENT
+ * is removed with creg_remove_user().
+ * @return 0 if the username was recorded, -1 if another CLIENT is
+ * already logged in under it.
+ */
+int creg_add_user(CLIENT_REGISTRY *cr, CLIENT *client, char *user);
+
+/*
+ * Forget the username under which a CLIENT was logged in.
+ *
+ * @param cr  The client registry.
+ * @param client  The CLIENT that is logging out.
+ * @param user  The username that was passed to creg_add_user().
+ */
+void creg_remove_user(CLIENT_REGISTRY *cr, CLIENT *client, char *user);
+
+/*
+ * Record that the listing of logged-in users has changed, because a
+ * client has logged in or out or the rating of a logged-in player has
+ * changed.  The listing is rebuilt when it is next requested.
+ *
+ * @param cr  The client registry.
+ */
+void creg_users_changed(CLIENT_REGISTRY *cr);
+
+/*
+ * Get the listing of logged-in users, with one "name<TAB>rating" line
+ * per user, the lines separated by newlines and the whole terminated
+ * by a null character.  The caller must be in an epoch critical section
+ * (see epoch.h), and the listing remains valid until it leaves it.
+ *
+ * @param cr  The client registry.
+ * @param lenp  Set to the length of the listing, including the
+ * terminating null character.
+ * @return  The listing, or NULL if it could not be built.
+ */
+const char *creg_users(CLIENT_REGISTRY *cr, size_t *lenp);
+
+/*
+ * A selection of logged-in users, for creg_users_page().  Users are taken
+ * in order of name, starting after "after", or from the first if it is
+ * NULL.  Only those whose names begin with "prefix", if it is not NULL,
+ * and whose ratings lie between min_rating and max_rating inclusive are
+ * selected, and at most "limit" of them.
+ *
+ * If either rating bound is not INT_MIN or INT_MAX, the users are taken
+ * in order of rating instead, lowest first and by name among equal
+ * ratings, and "after" names a user rated min_rating, so that a page can
+ * be continued from its last user by setting min_rating to its rating
+ * and "after" to its name.
+ */
+typedef struct creg_users_query {
+	const char *after;
+	const char *prefix;
+	int min_rating;
+	int max_rating;
+	int limit;
+} CREG_USERS_QUERY;
+
+/*
+ * Copy a page of the listing of logged-in users, in the format of
+ * creg_users().  The page holds the users selected by a query, except
+ * that it ends early if the next of them would not fit in the buffer.
+ * This takes time proportional to the size of the page, not to the
+ * number logged in, plus, when users are taken in order of rating, the
+ * number in the rating band skipped for not having the prefix.
+ *
+ * @param cr  The client registry.
+ * @param query  The users to be selected.
+ * @param buf  Storage for the page, which is null-terminated.
+ * @param size  The size of the storage.
+ * @param lenp  Set to the length of the page, including the terminating
+ * null character.
+ * @return 1 if more users match the query after the last one on the
+ * page, 0 if none do, or -1 if the listing could not be built.
+ */
+int creg_users_page(CLIENT_REGISTRY *cr, const CREG_USERS_QUERY *query, char *buf,
+		    size_t size, size_t *lenp);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+/*
+ * Epoch-based reclamation, for data that is read without locks.
+ *
+ * A thread reads shared data published through an atomic pointer only
+ * between epoch_enter() and epoch_exit().  A writer that replaces such
+ * data hands the old version to epoch_retire() instead of freeing it,
+ * and it is freed once every thread that might still be reading it has
+ * left its critical section.  Entering and leaving a critical section
+ * touch only the calling thread's own state, so readers never contend
+ * with each other.
+ *
+ * Critical sections must not be nested, and should be short: while any
+ * thread stays inside one, nothing retired after it entered is freed.
+ */
+
+/*
+ * Enter a read-side critical section.
+ */
+void epoch_enter(void);
+
+/*
+ * Leave a read-side critical section.
+ */
+void epoch_exit(void);
+
+/*
+ * Arrange for an object that has been unpublished to be destroyed once
+ * no thread can still be reading it.  Objects retired earlier may be
+ * destroyed by this call.
+ *
+ * @param ptr  The object.
+ * @param destroy  The function that destroys it, e.g. free().
+ */
+void epoch_retire(void *ptr, void (*destroy)(void *));
+
+/*
+ * Destroy everything that has been retired.  This may only be called
+ * once no thread will enter a critical section again, e.g. at shutdown.
+ */
+void epoch_fini(void);
+
+#endif
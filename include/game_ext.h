@@ -0,0 +1,229 @@
+#ifndef GAME_EXT_H
+#define GAME_EXT_H
+
+#include "game.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Additional GAME operations, beyond those in game.h.
+ */
+
+/*
+ * The geometry of a game: an m,n,k-game is played on a board of m rows
+ * and n columns, and won by the first player to occupy k squares in a
+ * row, horizontally, vertically or diagonally.  Tic-tac-toe is the 3,3,3
+ * game, and is what game_create() makes; gomoku, for example, is 15,15,5.
+ *
+ * Squares are numbered from 1, row by row from the top left, so that in
+ * tic-tac-toe they are numbered 1 to 9 as before, and a move is the
+ * number of the square to be occupied, written in decimal.
+ */
+typedef struct game_geometry {
+	int rows;	/* m: number of rows. */
+	int columns;	/* n: number of columns. */
+	int line;	/* k: length of a winning line. */
+} GAME_GEOMETRY;
+
+#define GAME_GEOMETRY_DEFAULT ((GAME_GEOMETRY) { .rows = 3, .columns = 3, .line = 3 })
+
+/*
+ * Largest number of rows or columns, and the largest number of squares.
+ */
+#define GAME_MAX_SIDE 19
+#define GAME_MAX_SQUARES (GAME_MAX_SIDE * GAME_MAX_SIDE)
+
+/*
+ * Create a new game with a given geometry, in an initial state.  The
+ * returned game has a reference count of one.
+ *
+ * @param geometry  The geometry, which must be valid (see
+ * game_parse_geometry()).
+ * @return the newly created GAME, if initialization was successful,
+ * otherwise NULL.
+ */
+GAME *game_create_geometry(const GAME_GEOMETRY *geometry);
+
+/*
+ * Interpret a string of the form "m,n,k" as a game geometry.  The numbers
+ * of rows and columns must be from 1 to GAME_MAX_SIDE, and the length of
+ * a winning line from 1 to the larger of them.
+ *
+ * @param str  The string.
+ * @param geometry  Set to the geometry described.
+ * @return 0 if the string describes a valid geometry, otherwise -1.
+ */
+int game_parse_geometry(const char *str, GAME_GEOMETRY *geometry);
+
+/*
+ * Render a game geometry in the form accepted by game_parse_geometry().
+ *
+ * @param geometry  The geometry.
+ * @param buf  Storage for at least GAME_GEOMETRY_SIZE bytes.
+ * @return  The length of the string, not counting the null terminator.
+ */
+int game_unparse_geometry(const GAME_GEOMETRY *geometry, char *buf);
+
+#define GAME_GEOMETRY_SIZE 12
+
+/*
+ * Determine whether a game geometry is tic-tac-toe.
+ *
+ * @param geometry  The geometry.
+ * @return  1 if it is 3,3,3, otherwise 0.
+ */
+int game_geometry_is_default(const GAME_GEOMETRY *geometry);
+
+/*
+ * Get the geometry of a GAME.
+ *
+ * @param game  The GAME to be queried.
+ * @param geometry  Set to its geometry.
+ */
+void game_get_geometry(GAME *game, GAME_GEOMETRY *geometry);
+
+/*
+ * A GAME_STATE is a reference-counted, immutable snapshot of the state of
+ * a GAME rendered as text, in the format of game_unparse_state().  It can
+ * be shared by any number of threads and sent any number of times without
+ * rendering or copying.
+ */
+typedef struct game_state GAME_STATE;
+
+/*
+ * Space for the rendered state of a game with a given number of rows and
+ * columns, and for the longest rendered state of any game, including the
+ * null terminator.  A board is drawn as rows of squares separated by '|',
+ * with a line of '-' between rows, followed by a line saying who is to
+ * move.
+ */
+#define GAME_STATE_SIZE_FOR(rows, columns) \
+	((2 * (rows) - 1) * 2 * (columns) + sizeof("X to move"))
+#define GAME_STATE_SIZE GAME_STATE_SIZE_FOR(GAME_MAX_SIDE, GAME_MAX_SIDE)
+
+/*
+ * Get a snapshot of the current GAME state, rendered as for
+ * game_unparse_state().
+ *
+ * @param game  The GAME for which the state is to be obtained.
+ * @return  The current GAME_STATE, with its reference count incremented.
+ */
+GAME_STATE *game_get_state(GAME *game);
+
+/*
+ * Release a reference to a GAME_STATE, freeing it if it was the last.
+ *
+ * @param state  The GAME_STATE to be released.
+ */
+void game_state_unref(GAME_STATE *state);
+
+/*
+ * Get the text of a GAME_STATE, which is null-terminated.
+ *
+ * @param state  The GAME_STATE.
+ * @return  The rendered state, valid for as long as the reference is held.
+ */
+const char *game_state_text(GAME_STATE *state);
+
+/*
+ * Get the length of the text of a GAME_STATE, not counting the null
+ * terminator.
+ *
+ * @param state  The GAME_STATE.
+ * @return  The length of the text.
+ */
+size_t game_state_length(GAME_STATE *state);
+
+/*
+ * Get the version of a GAME_STATE.  Every change to a game, whether a
+ * move or a resignation, produces a state with a higher version.
+ *
+ * @param state  The GAME_STATE.
+ * @return  The version number, starting from 1 for a new game.
+ */
+unsigned int game_state_version(GAME_STATE *state);
+
+/*
+ * A GAME_MOVE_CODE is a move packed into an integer, which can be passed
+ * around by value instead of being allocated as a GAME_MOVE.  The low
+ * 16 bits are the square (1 to GAME_MAX_SQUARES) and the high bits the
+ * GAME_ROLE of the player making the move.  Zero is not a valid move.
+ */
+typedef uint32_t GAME_MOVE_CODE;
+
+#define GAME_MOVE_CODE_MAKE(square, role) ((GAME_MOVE_CODE)((role) << 16 | (square)))
+#define GAME_MOVE_SQUARE(code) ((code) & 0xffff)
+#define GAME_MOVE_ROLE(code) ((GAME_ROLE)((code) >> 16))
+
+/*
+ * Interpret a string as a move, without reference to any particular game
+ * and without allocating anything.
+ *
+ * @param role  The GAME_ROLE of the player making the move.
+ * @param str  The string that is to be interpreted as a move.
+ * @return  The GAME_MOVE_CODE for the move, or 0 if the string is not
+ * a move.
+ */
+GAME_MOVE_CODE game_parse_move_code(GAME_ROLE role, char *str);
+
+/*
+ * Apply a move given as a GAME_MOVE_CODE to a GAME.
+ *
+ * @param game  The GAME to which the move is to be applied.
+ * @param code  The move, as produced by game_parse_move_code().
+ * @return 0 if application of the move was successful, otherwise -1.
+ */
+int game_apply_move_code(GAME *game, GAME_MOVE_CODE code);
+
+/*
+ * Parse a move and apply it to a GAME, taking the game's mutex once
+ * for both.  This is equivalent to game_parse_move() followed by
+ * game_apply_move(), without allocating a GAME_MOVE.
+ *
+ * @param game  The GAME in which the move is to be made.
+ * @param role  The GAME_ROLE of the player making the move, which must
+ * be the role currently on the move.
+ * @param str  The string that is to be interpreted as a move.
+ * @return 0 if the move was parsed and applied, otherwise -1.
+ */
+int game_play_move(GAME *game, GAME_ROLE role, char *str);
+
+/*
+ * Size in bytes of the packed state of a game with a given number of
+ * squares, and the largest packed state of any game (see
+ * game_pack_state()).
+ */
+#define GAME_PACKED_STATE_SIZE_FOR(squares) ((2 * (squares) + 2 + 7) / 8)
+#define GAME_PACKED_STATE_SIZE GAME_PACKED_STATE_SIZE_FOR(GAME_MAX_SQUARES)
+
+/*
+ * Encode the current state of a GAME in compact binary form, without any
+ * string formatting.  For a game of N squares the state is the value
+ *
+ *     cell[0] | cell[1] << 2 | ... | cell[N-1] << 2(N-1) | to_move << 2N
+ *
+ * where cell[i] is the content of square i + 1 (0 = empty, 1 = X, 2 = O)
+ * and to_move is the side to move (0 = nobody, the game being over,
+ * 1 = X, 2 = O).  It is stored as GAME_PACKED_STATE_SIZE_FOR(N) bytes,
+ * most significant byte first; for tic-tac-toe that is a 20-bit value in
+ * three bytes.
+ *
+ * @param game  The GAME whose state is to be encoded.
+ * @param buf  Storage for at least GAME_PACKED_STATE_SIZE bytes.
+ * @return  The number of bytes stored.
+ */
+int game_pack_state(GAME *game, unsigned char *buf);
+
+/*
+ * Get the squares held by each player in a game of tic-tac-toe, as 9-bit
+ * masks in which bit i stands for square i + 1.
+ *
+ * @param game  The GAME to be queried.
+ * @param x  Set to the squares held by the first player.
+ * @param o  Set to the squares held by the second player.
+ * @return 0 if the game is tic-tac-toe, otherwise -1, with the masks
+ * left unset.
+ */
+int game_get_position(GAME *game, unsigned int *x, unsigned int *o);
+
+#endif
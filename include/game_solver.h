@@ -0,0 +1,66 @@
+#ifndef GAME_SOLVER_H
+#define GAME_SOLVER_H
+
+#include "game.h"
+
+/*
+ * Perfect-play solver for tic-tac-toe.
+ *
+ * game_solver_init() solves every position that can arise in play (there
+ * are 5478 of them) once, and afterwards the outcome of any position
+ * under perfect play, and the moves that achieve it, are found by a
+ * table lookup with no search.
+ *
+ * Positions are given as a pair of 9-bit masks, one for the squares
+ * held by X (the first player) and one for those held by O, with bit i
+ * standing for square i + 1, as for game_get_position() in game_ext.h.
+ * The side to move follows from the number of pieces each has.
+ */
+
+/*
+ * What perfect play makes of a position.
+ */
+typedef struct game_solution {
+	unsigned char winner;	/* GAME_ROLE of the eventual winner, NULL_ROLE for a draw. */
+	unsigned char moves;	/* Moves left to the end of the game. */
+	unsigned short best;	/* Mask of the squares that keep to that outcome. */
+} GAME_SOLUTION;
+
+/*
+ * Number of positions that can arise in play, including those in which
+ * the game is over.
+ */
+#define GAME_SOLVER_POSITIONS 5478
+
+/*
+ * Solve all positions.  This must be called, once, before game_solve(),
+ * and takes about a millisecond.
+ *
+ * @return  The number of positions solved, GAME_SOLVER_POSITIONS.
+ */
+int game_solver_init(void);
+
+/*
+ * Look up the solution of a position.
+ *
+ * The winner and the number of moves assume that the side that can win
+ * wins as quickly as it can, and that the other side holds out as long
+ * as it can.  The "best" mask holds every move that keeps to the winner,
+ * however quickly, and is empty if the game is over.
+ *
+ * @param x  The squares held by X.
+ * @param o  The squares held by O.
+ * @return  The solution, or NULL if the position cannot arise in play.
+ */
+const GAME_SOLUTION *game_solve(unsigned int x, unsigned int o);
+
+/*
+ * Look up the solution of the current position of a GAME.
+ *
+ * @param game  The GAME.
+ * @return  The solution of its position, as for game_solve(), or NULL if
+ * the game is not tic-tac-toe.
+ */
+const GAME_SOLUTION *game_solve_game(GAME *game);
+
+#endif
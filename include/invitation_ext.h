@@ -0,0 +1,38 @@
+#ifndef INVITATION_EXT_H
+#define INVITATION_EXT_H
+
+#include "client_registry.h"
+#include "game_ext.h"
+
+/*
+ * Additional INVITATION operations, beyond those in invitation.h.
+ *
+ * An invitation carries the geometry of the game to be played (see
+ * game_ext.h), and the GAME created when it is accepted has that
+ * geometry.  Invitations made with inv_create() are to tic-tac-toe.
+ */
+
+/*
+ * Create an INVITATION in the OPEN state, as for inv_create(), to a game
+ * of a given geometry.
+ *
+ * @param source  The CLIENT that is the source of this INVITATION.
+ * @param target  The CLIENT that is the target of this INVITATION.
+ * @param source_role  The GAME_ROLE to be played by the source of this INVITATION.
+ * @param target_role  The GAME_ROLE to be played by the target of this INVITATION.
+ * @param geometry  The geometry of the game.
+ * @return a reference to the newly created INVITATION, if initialization
+ * was successful, otherwise NULL.
+ */
+INVITATION *inv_create_geometry(CLIENT *source, CLIENT *target, GAME_ROLE source_role,
+				GAME_ROLE target_role, const GAME_GEOMETRY *geometry);
+
+/*
+ * Get the geometry of the game offered by an INVITATION.
+ *
+ * @param inv  The INVITATION to be queried.
+ * @param geometry  Set to the geometry of the game.
+ */
+void inv_get_geometry(INVITATION *inv, GAME_GEOMETRY *geometry);
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef LEADERBOARD_H
+#define LEADERBOARD_H
+
+#include <stddef.h>
+#include "player.h"
+
+/*
+ * The leaderboard orders every existing PLAYER by rating, so that the
+ * best-rated players, and the rank of any one player, can be found in
+ * time logarithmic in the range of ratings rather than by sorting all of
+ * them.
+ *
+ * Ratings are counted in one bucket per rating point between
+ * LB_MIN_RATING and LB_MAX_RATING, with a Fenwick tree over the bucket
+ * counts; ratings outside that range share the bucket at its nearer end.
+ * A player's rank is one more than the number of players in buckets
+ * above its own, so players with equal ratings share a rank.
+ *
+ * Each PLAYER embeds an LB_NODE, through which player.c keeps it on the
+ * leaderboard from creation to destruction.  All operations are
+ * thread-safe.
+ */
+#define LB_MIN_RATING 0
+#define LB_MAX_RATING 4095
+
+typedef struct lb_node {
+	struct lb_node *prev;
+	struct lb_node *next;
+	PLAYER *player;
+	int rating;
+} LB_NODE;
+
+/*
+ * Put a player on the leaderboard.
+ *
+ * @param node  The node embedded in the player, which must not already
+ * be on the leaderboard.
+ * @param player  The player.
+ * @param rating  Its rating.
+ */
+void lb_insert(LB_NODE *node, PLAYER *player, int rating);
+
+/*
+ * Record a change in the rating of a player on the leaderboard.
+ *
+ * @param node  The player's node.
+ * @param rating  Its new rating.
+ */
+void lb_update(LB_NODE *node, int rating);
+
+/*
+ * Take a player off the leaderboard.
+ *
+ * @param node  The player's node.
+ */
+void lb_remove(LB_NODE *node);
+
+/*
+ * Get the rank of a player on the leaderboard.
+ *
+ * @param node  The player's node.
+ * @return  One more than the number of players rated above it.
+ */
+int lb_rank(LB_NODE *node);
+
+/*
+ * List the best-rated players, with one "rank<TAB>name<TAB>rating" line
+ * per player, best first, the lines separated by newlines and the whole
+ * terminated by a null character.  The list ends early if the next line
+ * would not fit.
+ *
+ * @param k  The number of players wanted.
+ * @param buf  Storage for the list.
+ * @param size  The size of the storage, which must be at least one.
+ * @return  The length of the list, including the null character.
+ */
+size_t lb_top(int k, char *buf, size_t size);
+
+#endif
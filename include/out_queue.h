@@ -0,0 +1,94 @@
+#ifndef OUT_QUEUE_H
+#define OUT_QUEUE_H
+
+#include "protocol.h"
+
+/*
+ * An OUT_QUEUE holds the packets waiting to be sent on one client
+ * connection, so that a thread sending to a client never blocks on that
+ * client's socket.  A send first tries to go straight out with a single
+ * non-blocking gather write; whatever the socket will not take right away
+ * is copied into the queue and drained later by a dedicated writer thread
+ * that waits for the socket to become writable.  Packets always leave in
+ * the order in which they were queued.
+ *
+ * A peer that does not keep up is not allowed to hold up its senders: once
+ * more than OUTQ_HIGH_WATER bytes are waiting for it, its queue is dropped
+ * and its connection is shut down, which its service thread sees as EOF.
+ * While less than OUTQ_LOW_WATER bytes are queued, senders also try to
+ * flush the queue themselves rather than leaving all of it to the writer.
+ */
+#define OUTQ_HIGH_WATER (256 * 1024)
+#define OUTQ_LOW_WATER (16 * 1024)
+
+typedef struct out_queue OUT_QUEUE;
+
+/*
+ * Start the writer thread.  This must be called once, before any queue
+ * is created.
+ *
+ * @return 0 if the writer was started, otherwise -1.
+ */
+int outq_init(void);
+
+/*
+ * Create an outbound queue for a connection.  From now on the queue owns
+ * the file descriptor, which is closed by outq_close().
+ *
+ * @param fd  The file descriptor of the connection.
+ * @return  The new OUT_QUEUE, or NULL if it could not be allocated.
+ */
+OUT_QUEUE *outq_create(int fd);
+
+/*
+ * Queue a batch of packets for sending, as a unit.  Either all of them are
+ * accepted or none is.
+ *
+ * @param q  The OUT_QUEUE.
+ * @param hdrs  The packet headers, in network byte order.
+ * @param data  The corresponding payloads, any of which may be NULL.
+ * @param n  The number of packets.
+ * @return 0 if the packets were sent or queued, -1 if the connection has
+ * failed, has been closed, or has just been shut down for exceeding
+ * OUTQ_HIGH_WATER.
+ */
+int outq_send(OUT_QUEUE *q, JEUX_PACKET_HEADER **hdrs, void **data, int n);
+
+/*
+ * Hold back packets sent to a queue, so that a run of them can later go
+ * out together in one gather write.  Once OUTQ_LOW_WATER bytes are held
+ * back they are sent anyway, so a corked queue, like any other, only
+ * reaches OUTQ_HIGH_WATER if the peer is not reading.
+ *
+ * @param q  The OUT_QUEUE.
+ */
+void outq_cork(OUT_QUEUE *q);
+
+/*
+ * Stop holding back packets, and send everything that has been queued.
+ *
+ * @param q  The OUT_QUEUE.
+ * @return 0 if the packets were sent or left for the writer thread,
+ * -1 if the connection has failed.
+ */
+int outq_uncork(OUT_QUEUE *q);
+
+/*
+ * Close the connection.  Anything still queued is discarded, and no more
+ * packets are accepted.  The file descriptor is closed as soon as the
+ * writer thread no longer refers to it.
+ *
+ * @param q  The OUT_QUEUE.
+ */
+void outq_close(OUT_QUEUE *q);
+
+/*
+ * Discard the caller's reference to a queue, closing it first if that has
+ * not already been done.  The queue is freed once the writer thread has
+ * also let go of it.
+ *
+ * @param q  The OUT_QUEUE.
+ */
+void outq_destroy(OUT_QUEUE *q);
+
+#endif
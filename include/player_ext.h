@@ -0,0 +1,22 @@
+#ifndef PLAYER_EXT_H
+#define PLAYER_EXT_H
+
+#include "player.h"
+
+/*
+ * Additional PLAYER operations, beyond those in player.h.
+ *
+ * Every PLAYER is on the leaderboard (see leaderboard.h) from its
+ * creation until it is freed, and player_post_result() keeps its place
+ * there up to date.
+ */
+
+/*
+ * Get the rank of a player among all players, by rating.
+ *
+ * @param player  The PLAYER that is to be queried.
+ * @return  One more than the number of players rated above it.
+ */
+int player_get_rank(PLAYER *player);
+
+#endif
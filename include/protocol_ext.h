@@ -0,0 +1,74 @@
+#ifndef PROTOCOL_EXT_H
+#define PROTOCOL_EXT_H
+
+#include "protocol.h"
+
+/*
+ * Additional protocol entry points, beyond those in protocol.h.
+ */
+
+/*
+ * Flags that a client may set in the role field of its LOGIN packet.
+ *
+ * JEUX_LOGIN_COMPACT_STATE asks for game states (the payloads of MOVED
+ * and ACCEPTED, and of the ACK to an ACCEPT) to be sent in the compact
+ * binary form described with game_pack_state() in game_ext.h, three
+ * bytes long for tic-tac-toe, instead of as text.  Clients that do not set it get text,
+ * as before.
+ */
+#define JEUX_LOGIN_COMPACT_STATE 0x01
+
+/*
+ * The payload of an INVITE is the name of the user invited, which may be
+ * followed by a tab and the geometry of the game, "m,n,k", for a game on
+ * a board of m rows and n columns won by k in a row (see game_ext.h).
+ * Without one the game is tic-tac-toe, 3,3,3.  The INVITED packet sent
+ * to the user invited carries the geometry in the same way, after the
+ * name of the user inviting, unless the game is tic-tac-toe.
+ *
+ * Moves are square numbers, counted row by row from 1 at the top left,
+ * and game states are rendered as for tic-tac-toe, but as large as the
+ * board.  A compact state (see JEUX_LOGIN_COMPACT_STATE) has two bits
+ * per square, so it is longer than three bytes on a larger board.
+ */
+
+/*
+ * A USERS packet with a payload asks for one page of the listing of
+ * logged-in users rather than the whole of it.  The payload is a list of
+ * fields separated by tabs, each of the form key=value, all optional:
+ *
+ *   after=NAME   Start after the user NAME.
+ *   prefix=STR   Only users whose names begin with STR.
+ *   min=N        Only users rated at least N.
+ *   max=N        Only users rated at most N.
+ *   limit=N      At most N users; the default, and the largest allowed,
+ *                is JEUX_USERS_PAGE_MAX.
+ *
+ * Users are listed in order of name, in the same format as the reply to
+ * a USERS packet without a payload.  The role field of the ACK is
+ * JEUX_USERS_MORE if more users match after those on the page, in which
+ * case the name on the last line is the "after" value for the next page.
+ * A page is also cut short if it would not fit in a packet.
+ *
+ * With min or max, users are listed in order of rating instead, lowest
+ * first and by name among equal ratings, and "after" names a user rated
+ * "min": the next page is asked for with the name on the last line as
+ * "after" and its rating as "min".
+ */
+#define JEUX_USERS_MORE 0x01
+#define JEUX_USERS_PAGE_MAX 100
+
+/*
+ * A LEADERS packet asks for the best-rated players, among all that have
+ * ever logged in.  Its id field is the number of players wanted, or 0
+ * for JEUX_LEADERS_DEFAULT, and if its role field has JEUX_LEADERS_SELF
+ * set the requesting player is added at the end, whatever its rank.
+ * The ACK carries one "rank<TAB>name<TAB>rating" line per player, best
+ * first, in the same layout as the reply to USERS; players with equal
+ * ratings share a rank.
+ */
+#define JEUX_LEADERS_PKT 18
+#define JEUX_LEADERS_SELF 0x01
+#define JEUX_LEADERS_DEFAULT 10
+
+#endif
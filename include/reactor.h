@@ -0,0 +1,32 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+/*
+ * Event-driven alternative to the thread-per-connection service loop.
+ * A small, fixed number of reactor threads each own an epoll instance
+ * and multiplex all of the client sockets assigned to them.  Packets are
+ * assembled incrementally from whatever data happens to be available on
+ * a socket, so that no thread ever blocks waiting for a particular
+ * client, and each complete packet is handed to jeux_dispatch_packet().
+ */
+
+/*
+ * Start the reactor threads.
+ *
+ * @param nthreads  The number of reactor threads to start.
+ * @return 0 if the reactors were started, otherwise -1.
+ */
+int reactor_init(int nthreads);
+
+/*
+ * Hand a newly accepted connection over to one of the reactor threads,
+ * which will register it with the client registry and service it from
+ * then on.
+ *
+ * @param fd  The file descriptor of the connection.
+ * @return 0 if the connection was accepted by a reactor, otherwise -1,
+ * in which case the file descriptor has been closed.
+ */
+int reactor_add(int fd);
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef RECV_BUFFER_H
+#define RECV_BUFFER_H
+
+#include "protocol.h"
+
+/*
+ * A RECV_BUFFER accumulates the bytes arriving on one client connection.
+ * Each fill pulls in as much data as the kernel has available (up to the
+ * free space in the buffer) with a single receive call, after which any
+ * number of complete packets can be parsed out of the buffer without
+ * further system calls.  A RECV_BUFFER belongs to whichever thread is
+ * servicing the connection and is not thread-safe.
+ *
+ * Payloads are handed out as slices of the buffer rather than as separate
+ * allocations.  A slice is null-terminated, and remains valid only until
+ * the next call that parses or receives on the same RECV_BUFFER.
+ */
+typedef struct recv_buffer RECV_BUFFER;
+
+/*
+ * Create a receive buffer for a connection.
+ *
+ * @param fd  The file descriptor of the connection.
+ * @return  The new RECV_BUFFER, or NULL if it could not be allocated.
+ */
+RECV_BUFFER *rbuf_create(int fd);
+
+/*
+ * Free a receive buffer.  Any slice previously handed out is invalidated.
+ *
+ * @param rb  The RECV_BUFFER to be freed.
+ */
+void rbuf_destroy(RECV_BUFFER *rb);
+
+/*
+ * Receive whatever data is available on the connection into the buffer,
+ * with a single receive call.
+ *
+ * @param rb  The RECV_BUFFER.
+ * @param flags  Flags to be passed to the receive call, e.g. MSG_DONTWAIT.
+ * @return  The number of bytes received, 0 at EOF, or -1 with errno set.
+ */
+ssize_t rbuf_fill(RECV_BUFFER *rb, int flags);
+
+/*
+ * Make room at the end of the buffer for more data to be received,
+ * without receiving anything.  This and rbuf_commit() are for a caller
+ * that receives into the buffer itself, e.g. asynchronously; nothing
+ * else may be done with the buffer in between.
+ *
+ * @param rb  The RECV_BUFFER.
+ * @param lenp  Set to the number of bytes that may be received.
+ * @return  Where the data is to be received, or NULL with errno set if
+ * the buffer could not be grown.
+ */
+char *rbuf_space(RECV_BUFFER *rb, size_t *lenp);
+
+/*
+ * Add data received into the space returned by rbuf_space() to the
+ * buffer.
+ *
+ * @param rb  The RECV_BUFFER.
+ * @param n  The number of bytes received.
+ */
+void rbuf_commit(RECV_BUFFER *rb, size_t n);
+
+/*
+ * Parse the next complete packet out of the buffer, if there is one,
+ * without receiving any more data.
+ *
+ * @param rb  The RECV_BUFFER.
+ * @param hdr  Storage for the packet header, in network byte order.
+ * @param payloadp  Pointer to a variable into which to store a slice
+ * containing the payload, or NULL if the packet has none.
+ * @return 1 if a packet was parsed, 0 if no complete packet is buffered.
+ */
+int rbuf_next_packet(RECV_BUFFER *rb, JEUX_PACKET_HEADER *hdr, void **payloadp);
+
+/*
+ * Determine whether a complete packet is already buffered, so that the
+ * next rbuf_next_packet() call will succeed without receiving any more
+ * data.  Like rbuf_next_packet(), this invalidates any slice previously
+ * handed out.
+ *
+ * @param rb  The RECV_BUFFER.
+ * @return 1 if a complete packet is buffered, otherwise 0.
+ */
+int rbuf_has_packet(RECV_BUFFER *rb);
+
+/*
+ * Receive a packet, blocking until one is available.  This is the
+ * buffered counterpart of proto_recv_packet().
+ *
+ * @param rb  The RECV_BUFFER.
+ * @param hdr  Storage for the packet header, in network byte order.
+ * @param payloadp  Pointer to a variable into which to store a slice
+ * containing the payload, or NULL if the packet has none.
+ * @return 0 if a packet was received, -1 on EOF or error.
+ */
+int rbuf_recv_packet(RECV_BUFFER *rb, JEUX_PACKET_HEADER *hdr, void **payloadp);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef REFCOUNT_H
+#define REFCOUNT_H
+
+#include <stdatomic.h>
+
+/*
+ * A REFCOUNT is an atomic reference count, shared by the reference-counted
+ * objects (GAME, PLAYER, INVITATION and CLIENT) so that taking and
+ * dropping references does not need their mutexes.
+ *
+ * Taking a reference only requires that the caller already holds one,
+ * so the increment is relaxed.  Every decrement is a release, so that all
+ * uses of the object through a reference happen before it is dropped, and
+ * the thread that drops the last reference issues an acquire fence before
+ * freeing the object, so that it sees the effects of all of those uses.
+ */
+typedef atomic_int REFCOUNT;
+
+/*
+ * Take a reference.
+ *
+ * @param rc  The REFCOUNT.
+ * @return  The new reference count.
+ */
+static inline int refcount_inc(REFCOUNT *rc) {
+	return atomic_fetch_add_explicit(rc, 1, memory_order_relaxed) + 1;
+}
+
+/*
+ * Drop a reference.
+ *
+ * @param rc  The REFCOUNT.
+ * @return  The new reference count.  If this is zero, the caller dropped
+ * the last reference and is responsible for freeing the object.
+ */
+static inline int refcount_dec(REFCOUNT *rc) {
+	int count = atomic_fetch_sub_explicit(rc, 1, memory_order_release) - 1;
+	if(count == 0)
+		atomic_thread_fence(memory_order_acquire);
+	return count;
+}
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef SERVER_EXT_H
+#define SERVER_EXT_H
+
+#include "client_registry.h"
+#include "recv_buffer.h"
+
+/*
+ * Additional server entry points, shared by the thread-per-connection
+ * service loop and the event-driven connection handlers.
+ */
+
+/*
+ * Run the service loop for a connection on the calling thread, returning
+ * once the connection has ended and the client has been cleaned up.
+ *
+ * @param fd  The file descriptor of the connection.
+ */
+void jeux_serve_connection(int fd);
+
+/*
+ * The most receive calls that jeux_serve_ready() makes on a connection
+ * before giving the other connections served by the same thread a turn.
+ */
+#define JEUX_READS_PER_WAKEUP 4
+
+/*
+ * Service a non-blocking connection that has become readable, without
+ * waiting for anything: receive what is available and carry out every
+ * request that is complete, answering each batch of requests together.
+ * At most JEUX_READS_PER_WAKEUP receives are made, so that a client that
+ * keeps streaming requests cannot hold on to the calling thread; a
+ * caller that stops with data still unread is told about it again by
+ * epoll, which is level-triggered.
+ *
+ * @param client  The CLIENT of the connection.
+ * @param rb  The receive buffer of the connection.
+ * @return 0 if the connection should remain open, -1 if it has reached
+ * EOF, failed, or been asked to shut down by the dispatcher.
+ */
+int jeux_serve_ready(CLIENT *client, RECV_BUFFER *rb);
+
+/*
+ * Carry out every request that is complete in a connection's receive
+ * buffer, answering them together.
+ *
+ * @param client  The CLIENT of the connection.
+ * @param rb  The receive buffer of the connection.
+ * @return 0 if the connection should remain open, -1 if it has been
+ * asked to shut down by the dispatcher.
+ */
+int jeux_dispatch_buffered(CLIENT *client, RECV_BUFFER *rb);
+
+/*
+ * Register a newly accepted connection with the client registry.
+ *
+ * @param fd  The file descriptor of the connection.
+ * @return  The newly registered CLIENT, otherwise NULL, in which case
+ * the file descriptor has been closed.
+ */
+CLIENT *jeux_client_open(int fd);
+
+/*
+ * Tear down the service state of a client whose connection has ended:
+ * log it out if it was logged in, unregister it and close its socket.
+ *
+ * @param client  The CLIENT whose connection has ended.  The reference
+ * held by the registry is discarded, so it must not be used afterwards.
+ */
+void jeux_client_close(CLIENT *client);
+
+/*
+ * Carry out a single request received from a client and send the
+ * corresponding ACK or NACK.
+ *
+ * @param client  The CLIENT from which the packet was received.
+ * @param hdr  The header of the received packet, in network byte order.
+ * It is used as scratch storage for the reply and is overwritten.
+ * @param data  The null-terminated payload of the packet, or NULL if
+ * there was none.  It remains owned by the caller.
+ * @return 0 if the service loop should continue, -1 if the connection
+ * should be shut down.
+ */
+int jeux_dispatch_packet(CLIENT *client, JEUX_PACKET_HEADER *hdr, void *data);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef SERVICE_POOL_H
+#define SERVICE_POOL_H
+
+/*
+ * A fixed pool of pre-spawned service threads.  Accepted connections are
+ * placed on a bounded queue, from which idle workers take them and
+ * register them with an epoll instance shared by the pool.  A poller
+ * thread waits on that instance and puts each connection that becomes
+ * readable back on the queue, and a worker that takes it carries out
+ * whatever requests have arrived, without waiting for more, before
+ * moving on to the next.  A worker is thus only ever busy with a client
+ * that has something to be done, so idle clients cost no worker and the
+ * number of workers bounds only the number of requests being carried
+ * out at once.  The queue depth bounds the number of connections, new
+ * or ready, waiting for a worker; when it is full, new connections are
+ * refused.
+ */
+
+/*
+ * The maximum time, in milliseconds, that the accepting thread will wait
+ * for room in a full queue before rejecting a connection.
+ */
+#define POOL_ADMIT_WAIT_MS 50
+
+/*
+ * Start the service workers, and the thread that waits for their
+ * connections to become ready.
+ *
+ * @param nworkers  The number of worker threads.
+ * @param qdepth  The capacity of the queue of connections waiting for
+ * a worker.
+ * @return 0 if the pool was started, otherwise -1.
+ */
+int pool_init(int nworkers, int qdepth);
+
+/*
+ * Offer an accepted connection to the pool.  If the queue is full, the
+ * caller is held back for up to POOL_ADMIT_WAIT_MS, after which the
+ * connection is refused and closed.
+ *
+ * @param fd  The file descriptor of the connection.
+ * @return 0 if the connection was queued, otherwise -1.
+ */
+int pool_submit(int fd);
+
+#endif
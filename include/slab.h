@@ -0,0 +1,75 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+
+/*
+ * Per-thread caches of fixed-size objects, for the objects the server
+ * creates and destroys all the time.
+ *
+ * Each type of object has its own cache.  Memory is taken from malloc()
+ * a slab of SLAB_OBJECTS objects at a time and is never given back; an
+ * object that is freed goes on a free list private to the thread that
+ * frees it, from which the same thread's next allocation is taken
+ * without any locking.  A thread whose list grows past SLAB_LOCAL_MAX
+ * objects passes a batch of SLAB_BATCH of them to a list shared by all
+ * threads, and a thread whose list is empty takes a batch from there
+ * before carving a new slab, so objects freed on one thread and
+ * allocated on another still get reused.  A thread's list is returned
+ * to the shared one when the thread exits.
+ */
+#define SLAB_OBJECTS 64
+#define SLAB_LOCAL_MAX 128
+#define SLAB_BATCH 32
+
+typedef enum slab_type {
+	SLAB_GAME,		/* GAME objects. */
+	SLAB_GAME_STATE,	/* Copies of tic-tac-toe GAME_STATEs. */
+	SLAB_INVITATION,	/* INVITATION objects. */
+	SLAB_PLAYER,		/* PLAYER objects. */
+	SLAB_COUNT
+} SLAB_TYPE;
+
+/*
+ * Allocator statistics for one type of object.
+ */
+typedef struct slab_stats {
+	long allocs;		/* Objects allocated. */
+	long frees;		/* Objects freed. */
+	long slabs;		/* Slabs taken from malloc(). */
+	long transfers;		/* Batches passed through the shared list. */
+} SLAB_STATS;
+
+/*
+ * Allocate an object.
+ *
+ * @param type  The type of object.
+ * @param size  Its size, which must be the same for every object of the
+ * type.
+ * @return  The object, uninitialized, or NULL if memory is exhausted.
+ */
+void *slab_alloc(SLAB_TYPE type, size_t size);
+
+/*
+ * Free an object allocated by slab_alloc().
+ *
+ * @param type  The type of object.
+ * @param obj  The object.
+ */
+void slab_free(SLAB_TYPE type, void *obj);
+
+/*
+ * Get the allocator statistics for a type of object.
+ *
+ * @param type  The type of object.
+ * @param stats  Set to its statistics.
+ */
+void slab_get_stats(SLAB_TYPE type, SLAB_STATS *stats);
+
+/*
+ * Print the allocator statistics for every type of object.  Like
+ * stats_report(), this only prints anything in builds with INFO defined.
+ */
+void slab_report(void);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef STATS_H
+#define STATS_H
+
+/*
+ * Server-wide event counters.  Counters are updated with relaxed atomic
+ * increments, so they are cheap enough to leave in hot paths, and are
+ * printed by stats_report() when the server shuts down.
+ */
+typedef enum stats_counter {
+	STAT_PACKETS_RECEIVED,	/* Packets parsed out of receive buffers. */
+	STAT_RECV_ALLOCS,	/* Heap allocations made on the receive path. */
+	STAT_DRAWS_ADJUDICATED,	/* Games ended as draws before the board filled. */
+	STAT_MOVES_SAVED,	/* Moves those games would still have taken. */
+	STAT_CONNECTIONS_REFUSED,	/* Connections refused by the pool or reactors. */
+	STAT_COUNT
+} STAT;
+
+/*
+ * Add to a counter.
+ *
+ * @param stat  The counter.
+ * @param n  The amount to add.
+ */
+void stats_add(STAT stat, long n);
+
+/*
+ * Get the current value of a counter.
+ *
+ * @param stat  The counter.
+ * @return  Its value.
+ */
+long stats_get(STAT stat);
+
+/*
+ * Print all counters.
+ */
+void stats_report(void);
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef STRMAP_H
+#define STRMAP_H
+
+#include <stdint.h>
+
+/*
+ * A STRMAP is a hash table mapping null-terminated strings to opaque
+ * values, using open addressing with linear probing.  Lookups, insertions
+ * and removals take expected constant time.
+ *
+ * The map does not copy its keys: a key must remain valid, and unchanged,
+ * for as long as it is in the map.  A STRMAP is not thread-safe; the
+ * caller is responsible for locking.
+ */
+typedef struct strmap STRMAP;
+
+/*
+ * Hash a string, with the same function as is used by a STRMAP.
+ *
+ * @param key  The string to be hashed.
+ * @return  Its 32-bit FNV-1a hash.
+ */
+uint32_t strmap_hash(const char *key);
+
+/*
+ * Create a new, empty map.
+ *
+ * @return  The newly created map, or NULL if creation failed.
+ */
+STRMAP *strmap_init(void);
+
+/*
+ * Finalize a map, freeing its resources.  The keys and values it still
+ * contains are not freed.
+ *
+ * @param map  The map to be finalized, which must not be used again.
+ */
+void strmap_fini(STRMAP *map);
+
+/*
+ * Look up a key.
+ *
+ * @param map  The map.
+ * @param key  The key to be looked up.
+ * @return  The value stored under the key, or NULL if there is none.
+ */
+void *strmap_get(STRMAP *map, const char *key);
+
+/*
+ * Store a value under a key that is not already in the map.
+ *
+ * @param map  The map.
+ * @param key  The key, which is retained by the map.
+ * @param value  The value, which must not be NULL.
+ * @return 0 if the value was stored, -1 if the key is already in the map
+ * or the map could not grow.
+ */
+int strmap_put(STRMAP *map, const char *key, void *value);
+
+/*
+ * Remove a key from the map.
+ *
+ * @param map  The map.
+ * @param key  The key to be removed.
+ * @return  The value that was stored under the key, or NULL if there
+ * was none.
+ */
+void *strmap_remove(STRMAP *map, const char *key);
+
+/*
+ * Get the number of keys in the map.
+ *
+ * @param map  The map.
+ * @return  The number of keys.
+ */
+int strmap_count(STRMAP *map);
+
+#endif
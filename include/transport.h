@@ -0,0 +1,140 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*
+ * Selection of the mechanism by which the event-driven reactors (see
+ * reactor.h) wait for and receive client data.
+ *
+ * With TRANSPORT_RW a reactor waits with epoll_wait(2) and then calls
+ * recv(2) on each connection that is ready.  With TRANSPORT_URING it
+ * keeps a read outstanding on every connection on its own io_uring
+ * instance, and a single io_uring_enter(2) call both re-arms the reads
+ * of the connections it has just served and collects whichever data has
+ * arrived since, so receiving a request costs no system call of its own.
+ * Sends, and the blocking service loops, use ordinary system calls
+ * either way; submitting a single operation through io_uring and waiting
+ * for it would cost just as many.  The packet wire format is the same
+ * either way.
+ */
+typedef enum transport {
+	TRANSPORT_RW,
+	TRANSPORT_URING
+} TRANSPORT;
+
+/*
+ * The transport currently in use.  This is set once, by transport_init(),
+ * before any connections are accepted.
+ */
+extern TRANSPORT proto_transport;
+
+/*
+ * Select the transport to be used for all connections.  If io_uring is
+ * requested but is not supported by the running kernel (or is disallowed
+ * by the environment), the ordinary read/write transport is used instead.
+ *
+ * @param requested  The transport that is desired.
+ * @return  The transport that was actually selected.
+ */
+TRANSPORT transport_init(TRANSPORT requested);
+
+/*
+ * A completed read on a TRANSPORT_RING.
+ */
+typedef struct transport_event {
+	void *tag;		/* The tag given when the read was queued. */
+	int res;		/* Bytes read, 0 at EOF, or a negated errno. */
+} TRANSPORT_EVENT;
+
+typedef struct transport_ring TRANSPORT_RING;
+
+/*
+ * The most reads that may be outstanding on a ring at once.  Its
+ * completion queue has room for a completion for each of them, so that
+ * none can overflow it.
+ */
+#define TRANSPORT_RING_MAX_READS 16384
+
+/*
+ * Create an io_uring instance for the calling thread to wait on.
+ *
+ * @return  The new ring, or NULL if io_uring is not available.
+ */
+TRANSPORT_RING *transport_ring_create(void);
+
+/*
+ * Destroy an io_uring instance.  Reads still in progress are cancelled.
+ *
+ * @param ring  The ring.
+ */
+void transport_ring_destroy(TRANSPORT_RING *ring);
+
+/*
+ * Queue a read on a ring, to be submitted with the next wait.  This has
+ * the semantics of read(2), so it serves for sockets and for eventfds
+ * alike.  The storage must remain valid until the read completes.
+ *
+ * @param ring  The ring.
+ * @param fd  The descriptor from which to read.
+ * @param buf  Storage for the bytes read.
+ * @param len  The maximum number of bytes to read.
+ * @param tag  Returned with the completion, to identify it.
+ * @return 0 if the read was queued, otherwise -1 with errno set.
+ */
+int transport_ring_read(TRANSPORT_RING *ring, int fd, void *buf, size_t len, void *tag);
+
+/*
+ * Submit every read queued on a ring, and collect completed reads,
+ * waiting for one if none has completed yet.  This takes at most one
+ * system call, however many reads are submitted or collected, except
+ * when the kernel has had to hold completions back, in which case
+ * those are collected first and the reads are left for the next wait.
+ *
+ * @param ring  The ring.
+ * @param events  Storage for the completions.
+ * @param max  The most completions to be collected.
+ * @return  The number of completions collected, or -1 with errno set.
+ */
+int transport_ring_wait(TRANSPORT_RING *ring, TRANSPORT_EVENT *events, int max);
+
+/*
+ * Receive whatever data is available on a socket, up to a limit.  This
+ * is recv(2): a single receive is no cheaper through io_uring.
+ *
+ * @param fd  The socket from which to receive.
+ * @param buf  Storage for the received bytes.
+ * @param len  The maximum number of bytes to receive.
+ * @param flags  Flags as for recv(2), e.g. MSG_DONTWAIT.
+ * @return  The number of bytes received, 0 at EOF, or -1 with errno set.
+ */
+ssize_t transport_recv(int fd, void *buf, size_t len, int flags);
+
+/*
+ * Send the entire contents of a gather list on a socket.  This is a
+ * writev(2) loop, in which a partial send just resumes from wherever it
+ * left off, so a caller can hand over any number of packets and expect
+ * them to go out in as few system calls (and TCP segments) as the kernel
+ * allows.
+ *
+ * @param fd  The socket on which to send.
+ * @param iov  The buffers to be sent, in order.  The array is modified
+ * to track progress across partial sends.
+ * @param iovcnt  The number of entries in iov, at most IOV_MAX.
+ * @return 0 if everything was sent, otherwise -1 with errno set.
+ */
+int transport_sendv(int fd, struct iovec *iov, int iovcnt);
+
+/*
+ * Make a single non-blocking attempt to send a gather list on a socket.
+ *
+ * @param fd  The socket on which to send.
+ * @param iov  The buffers to be sent, in order.
+ * @param iovcnt  The number of entries in iov, at most IOV_MAX.
+ * @return  The number of bytes sent, which may be less than the total,
+ * or -1 with errno set (EAGAIN if the socket buffer is full).
+ */
+ssize_t transport_trysendv(int fd, struct iovec *iov, int iovcnt);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef WORK_QUEUE_H
+#define WORK_QUEUE_H
+
+/*
+ * A WORK_QUEUE is a bounded, thread-safe FIFO of opaque items that may be
+ * used concurrently by any number of producer and consumer threads.
+ * Producers may either block until there is room in the queue, or give up
+ * after a bounded wait, which allows them to apply admission control when
+ * consumers fall behind.
+ */
+typedef struct work_queue WORK_QUEUE;
+
+/*
+ * Create a new, empty work queue.
+ *
+ * @param capacity  The maximum number of items the queue can hold.
+ * @return  The newly created queue, or NULL if creation failed.
+ */
+WORK_QUEUE *wq_init(int capacity);
+
+/*
+ * Finalize a work queue, freeing its resources.  Items still in the
+ * queue are discarded.
+ *
+ * @param wq  The queue to be finalized, which must not be used again.
+ */
+void wq_fini(WORK_QUEUE *wq);
+
+/*
+ * Add an item to the tail of a work queue, blocking until there is room.
+ *
+ * @param wq  The queue.
+ * @param item  The item to be added.
+ */
+void wq_put(WORK_QUEUE *wq, void *item);
+
+/*
+ * Add an item to the tail of a work queue, waiting at most a specified
+ * time for room to become available.
+ *
+ * @param wq  The queue.
+ * @param item  The item to be added.
+ * @param msec  The maximum time to wait, in milliseconds.  If zero, the
+ * call does not block at all.
+ * @return 0 if the item was added, -1 if the queue remained full.
+ */
+int wq_put_timed(WORK_QUEUE *wq, void *item, int msec);
+
+/*
+ * Remove and return the item at the head of a work queue, blocking
+ * until one is available.
+ *
+ * @param wq  The queue.
+ * @return  The item removed from the queue.
+ */
+void *wq_get(WORK_QUEUE *wq);
+
+/*
+ * Get the number of items currently in a work queue.
+ *
+ * @param wq  The queue.
+ * @return  The number of queued items.
+ */
+int wq_length(WORK_QUEUE *wq);
+
+#endif
@@ -0,0 +1,130 @@
+#include "acceptor.h"
+#include "debug.h"
+#include "csapp.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+typedef struct acceptor {
+	int listenfd;
+	ACCEPT_HANDLER *handler;
+	pthread_t tid;
+} ACCEPTOR;
+
+/*
+ * Open a listening socket on a port that can be shared with other
+ * sockets opened in the same way (SO_REUSEPORT).
+ *
+ * @param port  The port, as a decimal string.
+ * @return  The listening socket, or -1 with errno set on error.
+ */
+int open_reuseport_listenfd(char *port) {
+	struct addrinfo hints, *listp, *p;
+	int listenfd = -1, rc, optval = 1;
+
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG | AI_NUMERICSERV;
+	if((rc = getaddrinfo(NULL, port, &hints, &listp)) != 0) {
+		error("getaddrinfo failed (port %s): %s", port, gai_strerror(rc));
+		errno = EINVAL;
+		return -1;
+	}
+
+	for(p = listp; p; p = p->ai_next) {
+		if((listenfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0)
+			continue;
+		if(setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(int)) == 0 &&
+		   setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(int)) == 0 &&
+		   bind(listenfd, p->ai_addr, p->ai_addrlen) == 0)
+			break;
+		close(listenfd);
+		listenfd = -1;
+	}
+	freeaddrinfo(listp);
+	if(listenfd < 0)
+		return -1;
+
+	if(listen(listenfd, LISTENQ) < 0) {
+		close(listenfd);
+		return -1;
+	}
+	return listenfd;
+}
+
+/*
+ * Accept connections on a listening socket forever, passing each one to
+ * a handler.
+ *
+ * @param listenfd  The listening socket.
+ * @param handler  The function to be called for each connection.
+ */
+void acceptor_loop(int listenfd, ACCEPT_HANDLER *handler) {
+	struct sockaddr_storage clientaddr;
+	socklen_t clientlen;
+	int connfd;
+
+	while(1) {
+		clientlen = sizeof(struct sockaddr_storage);
+		if((connfd = accept(listenfd, (SA *)&clientaddr, &clientlen)) < 0) {
+			error("Accept: %s\n", strerror(errno));
+			continue;
+		}
+		handler(connfd);
+	}
+}
+
+static void *acceptor_thread(void *arg) {
+	ACCEPTOR *acceptor = arg;
+	debug("%ld: Acceptor listening on fd %d", pthread_self(), acceptor->listenfd);
+	acceptor_loop(acceptor->listenfd, acceptor->handler);
+	return NULL;
+}
+
+/*
+ * Open one SO_REUSEPORT listening socket per acceptor, and start a thread
+ * running acceptor_loop() on each of them but the last, which is left for
+ * the caller to run.
+ *
+ * @param port  The port to listen on.
+ * @param nacceptors  The number of acceptors.
+ * @param handler  The function to be called for each connection.
+ * @return  The listening socket for the caller's own acceptor, or -1 if
+ * the acceptors could not be set up.
+ */
+int acceptor_init(char *port, int nacceptors, ACCEPT_HANDLER *handler) {
+	ACCEPTOR *acceptors;
+	if(nacceptors <= 0) {
+		error("Invalid number of acceptors: %d", nacceptors);
+		return -1;
+	}
+	if(!(acceptors = calloc(nacceptors, sizeof(ACCEPTOR)))) {
+		error("calloc failed");
+		return -1;
+	}
+
+	// Bind every socket before starting any thread, so that a port that
+	// is in use is reported before anything has been accepted.
+	for(int i = 0; i < nacceptors; i++) {
+		if((acceptors[i].listenfd = open_reuseport_listenfd(port)) < 0) {
+			error("bind: %s", strerror(errno));
+			while(i-- > 0)
+				close(acceptors[i].listenfd);
+			free(acceptors);
+			return -1;
+		}
+		acceptors[i].handler = handler;
+	}
+	for(int i = 0; i < nacceptors - 1; i++) {
+		if(pthread_create(&acceptors[i].tid, NULL, acceptor_thread, &acceptors[i])) {
+			// The kernel would keep routing connections to the
+			// orphaned socket, so it must not be left open.
+			error("pthread_create failed");
+			close(acceptors[i].listenfd);
+		}
+	}
+	debug("%ld: Started %d acceptor(s) on port %s", pthread_self(), nacceptors, port);
+	return acceptors[nacceptors - 1].listenfd;
+}
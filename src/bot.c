@@ -0,0 +1,256 @@
+#include "bot.h"
+#include "client_registry_ext.h"
+#include "client_ext.h"
+#include "game_solver.h"
+#include "work_queue.h"
+#include "debug.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+/*
+ * Capacity of the queue of events waiting for a bot worker.  A thread
+ * delivering to a bot waits for room if the queue is full.
+ */
+#define BOT_QUEUE_DEPTH 1024
+
+typedef struct bot {
+	CLIENT *client;
+	int level;
+} BOT;
+
+/*
+ * Something a bot has to react to.  The event holds a reference to the
+ * bot's CLIENT, so that it stays valid even if the bot is shut down
+ * before the event is handled.
+ */
+typedef struct bot_event {
+	BOT *bot;
+	CLIENT *client;
+	int type;
+	int id;
+	struct bot_event *next;
+} BOT_EVENT;
+
+static BOT *bots;
+static int bot_count;
+static CLIENT_REGISTRY *bot_creg;
+static WORK_QUEUE *bot_queue;
+static atomic_int bot_stopping;
+static __thread BOT_EVENT *bot_pending, *bot_pending_tail;
+
+static void *bot_worker(void *arg);
+
+/*
+ * Start the bot workers and log in a number of bots.
+ *
+ * @param creg  The client registry in which the bots are registered.
+ * @param preg  The player registry from which their players come.
+ * @param nbots  The number of bots.
+ * @param level  The level at which they play.
+ * @return 0 if the bots were started, otherwise -1.
+ */
+int bot_init(CLIENT_REGISTRY *creg, PLAYER_REGISTRY *preg, int nbots, int level) {
+	if(nbots <= 0 || level < 0 || level > BOT_LEVEL_PERFECT) {
+		error("Invalid bots: %d at level %d", nbots, level);
+		return -1;
+	}
+	if(!(bots = calloc(nbots, sizeof(BOT)))) {
+		error("calloc failed");
+		return -1;
+	}
+	if(!(bot_queue = wq_init(BOT_QUEUE_DEPTH)))
+		return -1;
+	bot_creg = creg;
+
+	for(int i = 0; i < BOT_WORKERS; i++) {
+		pthread_t tid;
+		if(pthread_create(&tid, NULL, bot_worker, NULL)) {
+			error("pthread_create failed after %d bot workers", i);
+			if(i == 0)
+				return -1;
+			break;
+		}
+		pthread_detach(tid);
+	}
+
+	char name[32];
+	for(bot_count = 0; bot_count < nbots; bot_count++) {
+		BOT *bot = &bots[bot_count];
+		PLAYER *player;
+		snprintf(name, sizeof(name), "bot%d", bot_count + 1);
+		if(!(bot->client = creg_register(creg, -1)))
+			return -1;
+		bot->level = level;
+		client_set_bot(bot->client, bot);
+		if(!(player = preg_register(preg, name)) || client_login(bot->client, player) < 0) {
+			error("Failed to log in bot [%s]", name);
+			if(player)
+				player_unref(player, "because bot could not log in");
+			creg_unregister(creg, bot->client);
+			return -1;
+		}
+		player_unref(player, "now that bot is logged in");
+	}
+	debug("%ld: Started %d bots at level %d", pthread_self(), bot_count, level);
+	return 0;
+}
+
+/*
+ * Log out and unregister all the bots, resigning any games they are
+ * playing, and stop the bot workers.  This does nothing if bot_init()
+ * was never called.
+ */
+void bot_fini(void) {
+	// The workers are left blocked on the queue, like the service pool's;
+	// anything still queued holds its own reference to its bot's CLIENT.
+	atomic_store(&bot_stopping, 1);
+	for(int i = 0; i < bot_count; i++) {
+		client_logout(bots[i].client);
+		creg_unregister(bot_creg, bots[i].client);
+	}
+	bot_count = 0;
+}
+
+/*
+ * Hand a bot packets that were sent to it, as client_send_packets() does
+ * for a CLIENT that is a bot.  The bot reacts to them later, on a bot
+ * worker thread, once the calling thread has called bot_flush().
+ *
+ * @param bot  The bot.
+ * @param hdrs  The packet headers, in network byte order.
+ * @param data  The corresponding payloads, which are not used.
+ * @param n  The number of packets.
+ * @return 0 if the packets were taken, -1 if the bots are shutting down.
+ */
+int bot_deliver(BOT *bot, JEUX_PACKET_HEADER **hdrs, void **data, int n) {
+	if(atomic_load(&bot_stopping))
+		return -1;
+	for(int i = 0; i < n; i++) {
+		// Only an invitation or an opponent's move needs an answer.
+		// Everything else, including the ENDED that a bot's own move
+		// brings, is dropped.
+		if(hdrs[i]->type != JEUX_INVITED_PKT && hdrs[i]->type != JEUX_MOVED_PKT)
+			continue;
+		if(i + 1 < n && hdrs[i + 1]->type == JEUX_ENDED_PKT)
+			continue;
+		BOT_EVENT *event;
+		if(!(event = malloc(sizeof(BOT_EVENT)))) {
+			error("malloc failed");
+			return -1;
+		}
+		*event = (BOT_EVENT) {
+			.bot = bot,
+			.client = client_ref(bot->client, "for bot event"),
+			.type = hdrs[i]->type,
+			.id = hdrs[i]->id,
+			.next = NULL
+		};
+		if(bot_pending_tail)
+			bot_pending_tail->next = event;
+		else
+			bot_pending = event;
+		bot_pending_tail = event;
+	}
+	return 0;
+}
+
+/*
+ * Deal with an event for which there is no room in the queue, without
+ * waiting for the bot workers: the bot declines the invitation or
+ * resigns the game, so that its opponent is not left waiting for it.
+ */
+static void bot_give_up(BOT_EVENT *event) {
+	debug("%ld: Bot queue full, bot gives up %s %d", pthread_self(),
+	      event->type == JEUX_INVITED_PKT ? "invitation" : "game", event->id);
+	if(event->type == JEUX_INVITED_PKT)
+		client_decline_invitation(event->client, event->id);
+	else
+		client_resign_game(event->client, event->id);
+	client_unref(event->client, "after bot event");
+	free(event);
+}
+
+/*
+ * Pass the packets delivered to bots by the calling thread on to the bot
+ * workers.  The server calls this after replying to each request, so
+ * that a bot's answer to a request (e.g. accepting an invitation) can
+ * never reach the client that made it before the reply does.  This never
+ * waits for the bot workers: if their queue is full, the bot declines
+ * the invitation or resigns the game instead.
+ */
+void bot_flush(void) {
+	BOT_EVENT *event, *pending = bot_pending;
+	bot_pending = bot_pending_tail = NULL;
+	while((event = pending)) {
+		pending = event->next;
+		if(wq_put_timed(bot_queue, event, 0) < 0)
+			bot_give_up(event);
+	}
+}
+
+/*
+ * Pick one of a set of squares at random.
+ *
+ * @return  The square, numbered from 1.
+ */
+static int bot_pick(unsigned int squares, unsigned int *seed) {
+	int k = rand_r(seed) % __builtin_popcount(squares);
+	while(k--)
+		squares &= squares - 1;
+	return __builtin_ctz(squares) + 1;
+}
+
+/*
+ * Make a move for a bot in one of its games, if it is the bot's turn.
+ */
+static void bot_move(BOT_EVENT *event, unsigned int *seed) {
+	GAME *game;
+	GAME_ROLE role;
+	unsigned int x, o;
+	if(!(game = client_get_game(event->client, event->id, &role)))
+		return;
+	int known = game_get_position(game, &x, &o) == 0;
+	int over = game_is_over(game);
+	game_unref(game, "after bot has looked at game");
+	if(!known)
+		return;
+	GAME_ROLE to_move = __builtin_popcount(x) == __builtin_popcount(o) ? FIRST_PLAYER_ROLE
+									    : SECOND_PLAYER_ROLE;
+	if(over || role != to_move)
+		return;
+
+	unsigned int squares = ~(x | o) & 0x1ff;
+	const GAME_SOLUTION *solution = game_solve(x, o);
+	if(solution && solution->best && rand_r(seed) % BOT_LEVEL_PERFECT < event->bot->level)
+		squares = solution->best;
+	char move[4];
+	snprintf(move, sizeof(move), "%d", bot_pick(squares, seed));
+	debug("%ld: Bot plays %s in game %d", pthread_self(), move, event->id);
+	client_make_move(event->client, event->id, move);
+}
+
+static void *bot_worker(void *arg) {
+	unsigned int seed = time(NULL) ^ (unsigned int)pthread_self();
+	while(1) {
+		BOT_EVENT *event = wq_get(bot_queue);
+		if(event->type == JEUX_INVITED_PKT) {
+			// Bots only play tic-tac-toe.
+			GAME_GEOMETRY geometry;
+			char state[CLIENT_STATE_MAX];
+			size_t len;
+			if(client_get_geometry(event->client, event->id, &geometry) == 0 &&
+			   !game_geometry_is_default(&geometry))
+				client_decline_invitation(event->client, event->id);
+			else if(client_accept_invitation_state(event->client, event->id, state, &len) == 0)
+				bot_move(event, &seed);
+		} else {
+			bot_move(event, &seed);
+		}
+		client_unref(event->client, "after bot event");
+		free(event);
+	}
+	return NULL;
+}
@@ -0,0 +1,976 @@
+#include "client_registry.h"
+#include "client_ext.h"
+#include "client_registry_ext.h"
+#include "out_queue.h"
+#include "game_ext.h"
+#include "invitation_ext.h"
+#include "refcount.h"
+#include "debug.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+/*
+ * Initial number of slots in a client's invitation list.  The list is
+ * doubled in size whenever it fills up.
+ */
+#define CLIENT_INITIAL_INVITATIONS 4
+
+/*
+ * The CLIENT type is a structure type that defines the state of a
+ * client.  The ID a client uses for an invitation is simply the index of
+ * the invitation in its list, and the lowest free index is always
+ * assigned.
+ *
+ * "mutex" protects the player and the invitation list.  Packets for the
+ * client go through its own outbound queue, which has its own lock and
+ * never blocks, so a slow connection holds up neither operations on the
+ * client's state nor the threads sending to it.
+ * A client that is a bot has no connection, and "bot" is set so that
+ * packets for it go to the bot instead of its outbound queue.
+ * "slot" is the client's position in the client registry's table, and
+ * belongs to the registry, which only accesses it under its own lock.
+ * The client registry calls back into a CLIENT (e.g. client_get_player())
+ * while holding its own lock, so no creg_* function may be called with
+ * a client's mutex held.
+ */
+typedef struct client {
+	CLIENT_REGISTRY *creg;
+	int fd;
+	int slot;
+	PLAYER *player;
+	int compact_state;
+	INVITATION **invitations;
+	int inv_capacity;
+	REFCOUNT reference_count;
+	OUT_QUEUE *outq;
+	BOT *bot;
+	pthread_mutex_t mutex;
+} CLIENT;
+
+
+/*
+ * Create a new CLIENT object with a specified file descriptor with which
+ * to communicate with the client.  The returned CLIENT has a reference
+ * count of one and is in the logged-out state.
+ *
+ * @param creg  The client registry in which to create the client.
+ * @param fd  File descriptor of a socket to be used for communicating
+ * with the client.
+ * @return  The newly created CLIENT object, if creation is successful,
+ * otherwise NULL.
+ */
+CLIENT *client_create(CLIENT_REGISTRY *creg, int fd) {
+	CLIENT *client;
+	if(!(client = malloc(sizeof(CLIENT))))
+		return NULL;
+
+	*client = (CLIENT) {
+		.creg = creg,
+		.fd = fd,
+		.slot = -1,
+		.player = NULL,
+		.invitations = calloc(CLIENT_INITIAL_INVITATIONS, sizeof(INVITATION *)),
+		.inv_capacity = CLIENT_INITIAL_INVITATIONS,
+		.reference_count = 0,
+		.bot = NULL
+	};
+	if(!client->invitations) {
+		error("calloc failed");
+		free(client);
+		return NULL;
+	}
+
+	if(pthread_mutex_init(&client->mutex, NULL) < 0) {
+		error("Mutex initialization failed");
+		free(client->invitations);
+		free(client);
+		return NULL;
+	}
+
+	if(!(client->outq = outq_create(fd))) {
+		pthread_mutex_destroy(&client->mutex);
+		free(client->invitations);
+		free(client);
+		return NULL;
+	}
+
+	client_ref(client, "for newly created client");
+	return client;
+}
+
+/*
+ * Increase the reference count on a CLIENT by one.
+ *
+ * @param client  The CLIENT whose reference count is to be increased.
+ * @param why  A string describing the reason why the reference count is
+ * being increased.  This is used for debugging printout, to help trace
+ * the reference counting.
+ * @return  The same CLIENT that was passed as a parameter.
+ */
+CLIENT *client_ref(CLIENT *client, char *why) {
+#ifdef DEBUG
+	int count = refcount_inc(&client->reference_count);
+	debug("%ld: Increase reference count on client %p (%d -> %d) %s", pthread_self(), client,
+	      count - 1, count, why);
+#else
+	refcount_inc(&client->reference_count);
+#endif
+	return client;
+}
+
+/*
+ * Decrease the reference count on a CLIENT by one.  If after
+ * decrementing, the reference count has reached zero, then the CLIENT
+ * and its contents are freed.
+ *
+ * @param client  The CLIENT whose reference count is to be decreased.
+ * @param why  A string describing the reason why the reference count is
+ * being decreased.  This is used for debugging printout, to help trace
+ * the reference counting.
+ */
+void client_unref(CLIENT *client, char *why) {
+	int count = refcount_dec(&client->reference_count);
+	debug("%ld: Decrease reference count on client %p (%d -> %d) %s", pthread_self(), client,
+	      count + 1, count, why);
+	if(count == 0) {
+		debug("%ld: Free client %p", pthread_self(), client);
+		if(client->player)
+			player_unref(client->player, "because client is being freed");
+		free(client->invitations);
+		outq_destroy(client->outq);
+		pthread_mutex_destroy(&client->mutex);
+		free(client);
+	}
+}
+
+/*
+ * Log in this CLIENT as a specified PLAYER.
+ * The login fails if the CLIENT is already logged in or there is already
+ * some other CLIENT that is logged in as the specified PLAYER.
+ * Otherwise, the login is successful, the CLIENT is marked as "logged in"
+ * and a reference to the PLAYER is retained by it.  In this case,
+ * the reference count of the PLAYER is incremented to account for the
+ * retained reference.
+ *
+ * @param CLIENT  The CLIENT that is to be logged in.
+ * @param PLAYER  The PLAYER that the CLIENT is to be logged in as.
+ * @return 0 if the login operation is successful, otherwise -1.
+ */
+int client_login(CLIENT *client, PLAYER *player) {
+	if(client_get_player(client)) {
+		debug("%ld: [%d] Already logged in", pthread_self(), client->fd);
+		return -1;
+	}
+	// The registry's username index decides which of two clients logging
+	// in under the same name at the same time succeeds.
+	if(creg_add_user(client->creg, client, player_get_name(player)) < 0) {
+		debug("%ld: [%d] Player [%s] is already logged in", pthread_self(), client->fd,
+		      player_get_name(player));
+		return -1;
+	}
+	pthread_mutex_lock(&client->mutex);
+	client->player = player_ref(player, "for reference being retained by client");
+	pthread_mutex_unlock(&client->mutex);
+	creg_users_changed(client->creg);
+	debug("%ld: [%d] Logged in as [%s]", pthread_self(), client->fd, player_get_name(player));
+	return 0;
+}
+
+/*
+ * Log out this CLIENT.  If the client was not logged in, then it is
+ * an error.  The reference to the PLAYER that the CLIENT was logged
+ * in as is discarded, and its reference count is decremented.  Any
+ * INVITATIONs in the client's list are revoked or declined, if
+ * possible, any games in progress are resigned, and the invitations
+ * are removed from the list of this CLIENT as well as its opponents'.
+ *
+ * @param client  The CLIENT that is to be logged out.
+ * @return 0 if the client was logged in and has been successfully
+ * logged out, otherwise -1.
+ */
+int client_logout(CLIENT *client) {
+	PLAYER *player;
+	if(!(player = client_get_player(client))) {
+		debug("%ld: [%d] Not logged in", pthread_self(), client->fd);
+		return -1;
+	}
+	// Stop the client being found by name first, so that no new
+	// invitations arrive while the existing ones are being cleared.
+	creg_remove_user(client->creg, client, player_get_name(player));
+
+	// The list can change under us (e.g. an opponent resigning), so
+	// look each slot up afresh rather than working from a copy.
+	for(int id = 0; ; id++) {
+		pthread_mutex_lock(&client->mutex);
+		if(id >= client->inv_capacity) {
+			pthread_mutex_unlock(&client->mutex);
+			break;
+		}
+		INVITATION *inv = client->invitations[id];
+		if(inv)
+			inv_ref(inv, "while logging out");
+		pthread_mutex_unlock(&client->mutex);
+		if(!inv)
+			continue;
+		if(inv_get_game(inv)) {
+			client_resign_game(client, id);
+		} else if(inv_get_source(inv) == client) {
+			client_revoke_invitation(client, id);
+		} else {
+			client_decline_invitation(client, id);
+		}
+		inv_unref(inv, "while logging out");
+	}
+
+	pthread_mutex_lock(&client->mutex);
+	client->player = NULL;
+	pthread_mutex_unlock(&client->mutex);
+	creg_users_changed(client->creg);
+	debug("%ld: [%d] Logged out [%s]", pthread_self(), client->fd, player_get_name(player));
+	player_unref(player, "because client is logging out");
+	return 0;
+}
+
+/*
+ * Get the PLAYER for the specified logged-in CLIENT.
+ * The reference count on the returned PLAYER is NOT incremented,
+ * so the returned reference should only be regarded as valid as long
+ * as the CLIENT has not been freed.
+ *
+ * @param client  The CLIENT from which to get the PLAYER.
+ * @return  The PLAYER that the CLIENT is currently logged in as,
+ * otherwise NULL if the player is not currently logged in.
+ */
+PLAYER *client_get_player(CLIENT *client) {
+	pthread_mutex_lock(&client->mutex);
+	PLAYER *player = client->player;
+	pthread_mutex_unlock(&client->mutex);
+	return player;
+}
+
+/*
+ * Get the file descriptor for the network connection associated with
+ * this CLIENT.
+ *
+ * @param client  The CLIENT for which the file descriptor is to be
+ * obtained.
+ * @return the file descriptor.
+ */
+int client_get_fd(CLIENT *client) {
+	return client->fd;
+}
+
+/*
+ * Get the slot that the client registry has assigned to a client.
+ *
+ * @param client  The CLIENT.
+ * @return  The slot, or -1 if the client is not registered.
+ */
+int client_get_slot(CLIENT *client) {
+	return client->slot;
+}
+
+/*
+ * Record the slot that the client registry has assigned to a client.
+ *
+ * @param client  The CLIENT.
+ * @param slot  The slot, or -1 if the client is no longer registered.
+ */
+void client_set_slot(CLIENT *client, int slot) {
+	client->slot = slot;
+}
+
+/*
+ * Make a CLIENT a bot (see bot.h): from now on packets sent to it are
+ * handed to bot_deliver() instead of being written to a connection.
+ *
+ * @param client  The CLIENT, which should have no connection.
+ * @param bot  The bot that is to receive its packets.
+ */
+void client_set_bot(CLIENT *client, BOT *bot) {
+	client->bot = bot;
+}
+
+/*
+ * Choose the format in which game states are sent to a client.
+ *
+ * @param client  The CLIENT.
+ * @param compact  Nonzero for the compact binary format produced by
+ * game_pack_state(), zero for the text format of game_unparse_state().
+ */
+void client_set_compact_state(CLIENT *client, int compact) {
+	pthread_mutex_lock(&client->mutex);
+	client->compact_state = compact;
+	pthread_mutex_unlock(&client->mutex);
+}
+
+/*
+ * Send a packet to a client.  Exclusive access to the network connection
+ * is obtained for the duration of this operation, to prevent concurrent
+ * invocations from corrupting each other's transmissions.  To prevent
+ * such interference, only this function should be used to send packets to
+ * the client, rather than the lower-level proto_send_packet() function.
+ *
+ * The packet goes through the client's outbound queue, so this never
+ * blocks waiting for the client to read.
+ *
+ * @param client  The CLIENT who should be sent the packet.
+ * @param pkt  The header of the packet to be sent.
+ * @param data  Data payload to be sent, or NULL if none.
+ * @return 0 if transmission succeeds, -1 otherwise.
+ */
+int client_send_packet(CLIENT *player, JEUX_PACKET_HEADER *pkt, void *data) {
+	if(player->bot)
+		return bot_deliver(player->bot, &pkt, &data, 1);
+	return outq_send(player->outq, &pkt, &data, 1);
+}
+
+/*
+ * Send several packets to a client, back-to-back and with as few system
+ * calls as possible.  No other packet can be interleaved with the batch.
+ *
+ * @param client  The CLIENT who should be sent the packets.
+ * @param pkts  The headers of the packets to be sent.
+ * @param data  The corresponding payloads, any of which may be NULL.
+ * @param n  The number of packets.
+ * @return 0 if transmission succeeds, -1 otherwise.
+ */
+int client_send_packets(CLIENT *client, JEUX_PACKET_HEADER **pkts, void **data, int n) {
+	if(client->bot)
+		return bot_deliver(client->bot, pkts, data, n);
+	return outq_send(client->outq, pkts, data, n);
+}
+
+/*
+ * Start holding back packets for a client, so that the responses to a
+ * run of pipelined requests can be sent together by client_uncork().
+ * Notifications from other clients are held back along with them, so a
+ * client must not be left corked while waiting for input.
+ *
+ * @param client  The CLIENT to be corked.
+ */
+void client_cork(CLIENT *client) {
+	outq_cork(client->outq);
+}
+
+/*
+ * Send everything held back since client_cork(), in one gather write if
+ * the socket will take it.
+ *
+ * @param client  The CLIENT to be uncorked.
+ * @return 0 if the packets were sent or queued, -1 if the connection has
+ * failed.
+ */
+int client_uncork(CLIENT *client) {
+	return outq_uncork(client->outq);
+}
+
+/*
+ * Close the network connection of a client.  Packets still waiting to be
+ * sent are discarded, and any later attempt to send to the client fails.
+ *
+ * @param client  The CLIENT whose connection is to be closed.
+ */
+void client_disconnect(CLIENT *client) {
+	outq_close(client->outq);
+}
+
+/*
+ * Fill in a packet header, with the current time as its timestamp.
+ */
+static void client_make_header(JEUX_PACKET_HEADER *hdr, JEUX_PACKET_TYPE type,
+			       int id, int role, size_t size) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	*hdr = (JEUX_PACKET_HEADER) {
+		.type = type,
+		.id = id,
+		.role = role,
+		.size = htons(size),
+		.timestamp_sec = htonl((uint32_t)ts.tv_sec),
+		.timestamp_nsec = htonl((uint32_t)ts.tv_nsec)
+	};
+}
+
+/*
+ * Send a packet of a given type to a client.
+ */
+static int client_notify(CLIENT *client, JEUX_PACKET_TYPE type, int id, int role, char *str) {
+	JEUX_PACKET_HEADER hdr;
+	client_make_header(&hdr, type, id, role, str ? strlen(str) : 0);
+	return client_send_packet(client, &hdr, str);
+}
+
+/*
+ * Send an ACK packet to a client.  This is a convenience function that
+ * streamlines a common case.
+ *
+ * @param client  The CLIENT who should be sent the packet.
+ * @param data  Pointer to the optional data payload for this packet,
+ * or NULL if there is to be no payload.
+ * @param datalen  Length of the data payload, or 0 if there is none.
+ * @return 0 if transmission succeeds, -1 otherwise.
+ */
+int client_send_ack(CLIENT *client, void *data, size_t datalen) {
+	JEUX_PACKET_HEADER hdr;
+	client_make_header(&hdr, JEUX_ACK_PKT, 0, 0, data ? datalen : 0);
+	return client_send_packet(client, &hdr, data);
+}
+
+/*
+ * Send an ACK packet to a client, as for client_send_ack(), with a
+ * given value in its role field.
+ *
+ * @param client  The CLIENT who should be sent the packet.
+ * @param role  The value of the role field.
+ * @param data  Pointer to the optional data payload for this packet,
+ * or NULL if there is to be no payload.
+ * @param datalen  Length of the data payload, or 0 if there is none.
+ * @return 0 if transmission succeeds, -1 otherwise.
+ */
+int client_send_ack_role(CLIENT *client, int role, void *data, size_t datalen) {
+	JEUX_PACKET_HEADER hdr;
+	client_make_header(&hdr, JEUX_ACK_PKT, 0, role, data ? datalen : 0);
+	return client_send_packet(client, &hdr, data);
+}
+
+/*
+ * Send an NACK packet to a client.  This is a convenience function that
+ * streamlines a common case.
+ *
+ * @param client  The CLIENT who should be sent the packet.
+ * @return 0 if transmission succeeds, -1 otherwise.
+ */
+int client_send_nack(CLIENT *client) {
+	JEUX_PACKET_HEADER hdr;
+	client_make_header(&hdr, JEUX_NACK_PKT, 0, 0, 0);
+	return client_send_packet(client, &hdr, NULL);
+}
+
+/*
+ * Add an INVITATION to the list of outstanding invitations for a
+ * specified CLIENT.  A reference to the INVITATION is retained by
+ * the CLIENT and the reference count of the INVITATION is
+ * incremented.  The invitation is assigned an integer ID,
+ * which the client subsequently uses to identify the invitation.
+ *
+ * @param client  The CLIENT to which the invitation is to be added.
+ * @param inv  The INVITATION that is to be added.
+ * @return  The ID assigned to the invitation, if the invitation
+ * was successfully added, otherwise -1.
+ */
+int client_add_invitation(CLIENT *client, INVITATION *inv) {
+	pthread_mutex_lock(&client->mutex);
+	int id;
+	for(id = 0; id < client->inv_capacity; id++) {
+		if(!client->invitations[id])
+			break;
+	}
+	if(id == client->inv_capacity) {
+		// IDs travel in a one-byte header field.
+		if(client->inv_capacity > UINT8_MAX) {
+			error("Too many invitations");
+			pthread_mutex_unlock(&client->mutex);
+			return -1;
+		}
+		INVITATION **bigger;
+		if(!(bigger = realloc(client->invitations, 2 * client->inv_capacity * sizeof(INVITATION *)))) {
+			error("realloc failed");
+			pthread_mutex_unlock(&client->mutex);
+			return -1;
+		}
+		memset(bigger + client->inv_capacity, 0, client->inv_capacity * sizeof(INVITATION *));
+		client->invitations = bigger;
+		client->inv_capacity *= 2;
+	}
+	client->invitations[id] = inv_ref(inv, "for invitation being added to client's list");
+	pthread_mutex_unlock(&client->mutex);
+	return id;
+}
+
+/*
+ * Remove an invitation from the list of outstanding invitations
+ * for a specified CLIENT.  The reference count of the invitation is
+ * decremented to account for the discarded reference.
+ *
+ * @param client  The client from which the invitation is to be removed.
+ * @param inv  The invitation that is to be removed.
+ * @return the CLIENT's id for the INVITATION, if it was successfully
+ * removed, otherwise -1.
+ */
+int client_remove_invitation(CLIENT *client, INVITATION *inv) {
+	pthread_mutex_lock(&client->mutex);
+	for(int id = 0; id < client->inv_capacity; id++) {
+		if(client->invitations[id] == inv) {
+			client->invitations[id] = NULL;
+			pthread_mutex_unlock(&client->mutex);
+			inv_unref(inv, "for invitation being removed from client's list");
+			return id;
+		}
+	}
+	pthread_mutex_unlock(&client->mutex);
+	return -1;
+}
+
+/*
+ * Look up an invitation by a client's ID for it.  The reference count of
+ * the returned INVITATION is incremented.
+ */
+static INVITATION *client_get_invitation(CLIENT *client, int id) {
+	INVITATION *inv = NULL;
+	pthread_mutex_lock(&client->mutex);
+	if(id >= 0 && id < client->inv_capacity && client->invitations[id])
+		inv = inv_ref(client->invitations[id], "for reference being used by client");
+	pthread_mutex_unlock(&client->mutex);
+	return inv;
+}
+
+/*
+ * Find a client's ID for an invitation.
+ */
+static int client_find_invitation(CLIENT *client, INVITATION *inv) {
+	pthread_mutex_lock(&client->mutex);
+	for(int id = 0; id < client->inv_capacity; id++) {
+		if(client->invitations[id] == inv) {
+			pthread_mutex_unlock(&client->mutex);
+			return id;
+		}
+	}
+	pthread_mutex_unlock(&client->mutex);
+	return -1;
+}
+
+/*
+ * Get the state of a game as a packet payload for a particular client,
+ * in the format that client asked for at login.  A compact state is
+ * packed into the buffer provided.  A text state is a shared snapshot,
+ * which is stored in *statep and must be released with game_state_unref()
+ * once the payload has been sent; *statep is otherwise set to NULL.
+ *
+ * @return  The payload, with its length stored in *lenp.  The length of a
+ * text state does not include its null terminator.
+ */
+static void *client_state_payload(CLIENT *client, GAME *game, unsigned char *buf,
+				  GAME_STATE **statep, size_t *lenp) {
+	if(client->compact_state) {
+		*statep = NULL;
+		*lenp = game_pack_state(game, buf);
+		return buf;
+	}
+	*statep = game_get_state(game);
+	*lenp = game_state_length(*statep);
+	return (void *)game_state_text(*statep);
+}
+
+/*
+ * Get the GAME in an INVITATION of a client, and the role that the
+ * client plays in it.
+ *
+ * @param client  The CLIENT.
+ * @param id  The ID assigned by the CLIENT to the INVITATION.
+ * @param rolep  Set to the GAME_ROLE of the CLIENT in the game.
+ * @return  The GAME, with its reference count incremented, or NULL if
+ * the ID does not refer to an INVITATION that has been accepted.
+ */
+GAME *client_get_game(CLIENT *client, int id, GAME_ROLE *rolep) {
+	INVITATION *inv;
+	if(!(inv = client_get_invitation(client, id)))
+		return NULL;
+	GAME *game;
+	if((game = inv_get_game(inv))) {
+		game_ref(game, "for reference being returned by client_get_game()");
+		*rolep = inv_get_source(inv) == client ? inv_get_source_role(inv) : inv_get_target_role(inv);
+	}
+	inv_unref(inv, "after getting game");
+	return game;
+}
+
+/*
+ * Get the geometry of the game offered by an INVITATION of a client.
+ *
+ * @param client  The CLIENT.
+ * @param id  The ID assigned by the CLIENT to the INVITATION.
+ * @param geometry  Set to the geometry of the game.
+ * @return 0 if the ID refers to an INVITATION, otherwise -1.
+ */
+int client_get_geometry(CLIENT *client, int id, GAME_GEOMETRY *geometry) {
+	INVITATION *inv;
+	if(!(inv = client_get_invitation(client, id)))
+		return -1;
+	inv_get_geometry(inv, geometry);
+	inv_unref(inv, "after getting geometry");
+	return 0;
+}
+
+/*
+ * Post the result of a finished game to the ratings of its players.
+ */
+static void client_post_result(INVITATION *inv, GAME_ROLE winner) {
+	PLAYER *source = client_get_player(inv_get_source(inv));
+	PLAYER *target = client_get_player(inv_get_target(inv));
+	if(!source || !target)
+		return;
+	int result = 0;
+	if(winner == inv_get_source_role(inv))
+		result = 1;
+	else if(winner == inv_get_target_role(inv))
+		result = 2;
+	player_post_result(source, target, result);
+	creg_users_changed(inv_get_source(inv)->creg);
+}
+
+/*
+ * Make a new invitation from a specified "source" CLIENT to a specified
+ * target CLIENT.  The invitation represents an offer to the target to
+ * engage in a game with the source.  The invitation is added to both the
+ * source's list of invitations and the target's list of invitations and
+ * the invitation's reference count is appropriately increased.
+ * An `INVITED` packet is sent to the target of the invitation.
+ *
+ * @param source  The CLIENT that is the source of the INVITATION.
+ * @param target  The CLIENT that is the target of the INVITATION.
+ * @param source_role  The GAME_ROLE to be played by the source of the INVITATION.
+ * @param target_role  The GAME_ROLE to be played by the target of the INVITATION.
+ * @return the ID assigned by the source to the INVITATION, if the operation
+ * is successful, otherwise -1.
+ */
+int client_make_invitation(CLIENT *source, CLIENT *target,
+			   GAME_ROLE source_role, GAME_ROLE target_role) {
+	return client_make_invitation_geometry(source, target, source_role, target_role,
+					       &GAME_GEOMETRY_DEFAULT);
+}
+
+/*
+ * Make a new invitation, as for client_make_invitation(), to a game of a
+ * given geometry.  Unless the game is tic-tac-toe, the payload of the
+ * INVITED packet is the source's name and the geometry, separated by a
+ * tab, as in the payload of an INVITE.
+ *
+ * @param source  The CLIENT that is the source of the INVITATION.
+ * @param target  The CLIENT that is the target of the INVITATION.
+ * @param source_role  The GAME_ROLE to be played by the source of the INVITATION.
+ * @param target_role  The GAME_ROLE to be played by the target of the INVITATION.
+ * @param geometry  The geometry of the game.
+ * @return the ID assigned by the source to the INVITATION, if the operation
+ * is successful, otherwise -1.
+ */
+int client_make_invitation_geometry(CLIENT *source, CLIENT *target, GAME_ROLE source_role,
+				    GAME_ROLE target_role, const GAME_GEOMETRY *geometry) {
+	PLAYER *player = client_get_player(source);
+	char *name = player ? player_get_name(player) : NULL;
+	char *payload = name;
+	if(name && !game_geometry_is_default(geometry)) {
+		if(!(payload = malloc(strlen(name) + 1 + GAME_GEOMETRY_SIZE))) {
+			error("malloc failed");
+			return -1;
+		}
+		char *shape = stpcpy(payload, name);
+		*shape++ = '\t';
+		game_unparse_geometry(geometry, shape);
+	}
+
+	INVITATION *inv;
+	int sid = -1, tid = -1;
+	if(!(inv = inv_create_geometry(source, target, source_role, target_role, geometry)))
+		goto done;
+	if((sid = client_add_invitation(source, inv)) < 0 ||
+	   (tid = client_add_invitation(target, inv)) < 0) {
+		if(sid >= 0)
+			client_remove_invitation(source, inv);
+		inv_unref(inv, "because invitation could not be made");
+		sid = -1;
+		goto done;
+	}
+	inv_unref(inv, "now that invitation is in both clients' lists");
+	client_notify(target, JEUX_INVITED_PKT, tid, target_role, payload);
+done:
+	if(payload != name)
+		free(payload);
+	return sid;
+}
+
+/*
+ * Revoke an invitation for which the specified CLIENT is the source.
+ * The invitation is removed from the lists of invitations of its source
+ * and target CLIENT's and the reference counts are appropriately
+ * decreased.  It is an error if the specified CLIENT is not the source
+ * of the INVITATION, or the INVITATION does not exist in the source or
+ * target CLIENT's list.  It is also an error if the INVITATION being
+ * revoked is in a state other than the "open" state.  If the invitation
+ * is successfully revoked, then the target is sent a REVOKED packet
+ * containing the target's ID of the revoked invitation.
+ *
+ * @param client  The CLIENT that is the source of the invitation to be
+ * revoked.
+ * @param id  The ID assigned by the CLIENT to the invitation to be
+ * revoked.
+ * @return 0 if the invitation is successfully revoked, otherwise -1.
+ */
+int client_revoke_invitation(CLIENT *client, int id) {
+	INVITATION *inv;
+	if(!(inv = client_get_invitation(client, id)))
+		return -1;
+	if(inv_get_source(inv) != client || inv_get_game(inv) ||
+	   inv_close(inv, NULL_ROLE) < 0) {
+		inv_unref(inv, "after failed revoke");
+		return -1;
+	}
+	CLIENT *target = inv_get_target(inv);
+	client_remove_invitation(client, inv);
+	int tid = client_remove_invitation(target, inv);
+	if(tid >= 0)
+		client_notify(target, JEUX_REVOKED_PKT, tid, 0, NULL);
+	inv_unref(inv, "after revoke");
+	return 0;
+}
+
+/*
+ * Decline an invitation previously made with the specified CLIENT as target.
+ * The invitation is removed from the lists of invitations of its source
+ * and target CLIENT's and the reference counts are appropriately
+ * decreased.  It is an error if the specified CLIENT is not the target
+ * of the INVITATION, or the INVITATION does not exist in the source or
+ * target CLIENT's list.  It is also an error if the INVITATION being
+ * declined is in a state other than the "open" state.  If the invitation
+ * is successfully declined, then the source is sent a DECLINED packet
+ * containing the source's ID of the declined invitation.
+ *
+ * @param client  The CLIENT that is the target of the invitation to be
+ * declined.
+ * @param id  The ID assigned by the CLIENT to the invitation to be
+ * declined.
+ * @return 0 if the invitation is successfully declined, otherwise -1.
+ */
+int client_decline_invitation(CLIENT *client, int id) {
+	INVITATION *inv;
+	if(!(inv = client_get_invitation(client, id)))
+		return -1;
+	if(inv_get_target(inv) != client || inv_get_game(inv) ||
+	   inv_close(inv, NULL_ROLE) < 0) {
+		inv_unref(inv, "after failed decline");
+		return -1;
+	}
+	CLIENT *source = inv_get_source(inv);
+	client_remove_invitation(client, inv);
+	int sid = client_remove_invitation(source, inv);
+	if(sid >= 0)
+		client_notify(source, JEUX_DECLINED_PKT, sid, 0, NULL);
+	inv_unref(inv, "after decline");
+	return 0;
+}
+
+/*
+ * Accept an invitation and send ACCEPTED to its source.
+ *
+ * @return  The INVITATION, with a reference for the caller, if it was
+ * accepted, otherwise NULL.
+ */
+static INVITATION *client_accept(CLIENT *client, int id) {
+	INVITATION *inv;
+	if(!(inv = client_get_invitation(client, id)))
+		return NULL;
+	if(inv_get_target(inv) != client || inv_accept(inv) < 0) {
+		inv_unref(inv, "after failed accept");
+		return NULL;
+	}
+
+	CLIENT *source = inv_get_source(inv);
+	int sid = client_find_invitation(source, inv);
+	if(sid >= 0) {
+		JEUX_PACKET_HEADER hdr;
+		unsigned char buf[GAME_PACKED_STATE_SIZE];
+		GAME_STATE *state = NULL;
+		void *payload = NULL;
+		size_t len = 0;
+		if(inv_get_source_role(inv) == FIRST_PLAYER_ROLE)
+			payload = client_state_payload(source, inv_get_game(inv), buf, &state, &len);
+		client_make_header(&hdr, JEUX_ACCEPTED_PKT, sid, 0, len);
+		client_send_packet(source, &hdr, payload);
+		if(state)
+			game_state_unref(state);
+	}
+	return inv;
+}
+
+/*
+ * Accept an INVITATION previously made with the specified CLIENT as
+ * the target.  A new GAME is created and a reference to it is saved
+ * in the INVITATION.  If the invitation is successfully accepted,
+ * the source is sent an ACCEPTED packet containing the source's ID
+ * of the accepted INVITATION.  If the source is to play the role of
+ * the first player, then the payload of the ACCEPTED packet contains
+ * a string describing the initial game state.  A reference to the
+ * new GAME (with its reference count incremented) is returned to the
+ * caller.
+ *
+ * @param client  The CLIENT that is the target of the INVITATION to be
+ * accepted.
+ * @param id  The ID assigned by the target to the INVITATION.
+ * @param strp  Pointer to a variable into which will be stored either
+ * NULL, if the accepting client is not the first player to move,
+ * or a malloc'ed string that describes the initial game state,
+ * if the accepting client is the first player to move.
+ * If non-NULL, this string should be used as the payload of the `ACK`
+ * message to be sent to the accepting client.  The caller must free
+ * the string after use.
+ * @return 0 if the INVITATION is successfully accepted, otherwise -1.
+ */
+int client_accept_invitation(CLIENT *client, int id, char **strp) {
+	INVITATION *inv;
+	if(!(inv = client_accept(client, id)))
+		return -1;
+	if(inv_get_target_role(inv) == FIRST_PLAYER_ROLE)
+		*strp = game_unparse_state(inv_get_game(inv));
+	else
+		*strp = NULL;
+	inv_unref(inv, "after accept");
+	return 0;
+}
+
+/*
+ * Accept an INVITATION, as for client_accept_invitation(), but produce
+ * the payload of the ACK to the accepting client in that client's own
+ * state format.
+ *
+ * @param client  The CLIENT that is the target of the INVITATION to be
+ * accepted.
+ * @param id  The ID assigned by the target to the INVITATION.
+ * @param buf  Storage for at least CLIENT_STATE_MAX bytes, into which
+ * the initial game state is rendered if the accepting client is the
+ * first player to move.
+ * @param lenp  Pointer to a variable into which is stored the length of
+ * the payload (including the terminator of a text state), or 0 if there
+ * is none.
+ * @return 0 if the INVITATION is successfully accepted, otherwise -1.
+ */
+int client_accept_invitation_state(CLIENT *client, int id, char *buf, size_t *lenp) {
+	INVITATION *inv;
+	if(!(inv = client_accept(client, id)))
+		return -1;
+	*lenp = 0;
+	if(inv_get_target_role(inv) == FIRST_PLAYER_ROLE) {
+		GAME_STATE *state;
+		size_t len;
+		void *payload = client_state_payload(client, inv_get_game(inv),
+						     (unsigned char *)buf, &state, &len);
+		if(state) {
+			// Include the terminator.
+			memcpy(buf, payload, ++len);
+			game_state_unref(state);
+		}
+		*lenp = len;
+	}
+	inv_unref(inv, "after accept");
+	return 0;
+}
+
+/*
+ * Resign a game in progress.  This function may be called by a CLIENT
+ * that is either source or the target of the INVITATION containing the
+ * GAME that is to be resigned.  It is an error if the INVITATION containing
+ * the GAME is not in the ACCEPTED state.  If the game is successfully
+ * resigned, the INVITATION is set to the CLOSED state, it is removed
+ * from the lists of both the source and target, and a RESIGNED packet
+ * containing the opponent's ID for the INVITATION is sent to the opponent
+ * of the CLIENT that has resigned.
+ *
+ * @param client  The CLIENT that is resigning.
+ * @param id  The ID assigned by the CLIENT to the INVITATION that contains
+ * the GAME to be resigned.
+ * @return 0 if the game is successfully resigned, otherwise -1.
+ */
+int client_resign_game(CLIENT *client, int id) {
+	INVITATION *inv;
+	if(!(inv = client_get_invitation(client, id)))
+		return -1;
+	GAME *game = inv_get_game(inv);
+	int is_source = inv_get_source(inv) == client;
+	GAME_ROLE role = is_source ? inv_get_source_role(inv) : inv_get_target_role(inv);
+	if(!game || game_is_over(game) || inv_close(inv, role) < 0) {
+		inv_unref(inv, "after failed resign");
+		return -1;
+	}
+	CLIENT *opponent = is_source ? inv_get_target(inv) : inv_get_source(inv);
+	client_remove_invitation(client, inv);
+	int oid = client_remove_invitation(opponent, inv);
+	if(oid >= 0)
+		client_notify(opponent, JEUX_RESIGNED_PKT, oid, 0, NULL);
+	client_post_result(inv, game_get_winner(game));
+	inv_unref(inv, "after resign");
+	return 0;
+}
+
+/*
+ * Make a move in a game currently in progress, in which the specified
+ * CLIENT is a participant.  The GAME in which the move is to be made is
+ * specified by passing the ID assigned by the CLIENT to the INVITATION
+ * that contains the game.  The move to be made is specified as a string
+ * that describes the move in a game-dependent format.  It is an error
+ * if the ID does not refer to an INVITATION containing a GAME in progress,
+ * if the move cannot be parsed, or if the move is not legal in the current
+ * GAME state.  If the move is successfully made, then a MOVED packet is
+ * sent to the opponent of the CLIENT making the move.  In addition, if
+ * the move that has been made results in the game being over, then an
+ * ENDED packet containing the appropriate game ID and the game result
+ * is sent to each of the players participating in the game, and the
+ * INVITATION containing the now-terminated game is removed from the lists
+ * of both the source and target.  The result of the game is posted in
+ * order to update both players' ratings.
+ *
+ * The opponent's MOVED and ENDED packets are sent together, in a single
+ * gather write.
+ *
+ * @param client  The CLIENT that is making the move.
+ * @param id  The ID assigned by the CLIENT to the GAME in which the move
+ * is to be made.
+ * @param move  A string that describes the move to be made.
+ * @return 0 if the move was made successfully, -1 otherwise.
+ */
+int client_make_move(CLIENT *client, int id, char *move) {
+	INVITATION *inv;
+	if(!(inv = client_get_invitation(client, id)))
+		return -1;
+	GAME *game = inv_get_game(inv);
+	int is_source = inv_get_source(inv) == client;
+	GAME_ROLE role = is_source ? inv_get_source_role(inv) : inv_get_target_role(inv);
+	if(!move || !game || game_is_over(game)) {
+		inv_unref(inv, "after failed move");
+		return -1;
+	}
+
+	if(game_play_move(game, role, move) < 0) {
+		inv_unref(inv, "after failed move");
+		return -1;
+	}
+
+	CLIENT *opponent = is_source ? inv_get_target(inv) : inv_get_source(inv);
+	int oid = client_find_invitation(opponent, inv);
+	int over = game_is_over(game);
+	GAME_ROLE winner = over ? game_get_winner(game) : NULL_ROLE;
+
+	if(oid >= 0) {
+		unsigned char buf[GAME_PACKED_STATE_SIZE];
+		GAME_STATE *state;
+		size_t len;
+		JEUX_PACKET_HEADER moved, ended;
+		JEUX_PACKET_HEADER *hdrs[] = { &moved, &ended };
+		void *data[] = { client_state_payload(opponent, game, buf, &state, &len), NULL };
+		client_make_header(&moved, JEUX_MOVED_PKT, oid, 0, len);
+		client_make_header(&ended, JEUX_ENDED_PKT, oid, winner, 0);
+		client_send_packets(opponent, hdrs, data, over ? 2 : 1);
+		if(state)
+			game_state_unref(state);
+	}
+
+	if(over && inv_close(inv, NULL_ROLE) == 0) {
+		client_notify(client, JEUX_ENDED_PKT, id, winner, NULL);
+		client_remove_invitation(client, inv);
+		client_remove_invitation(opponent, inv);
+		client_post_result(inv, winner);
+	}
+	inv_unref(inv, "after move");
+	return 0;
+}
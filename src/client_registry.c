@@ -1,11 +1,24 @@
 #include "client_registry.h"
+#include "client_registry_ext.h"
+#include "client_ext.h"
+#include "strmap.h"
+#include "epoch.h"
 // #include "client.h"
 #include <semaphore.h>
 #include "debug.h"
 #include <stdlib.h>
 #include <pthread.h>
 #include <string.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <limits.h>
 #include <unistd.h>
+#include <sys/socket.h>
+
+/*
+ * Initial capacity of the client table, which doubles whenever it fills.
+ */
+#define CREG_INITIAL_CAPACITY 64
 
 /*
  * The CLIENT_REGISTRY type is a structure that defines the state of a
@@ -13,17 +26,63 @@
  * definition in client_registry.c.  The precise contents are up to
  * you.  Be sure that all the operations that might be called
  * concurrently are thread-safe.
+ *
+ * The registered clients are kept densely packed at the start of
+ * "clients", and each CLIENT records its own slot.  A client being
+ * unregistered is replaced by the one in the last slot, so registration
+ * and unregistration take constant time, and walking the registered
+ * clients touches no empty slots.
+ *
+ * "users_listing" is the published USERS listing, which is never
+ * modified once published.  Readers load it without locking, inside an
+ * epoch critical section, and a listing that has been replaced is freed
+ * through epoch_retire().  Every change to the set of logged-in users
+ * or their ratings bumps "users_version", and a listing built from an
+ * older version is rebuilt, under "users_mutex" so that concurrent
+ * requests do not all rebuild it at once.
+ *
+ * The listing is sorted by name, and alongside it is an index with an
+ * entry for each line, so that a page of it can be found by binary
+ * search and copied without looking at the rest.  "by_rating" holds the
+ * same entries in order of rating, and of name among equal ratings, so
+ * that the users in a band of ratings can be found in the same way.
  */
+typedef struct creg_user {
+	const char *line;
+	unsigned int name_length;
+	unsigned int line_length;
+	int rating;
+} CREG_USER;
+
+typedef struct creg_users {
+	unsigned int version;
+	int count;
+	CREG_USER *index;
+	CREG_USER **by_rating;
+	size_t length;
+	char text[];
+} CREG_USERS;
+
 typedef struct client_registry {
 	int client_thread_counts;
-	// CLIENT *firstClient;
+	int capacity;
 	CLIENT **clients;
-	int fd[1024];
+	STRMAP *users;
+	CREG_USERS *_Atomic users_listing;
+	atomic_uint users_version;
+	pthread_mutex_t users_mutex;
 	pthread_mutex_t mutex;
 	sem_t semaphore;
 	int waiting_shutdown;
 } CLIENT_REGISTRY;
 
+static void creg_users_free(void *arg) {
+	CREG_USERS *users = arg;
+	free(users->by_rating);
+	free(users->index);
+	free(users);
+}
+
 /*
  * Initialize a new client registry.
  *
@@ -40,19 +99,35 @@ CLIENT_REGISTRY *creg_init() {
 
 	*cr = (CLIENT_REGISTRY) {
 		.client_thread_counts = 0,
-		// .firstClient = NULL,
-		.clients = calloc(MAX_CLIENTS, sizeof(CLIENT *)),
+		.capacity = CREG_INITIAL_CAPACITY,
+		.clients = calloc(CREG_INITIAL_CAPACITY, sizeof(CLIENT *)),
+		.users = strmap_init(),
+		.users_listing = NULL,
+		.users_version = 1,
 		.waiting_shutdown = 0
 	};
 
-	if(!cr->clients) {
+	if(!cr->clients || !cr->users) {
 		error("calloc failed");
+		free(cr->clients);
+		if(cr->users)
+			strmap_fini(cr->users);
 		free(cr);
 		return NULL;
 	}
 
 	if (pthread_mutex_init(&cr->mutex, NULL) < 0) {
 		error("Mutex initialization failed");
+		strmap_fini(cr->users);
+		free(cr->clients);
+		free(cr);
+		return NULL;
+	}
+
+	if (pthread_mutex_init(&cr->users_mutex, NULL) < 0) {
+		error("Mutex initialization failed");
+		pthread_mutex_destroy(&cr->mutex);
+		strmap_fini(cr->users);
 		free(cr->clients);
 		free(cr);
 		return NULL;
@@ -60,16 +135,14 @@ CLIENT_REGISTRY *creg_init() {
 
 	if (sem_init(&cr->semaphore, 0, 0) < 0) {
 		error("Semaphore initialization failed");
+		pthread_mutex_destroy(&cr->users_mutex);
 		pthread_mutex_destroy(&cr->mutex);
+		strmap_fini(cr->users);
 		free(cr->clients);
 		free(cr);
 		return NULL;
 	}
 
-	for(int i = 0; i < 1024; i++) {
-		cr->fd[i] = -1;
-	}
-	
 	debug("%ld: Initialize client registry", pthread_self());
 	return cr;
 }
@@ -89,7 +162,12 @@ void creg_fini(CLIENT_REGISTRY *cr) {
 	}
 
 	pthread_mutex_destroy(&cr->mutex);
+	pthread_mutex_destroy(&cr->users_mutex);
 	sem_destroy(&cr->semaphore);
+	strmap_fini(cr->users);
+	CREG_USERS *users;
+	if((users = atomic_load(&cr->users_listing)))
+		creg_users_free(users);
 	free(cr->clients);
 	free(cr);
 	debug("%ld: Finalize client registry", pthread_self());
@@ -106,19 +184,16 @@ void creg_fini(CLIENT_REGISTRY *cr) {
  * is successful, otherwise NULL.
  */
 CLIENT *creg_register(CLIENT_REGISTRY *cr, int fd) {
-	// debug("%ld: Register client fd %d", pthread_self(), fd);
 	pthread_mutex_lock(&cr->mutex);
-	//check if full
-	if(cr->client_thread_counts == MAX_CLIENTS) {
-		error("max clients reached");
-		pthread_mutex_unlock(&cr->mutex);
-		return NULL;
-	}
-	//check if fd is not registered
-	if(cr->fd[fd] != -1) {
-		error("fd already registered");
-		pthread_mutex_unlock(&cr->mutex);
-		return NULL;
+	if(cr->client_thread_counts == cr->capacity) {
+		CLIENT **clients;
+		if(!(clients = realloc(cr->clients, 2 * cr->capacity * sizeof(CLIENT *)))) {
+			error("realloc failed");
+			pthread_mutex_unlock(&cr->mutex);
+			return NULL;
+		}
+		cr->clients = clients;
+		cr->capacity *= 2;
 	}
 	//create client
 	CLIENT *client;
@@ -127,18 +202,8 @@ CLIENT *creg_register(CLIENT_REGISTRY *cr, int fd) {
 		pthread_mutex_unlock(&cr->mutex);
 		return NULL;
 	}
-	for(int i = 0; i < MAX_CLIENTS; i++) {
-		if(!(cr->clients[i])) {
-			cr->clients[i] = client;
-			break;
-		}
-	}
-	//increment client reference count
-	// client_ref(client, "for newly created client");
-	//increment client count
-	cr->client_thread_counts++;
-	//register fd
-	cr->fd[fd] = 1;
+	client_set_slot(client, cr->client_thread_counts);
+	cr->clients[cr->client_thread_counts++] = client;
 	debug("%ld: Register client fd %d (total connected: %d)", pthread_self(), fd, cr->client_thread_counts);
 
 	pthread_mutex_unlock(&cr->mutex);
@@ -160,38 +225,22 @@ CLIENT *creg_register(CLIENT_REGISTRY *cr, int fd) {
  * @return 0  if unregistration succeeds, otherwise -1.
  */
 int creg_unregister(CLIENT_REGISTRY *cr, CLIENT *client) {
-	// debug("%ld: Unregister client fd %d", pthread_self(), client_get_fd(client));
 	pthread_mutex_lock(&cr->mutex);
 	//check if client is registered
-	int fd = client_get_fd(client);
-	if(cr->fd[fd] != 1) {
+	int slot = client_get_slot(client);
+	if(slot < 0 || slot >= cr->client_thread_counts || cr->clients[slot] != client) {
 		error("client not registered");
 		pthread_mutex_unlock(&cr->mutex);
 		return -1;
 	}
 
-	//remove client from array
-	for(int i = 0; i < MAX_CLIENTS; i++) {
-		if(cr->clients[i]) {
-			if(client_get_fd(cr->clients[i]) == client_get_fd(client)) {
-				cr->clients[i] = NULL;
-				//decrement client reference count
-				// client_unref(client, "client is being unregistered");
-				break;
-			}
-		}
-		if(i == MAX_CLIENTS - 1) {
-			error("client not found");
-			pthread_mutex_unlock(&cr->mutex);
-			return -1;
-		}
-	}
-
-	//decrement client count
-	cr->client_thread_counts--;
-	//unregister fd
-	cr->fd[fd] = -1;
-	debug("%ld: Unregister client fd %d (total connected: %d)", pthread_self(), fd, cr->client_thread_counts);
+	//fill the hole with the last client
+	CLIENT *last = cr->clients[--cr->client_thread_counts];
+	cr->clients[slot] = last;
+	client_set_slot(last, slot);
+	cr->clients[cr->client_thread_counts] = NULL;
+	client_set_slot(client, -1);
+	debug("%ld: Unregister client fd %d (total connected: %d)", pthread_self(), client_get_fd(client), cr->client_thread_counts);
 	client_unref(client, "because client is being unregistered");
 
 	//if total connected is 0, allow threads to proceed
@@ -221,28 +270,325 @@ int creg_unregister(CLIENT_REGISTRY *cr, CLIENT *client) {
  */
 CLIENT *creg_lookup(CLIENT_REGISTRY *cr, char *user) {
 	pthread_mutex_lock(&cr->mutex);
-	for(int i = 0; i < MAX_CLIENTS; i++) {
-		if(cr->clients[i]) {
-			PLAYER *player;
-			//get player from client
-			if((player = client_get_player(cr->clients[i]))) {
-				//check if player name matches
-				if(!(strcmp(player_get_name(player), user))) {
-					//increment client reference count
-					client_ref(cr->clients[i], "for reference being returned by creg_lookup()");
-					pthread_mutex_unlock(&cr->mutex);
-					return cr->clients[i];
-				}
-			}
+	CLIENT *client;
+	if((client = strmap_get(cr->users, user)))
+		client_ref(client, "for reference being returned by creg_lookup()");
+	pthread_mutex_unlock(&cr->mutex);
+	return client;
+}
+
+/*
+ * Record that a CLIENT is logged in under a username, so that it can be
+ * found by creg_lookup().  No other CLIENT may be logged in under the
+ * same name.
+ *
+ * @param cr  The client registry.
+ * @param client  The CLIENT that is logging in.
+ * @param user  The username, which must remain valid until the CLIENT
+ * is removed with creg_remove_user().
+ * @return 0 if the username was recorded, -1 if another CLIENT is
+ * already logged in under it.
+ */
+int creg_add_user(CLIENT_REGISTRY *cr, CLIENT *client, char *user) {
+	pthread_mutex_lock(&cr->mutex);
+	int ret = strmap_put(cr->users, user, client);
+	pthread_mutex_unlock(&cr->mutex);
+	return ret;
+}
+
+/*
+ * Forget the username under which a CLIENT was logged in.
+ *
+ * @param cr  The client registry.
+ * @param client  The CLIENT that is logging out.
+ * @param user  The username that was passed to creg_add_user().
+ */
+void creg_remove_user(CLIENT_REGISTRY *cr, CLIENT *client, char *user) {
+	pthread_mutex_lock(&cr->mutex);
+	if(strmap_get(cr->users, user) == client)
+		strmap_remove(cr->users, user);
+	pthread_mutex_unlock(&cr->mutex);
+}
+
+/*
+ * Record that the listing of logged-in users has changed, because a
+ * client has logged in or out or the rating of a logged-in player has
+ * changed.  The listing is rebuilt when it is next requested.
+ *
+ * @param cr  The client registry.
+ */
+void creg_users_changed(CLIENT_REGISTRY *cr) {
+	atomic_fetch_add_explicit(&cr->users_version, 1, memory_order_release);
+}
+
+/*
+ * Compare two entries of a listing by name.
+ */
+static int creg_user_compare(const void *a, const void *b) {
+	const CREG_USER *x = a, *y = b;
+	unsigned int n = x->name_length < y->name_length ? x->name_length : y->name_length;
+	int c = memcmp(x->line, y->line, n);
+	return c ? c : (int)x->name_length - (int)y->name_length;
+}
+
+/*
+ * Compare two entries of a listing by rating, and by name among equal
+ * ratings.  The entries are those of the index, which is in order of
+ * name by then, so their addresses give the order of their names.
+ */
+static int creg_user_compare_rating(const void *a, const void *b) {
+	const CREG_USER *x = *(CREG_USER **)a, *y = *(CREG_USER **)b;
+	if(x->rating != y->rating)
+		return x->rating < y->rating ? -1 : 1;
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * Compare the name in an entry of a listing with a string, looking at
+ * no more than the first "n" characters of the string if "n" is not
+ * zero.
+ */
+static int creg_user_compare_name(CREG_USERS *users, int i, const char *name, size_t n) {
+	const CREG_USER *u = &users->index[i];
+	size_t len = u->name_length;
+	if(n && n < len)
+		len = n;
+	int c = strncmp(u->line, name, len);
+	return c ? c : name[len] ? -1 : 0;
+}
+
+/*
+ * Find the first entry of a listing whose name compares greater than a
+ * string (or not less, if "equal" is set), in the sense of
+ * creg_user_compare_name().
+ */
+static int creg_users_search(CREG_USERS *users, const char *name, size_t n, int equal) {
+	int lo = 0, hi = users->count;
+	while(lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		int c = creg_user_compare_name(users, mid, name, n);
+		if(c > 0 || (equal && c == 0))
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return lo;
+}
+
+/*
+ * Find the first entry, in order of rating, that is rated above a rating
+ * (or not below it, if "equal" is set), or that is rated the same and
+ * whose name compares greater than "after" if that is not NULL.
+ */
+static int creg_users_search_rating(CREG_USERS *users, int rating, const char *after, int equal) {
+	int lo = 0, hi = users->count;
+	while(lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		const CREG_USER *u = users->by_rating[mid];
+		int c = u->rating < rating ? -1 : u->rating > rating;
+		if(!c && after)
+			c = creg_user_compare_name(users, u - users->index, after, 0);
+		if(c > 0 || (equal && !after && c == 0))
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return lo;
+}
+
+/*
+ * Build and publish a listing of the logged-in users that is at least
+ * as recent as the current version.
+ */
+static CREG_USERS *creg_rebuild_users(CLIENT_REGISTRY *cr) {
+	pthread_mutex_lock(&cr->users_mutex);
+	// The version is read before the clients are, so that a change made
+	// while the listing is being built leaves it out of date.
+	unsigned int version = atomic_load_explicit(&cr->users_version, memory_order_acquire);
+	CREG_USERS *old = atomic_load_explicit(&cr->users_listing, memory_order_relaxed);
+	if(old && old->version == version) {
+		// Somebody else rebuilt it while we waited.
+		pthread_mutex_unlock(&cr->users_mutex);
+		return old;
+	}
+
+	// Take the logged-in players, with references, in one pass under the
+	// registry lock, and render the listing from them after letting go
+	// of it.  Logins do not wait for that lock (see client_login()), so a
+	// second pass could find players that were not counted by the first.
+	PLAYER **players;
+	if(!(players = creg_all_players(cr))) {
+		pthread_mutex_unlock(&cr->users_mutex);
+		return NULL;
+	}
+	// Allow for the longest rating, since ratings can change meanwhile.
+	size_t size = 1;
+	int count = 0;
+	for(; players[count]; count++)
+		size += strlen(player_get_name(players[count])) + sizeof("\t-2147483648\n") - 1;
+	CREG_USERS *users = NULL;
+	CREG_USER *index = NULL, **by_rating = NULL;
+	char *lines = NULL;
+	if(!(users = malloc(sizeof(CREG_USERS) + size)) || !(index = malloc((count + 1) * sizeof(CREG_USER)))
+	   || !(by_rating = malloc((count + 1) * sizeof(CREG_USER *))) || !(lines = malloc(size))) {
+		error("malloc failed");
+		pthread_mutex_unlock(&cr->users_mutex);
+		for(int i = 0; i < count; i++)
+			player_unref(players[i], "after failing to build users listing");
+		free(players);
+		free(users);
+		free(index);
+		free(by_rating);
+		return NULL;
+	}
+	size_t len = 0;
+	for(int i = 0; i < count; i++) {
+		char *name = player_get_name(players[i]);
+		int rating = player_get_rating(players[i]);
+		int n = sprintf(lines + len, "%s\t%d", name, rating);
+		index[i] = (CREG_USER) {
+			.line = lines + len,
+			.name_length = strlen(name),
+			.line_length = n,
+			.rating = rating
+		};
+		len += n;
+		player_unref(players[i], "after adding to users listing");
+	}
+	free(players);
+
+	qsort(index, count, sizeof(CREG_USER), creg_user_compare);
+	len = 0;
+	for(int i = 0; i < count; i++) {
+		memcpy(users->text + len, index[i].line, index[i].line_length);
+		index[i].line = users->text + len;
+		len += index[i].line_length;
+		users->text[len++] = '\n';
+	}
+	free(lines);
+	for(int i = 0; i < count; i++)
+		by_rating[i] = &index[i];
+	qsort(by_rating, count, sizeof(CREG_USER *), creg_user_compare_rating);
+
+	// The last line has no newline; the null character takes its place.
+	if(len)
+		len--;
+	users->text[len] = '\0';
+	users->version = version;
+	users->count = count;
+	users->index = index;
+	users->by_rating = by_rating;
+	users->length = len + 1;
+
+	atomic_store_explicit(&cr->users_listing, users, memory_order_release);
+	pthread_mutex_unlock(&cr->users_mutex);
+	if(old)
+		epoch_retire(old, creg_users_free);
+	debug("%ld: Rebuilt users listing (version %u, %d users, %zu bytes)", pthread_self(), version,
+	      count, users->length);
+	return users;
+}
+
+/*
+ * Get the current listing, rebuilding it if it is out of date.
+ */
+static CREG_USERS *creg_current_users(CLIENT_REGISTRY *cr) {
+	unsigned int version = atomic_load_explicit(&cr->users_version, memory_order_acquire);
+	CREG_USERS *users = atomic_load_explicit(&cr->users_listing, memory_order_acquire);
+	if(!users || users->version != version)
+		users = creg_rebuild_users(cr);
+	return users;
+}
+
+/*
+ * Get the listing of logged-in users, with one "name<TAB>rating" line
+ * per user, the lines separated by newlines and the whole terminated
+ * by a null character.  The caller must be in an epoch critical section
+ * (see epoch.h), and the listing remains valid until it leaves it.
+ *
+ * @param cr  The client registry.
+ * @param lenp  Set to the length of the listing, including the
+ * terminating null character.
+ * @return  The listing, or NULL if it could not be built.
+ */
+const char *creg_users(CLIENT_REGISTRY *cr, size_t *lenp) {
+	CREG_USERS *users;
+	if(!(users = creg_current_users(cr)))
+		return NULL;
+	*lenp = users->length;
+	return users->text;
+}
+
+/*
+ * Copy a page of the listing of logged-in users, in the format of
+ * creg_users().  The page holds the users selected by a query, except
+ * that it ends early if the next of them would not fit in the buffer.
+ * This takes time proportional to the size of the page plus the number
+ * of users skipped by the rating filter, not to the number logged in.
+ *
+ * @param cr  The client registry.
+ * @param query  The users to be selected.
+ * @param buf  Storage for the page, which is null-terminated.
+ * @param size  The size of the storage.
+ * @param lenp  Set to the length of the page, including the terminating
+ * null character.
+ * @return 1 if more users match the query after the last one on the
+ * page, 0 if none do, or -1 if the listing could not be built.
+ */
+int creg_users_page(CLIENT_REGISTRY *cr, const CREG_USERS_QUERY *query, char *buf,
+		    size_t size, size_t *lenp) {
+	epoch_enter();
+	CREG_USERS *users;
+	if(!(users = creg_current_users(cr))) {
+		epoch_exit();
+		return -1;
+	}
+
+	// Names with the prefix form a contiguous run of the listing, and
+	// ratings in the band a contiguous run of the index by rating.
+	size_t prefix_length = query->prefix ? strlen(query->prefix) : 0;
+	int rated = query->min_rating != INT_MIN || query->max_rating != INT_MAX;
+	int i = 0, end = users->count;
+	if(rated) {
+		i = creg_users_search_rating(users, query->min_rating, query->after, 1);
+		end = creg_users_search_rating(users, query->max_rating, NULL, 0);
+	} else {
+		if(prefix_length) {
+			i = creg_users_search(users, query->prefix, prefix_length, 1);
+			end = creg_users_search(users, query->prefix, prefix_length, 0);
 		}
-		if(i == MAX_CLIENTS - 1) {
-			error("client not found");
-			pthread_mutex_unlock(&cr->mutex);
-			return NULL;
+		if(query->after) {
+			int j = creg_users_search(users, query->after, 0, 0);
+			if(j > i)
+				i = j;
 		}
 	}
-	pthread_mutex_unlock(&cr->mutex);
-	return NULL;
+
+	size_t len = 0;
+	int count = 0, more = 0;
+	for(; i < end; i++) {
+		CREG_USER *u = rated ? users->by_rating[i] : &users->index[i];
+		// A line that could never fit is left out rather than leaving
+		// the client unable to get past it.
+		if(u->line_length + 1 > size || (rated && prefix_length &&
+		   (u->name_length < prefix_length || memcmp(u->line, query->prefix, prefix_length))))
+			continue;
+		if(count == query->limit || len + u->line_length + 1 > size) {
+			more = 1;
+			break;
+		}
+		memcpy(buf + len, u->line, u->line_length);
+		len += u->line_length;
+		buf[len++] = '\n';
+		count++;
+	}
+	epoch_exit();
+
+	if(len)
+		len--;
+	buf[len] = '\0';
+	*lenp = len + 1;
+	return more;
 }
 
 /*
@@ -265,25 +611,17 @@ PLAYER **creg_all_players(CLIENT_REGISTRY *cr) {
 		return NULL;
 	}
 
-	int client_counted = 0;
 	int player_counted = 0;
-	for(int i = 0; i < MAX_CLIENTS; i++) {
-		if(cr->clients[i]) {
-			PLAYER *player;
-			//get player from client
-			if((player = client_get_player(cr->clients[i]))) {
-				//increment player reference count
-				player_ref(player, "for reference being added to players list");
-				players[player_counted] = player;
-				player_counted++;
-			}
-			client_counted++;
-			if(client_counted == cr->client_thread_counts) {
-				players[player_counted] = NULL;
-				break;
-			}
+	for(int i = 0; i < cr->client_thread_counts; i++) {
+		PLAYER *player;
+		//get player from client
+		if((player = client_get_player(cr->clients[i]))) {
+			//increment player reference count
+			player_ref(player, "for reference being added to players list");
+			players[player_counted++] = player;
 		}
 	}
+	players[player_counted] = NULL;
 
 	//realloc player array
 	// PLAYER **newPlayers;
@@ -331,11 +669,10 @@ void creg_wait_for_empty(CLIENT_REGISTRY *cr) {
  * @param cr  The client registry.
  */
 void creg_shutdown_all(CLIENT_REGISTRY *cr) {
-	for(int i = 0; i < 1024; i++) {
-		if(cr->fd[i] == 1) {
-			shutdown(cr->fd[i], SHUT_RDWR);
-			creg_unregister(cr, cr->clients[i]);
-			close(cr->fd[i]);
-		}
+	pthread_mutex_lock(&cr->mutex);
+	for(int i = 0; i < cr->client_thread_counts; i++) {
+		debug("%ld: Shutting down client %d", pthread_self(), client_get_fd(cr->clients[i]));
+		shutdown(client_get_fd(cr->clients[i]), SHUT_RD);
 	}
+	pthread_mutex_unlock(&cr->mutex);
 }
\ No newline at end of file
@@ -0,0 +1,179 @@
+#include "epoch.h"
+#include "debug.h"
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/*
+ * The global epoch only ever advances, and it can only advance from E to
+ * E + 1 when every thread in a critical section entered it during epoch
+ * E.  An object retired during epoch E might be read by threads that
+ * entered during E or E - 1 (whose read of the global epoch raced with
+ * the advance), so it is safe to destroy once the global epoch reaches
+ * E + 2.
+ *
+ * Each thread has a record of whether it is in a critical section, and
+ * if so, in which epoch it entered.  Records are kept on a list that
+ * only grows; the record of a thread that exits is marked free and is
+ * reused by the next new thread, so with a thread per connection the
+ * list stays as long as the largest number of threads ever alive at
+ * once.
+ */
+typedef struct epoch_thread {
+	// (epoch << 1) | 1 while in a critical section, otherwise 0.
+	atomic_uint state;
+	atomic_int in_use;
+	struct epoch_thread *next;
+} EPOCH_THREAD;
+
+typedef struct epoch_garbage {
+	void *ptr;
+	void (*destroy)(void *);
+	unsigned int epoch;
+	struct epoch_garbage *next;
+} EPOCH_GARBAGE;
+
+static atomic_uint global_epoch = 1;
+static EPOCH_THREAD *_Atomic threads;
+static __thread EPOCH_THREAD *self;
+static pthread_key_t self_key;
+static pthread_once_t self_key_once = PTHREAD_ONCE_INIT;
+
+static EPOCH_GARBAGE *garbage;
+static pthread_mutex_t garbage_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void epoch_thread_exit(void *arg) {
+	EPOCH_THREAD *t = arg;
+	atomic_store_explicit(&t->state, 0, memory_order_release);
+	atomic_store_explicit(&t->in_use, 0, memory_order_release);
+}
+
+static void epoch_make_key(void) {
+	pthread_key_create(&self_key, epoch_thread_exit);
+}
+
+/*
+ * Find or create the calling thread's record.
+ */
+static EPOCH_THREAD *epoch_register(void) {
+	pthread_once(&self_key_once, epoch_make_key);
+	EPOCH_THREAD *t;
+	for(t = atomic_load_explicit(&threads, memory_order_acquire); t; t = t->next) {
+		int expected = 0;
+		if(atomic_compare_exchange_strong(&t->in_use, &expected, 1))
+			break;
+	}
+	if(!t) {
+		if(!(t = calloc(1, sizeof(EPOCH_THREAD)))) {
+			// Nothing sensible to do without a record.
+			error("calloc failed");
+			abort();
+		}
+		atomic_init(&t->in_use, 1);
+		t->next = atomic_load_explicit(&threads, memory_order_relaxed);
+		while(!atomic_compare_exchange_weak_explicit(&threads, &t->next, t,
+							     memory_order_release, memory_order_relaxed))
+			;
+	}
+	pthread_setspecific(self_key, t);
+	return self = t;
+}
+
+/*
+ * Enter a read-side critical section.
+ */
+void epoch_enter(void) {
+	EPOCH_THREAD *t = self ? self : epoch_register();
+	unsigned int epoch = atomic_load_explicit(&global_epoch, memory_order_relaxed);
+	atomic_store_explicit(&t->state, (epoch << 1) | 1, memory_order_relaxed);
+	// Make our entry visible before anything we read inside the critical
+	// section; pairs with the fence in epoch_try_advance().
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
+/*
+ * Leave a read-side critical section.
+ */
+void epoch_exit(void) {
+	atomic_store_explicit(&self->state, 0, memory_order_release);
+}
+
+/*
+ * Advance the global epoch if every thread in a critical section has
+ * seen the current one.
+ *
+ * @return  The global epoch.
+ */
+static unsigned int epoch_try_advance(void) {
+	unsigned int epoch = atomic_load_explicit(&global_epoch, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	for(EPOCH_THREAD *t = atomic_load_explicit(&threads, memory_order_acquire); t; t = t->next) {
+		unsigned int state = atomic_load_explicit(&t->state, memory_order_relaxed);
+		if((state & 1) && (state >> 1) != epoch)
+			return epoch;
+	}
+	atomic_thread_fence(memory_order_acquire);
+	if(atomic_compare_exchange_strong(&global_epoch, &epoch, epoch + 1))
+		epoch++;
+	return epoch;
+}
+
+/*
+ * Arrange for an object that has been unpublished to be destroyed once
+ * no thread can still be reading it.  Objects retired earlier may be
+ * destroyed by this call.
+ *
+ * @param ptr  The object.
+ * @param destroy  The function that destroys it, e.g. free().
+ */
+void epoch_retire(void *ptr, void (*destroy)(void *)) {
+	EPOCH_GARBAGE *g;
+	if(!(g = malloc(sizeof(EPOCH_GARBAGE)))) {
+		// Better to leak it than to free it under a reader.
+		error("malloc failed");
+		return;
+	}
+	pthread_mutex_lock(&garbage_mutex);
+	*g = (EPOCH_GARBAGE) {
+		.ptr = ptr,
+		.destroy = destroy,
+		.epoch = atomic_load_explicit(&global_epoch, memory_order_relaxed),
+		.next = garbage
+	};
+	garbage = g;
+
+	// Unlink whatever is now safe, and destroy it after unlocking.
+	unsigned int epoch = epoch_try_advance();
+	EPOCH_GARBAGE *done = NULL, **gp = &garbage;
+	while((g = *gp)) {
+		if(epoch - g->epoch >= 2) {
+			*gp = g->next;
+			g->next = done;
+			done = g;
+		} else {
+			gp = &g->next;
+		}
+	}
+	pthread_mutex_unlock(&garbage_mutex);
+
+	while((g = done)) {
+		done = g->next;
+		g->destroy(g->ptr);
+		free(g);
+	}
+}
+
+/*
+ * Destroy everything that has been retired.  This may only be called
+ * once no thread will enter a critical section again, e.g. at shutdown.
+ */
+void epoch_fini(void) {
+	pthread_mutex_lock(&garbage_mutex);
+	EPOCH_GARBAGE *g;
+	while((g = garbage)) {
+		garbage = g->next;
+		g->destroy(g->ptr);
+		free(g);
+	}
+	pthread_mutex_unlock(&garbage_mutex);
+}
@@ -1,8 +1,15 @@
 #include "game.h"
+#include "game_ext.h"
+#include "refcount.h"
+#include "stats.h"
+#include "slab.h"
 #include "debug.h"
+#include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <string.h>
+#include <stdalign.h>
+#include <stdatomic.h>
 
 /*
  * A GAME represents the current state of a game between participating
@@ -12,6 +19,167 @@
  * A GAME object will not be freed until its reference count reaches zero.
  */
 
+/*
+ * The board is kept as a pair of bitboards, one per side, packed into
+ * 64-bit words.  Index 0 is X (the first player) and index 1 is O.
+ * Square (r, c), counting rows and columns from zero, is bit
+ * r * stride + c, where the stride is one more than the number of
+ * columns: the spare bit at the end of each row is never set, so that a
+ * line shifted past the edge of the board runs into it instead of
+ * wrapping onto the next row.
+ */
+typedef uint64_t GAME_WORD;
+
+#define GAME_WORD_BITS 64
+#define GAME_BOARD_WORDS ((GAME_MAX_SIDE * (GAME_MAX_SIDE + 1) + GAME_WORD_BITS - 1) / GAME_WORD_BITS)
+
+typedef GAME_WORD GAME_BOARD[GAME_BOARD_WORDS];
+
+/*
+ * Shift a bitboard towards bit zero: dst = src >> n.  Words beyond the
+ * first "words" are taken to be zero.  dst may be the same as src.
+ */
+static void game_shift(GAME_WORD *dst, const GAME_WORD *src, int n, int words) {
+	int w = n / GAME_WORD_BITS, b = n % GAME_WORD_BITS;
+	for(int i = 0; i < words; i++) {
+		GAME_WORD lo = i + w < words ? src[i + w] : 0;
+		GAME_WORD hi = i + w + 1 < words ? src[i + w + 1] : 0;
+		dst[i] = b ? lo >> b | hi << (GAME_WORD_BITS - b) : lo;
+	}
+}
+
+static int game_any(const GAME_WORD *board, int words) {
+	GAME_WORD any = 0;
+	for(int i = 0; i < words; i++)
+		any |= board[i];
+	return any != 0;
+}
+
+/*
+ * Shift a bitboard of one word towards bit zero, as game_shift() does.
+ * A line can be long enough to take a shift past the end of the word,
+ * which leaves nothing, where a plain >> would be undefined.
+ */
+static GAME_WORD game_shift_word(GAME_WORD src, int n) {
+	return n < GAME_WORD_BITS ? src >> n : 0;
+}
+
+/*
+ * Find the runs of "length" set bits, "step" bits apart, in a bitboard of
+ * one word, as game_runs() does for any bitboard.
+ */
+static GAME_WORD game_runs_word(GAME_WORD board, int step, int length) {
+	int n = 1;
+	for(; 2 * n <= length; n *= 2)
+		board &= game_shift_word(board, n * step);
+	if(n < length)
+		board &= game_shift_word(board, (length - n) * step);
+	return board;
+}
+
+/*
+ * Find the windows that game_windows() would find, in bitboards of one
+ * word.
+ */
+static GAME_WORD game_windows_word(GAME_WORD free, GAME_WORD empty, int step, int length, int most) {
+	GAME_WORD counts[GAME_MAX_SIDE + 1];
+	counts[0] = free;
+	for(int t = 1; t <= most; t++)
+		counts[t] = 0;
+	for(int j = 0; j < length; j++) {
+		GAME_WORD f = game_shift_word(free, j * step), e = game_shift_word(empty, j * step);
+		for(int t = most; t > 0; t--)
+			counts[t] = f & ((counts[t] & ~e) | (counts[t - 1] & e));
+		counts[0] &= f & ~e;
+	}
+	GAME_WORD found = 0;
+	for(int t = 0; t <= most; t++)
+		found |= counts[t];
+	return found;
+}
+
+/*
+ * Find the runs of "length" set bits, "step" bits apart, in a bitboard:
+ * on return "runs" has a bit set for each square from which such a run
+ * starts.  Runs of n bits are doubled by shifting and masking, so this
+ * takes about log2(length) passes over the board, whatever its size.
+ *
+ * @return  Nonzero if there is any such run.
+ */
+static int game_runs(GAME_WORD *runs, const GAME_WORD *board, int step, int length, int words) {
+	GAME_WORD shifted[GAME_BOARD_WORDS];
+	memcpy(runs, board, words * sizeof(GAME_WORD));
+	int n = 1;
+	for(; 2 * n <= length; n *= 2) {
+		game_shift(shifted, runs, n * step, words);
+		for(int i = 0; i < words; i++)
+			runs[i] &= shifted[i];
+	}
+	// Two overlapping runs of n make one of "length", as n > length / 2.
+	if(n < length) {
+		game_shift(shifted, runs, (length - n) * step, words);
+		for(int i = 0; i < words; i++)
+			runs[i] &= shifted[i];
+	}
+	return game_any(runs, words);
+}
+
+/*
+ * Find the windows of "length" squares, "step" bits apart, that lie
+ * wholly within the "free" squares and include at most "most" of the
+ * "empty" ones.  "counts[t]" tracks the windows that have met t empty
+ * squares so far, as the window is extended one square at a time.
+ *
+ * @return  Nonzero if there is any such window.
+ */
+static int game_windows(const GAME_WORD *free, const GAME_WORD *empty, int step, int length,
+			int most, int words) {
+	GAME_WORD counts[GAME_MAX_SIDE + 1][GAME_BOARD_WORDS];
+	GAME_WORD f[GAME_BOARD_WORDS], e[GAME_BOARD_WORDS];
+	memcpy(counts[0], free, words * sizeof(GAME_WORD));
+	for(int t = 1; t <= most; t++)
+		memset(counts[t], 0, words * sizeof(GAME_WORD));
+	for(int j = 1; j <= length; j++) {
+		// Extend each window by its square j - 1.
+		game_shift(f, free, (j - 1) * step, words);
+		game_shift(e, empty, (j - 1) * step, words);
+		for(int i = 0; i < words; i++) {
+			for(int t = most; t > 0; t--)
+				counts[t][i] = f[i] & ((counts[t][i] & ~e[i]) | (counts[t - 1][i] & e[i]));
+			counts[0][i] &= f[i] & ~e[i];
+		}
+	}
+	int found = 0;
+	for(int t = 0; t <= most; t++)
+		found |= game_any(counts[t], words);
+	return found;
+}
+
+/*
+ * A GAME_STATE is an immutable snapshot of the rendered state of a game.
+ * The GAME holds one reference to its current snapshot.  When a move is
+ * made, a snapshot that nobody else holds is patched in place; one that
+ * has been handed out is replaced by a patched copy instead.  The text
+ * is sized for the board, which is why it comes last.
+ *
+ * The first snapshot of a game of tic-tac-toe is kept inside the GAME,
+ * and as snapshots are normally released as soon as they have been
+ * sent, it is usually the only one the game ever has.  Each reference
+ * handed out to it holds a reference to the GAME as well, which
+ * game_state_unref() releases.  Copies of tic-tac-toe snapshots come
+ * from a slab cache, and larger ones from malloc().
+ */
+typedef struct game_state {
+	atomic_int ref_count;
+	unsigned int version;
+	size_t length;
+	struct game *game;	// The GAME that holds this state inside it, if any.
+	int pooled;		// Whether this state came from the slab cache.
+	char text[];
+} GAME_STATE;
+
+#define GAME_STATE_INLINE_SIZE (sizeof(GAME_STATE) + GAME_STATE_SIZE_FOR(3, 3))
+
 /*
  * The GAME type is a structure type that defines the state of a game.
  * You will have to give a complete structure definition in game.c.
@@ -19,15 +187,23 @@
  * that might be called concurrently are thread-safe.
  */
 typedef struct game {
-	// char game_state[31];
-	char *game_state;
-	int game_board[9];
-	int box_indexes[9];
-	// char box_indexes[9];
+	GAME_STATE *state;
+	unsigned int version;
+	GAME_GEOMETRY geometry;
+	int stride;		// Bits per row of a bitboard.
+	int words;		// Words of a bitboard in use.
+	int squares;		// Squares on the board.
+	int filled;		// Squares occupied.
+	size_t state_size;	// Size of a GAME_STATE for this board.
+	size_t trailer_offset;	// Offset in the rendered state of the "X to move" line.
+	int steps[4];		// Bit distances along rows, columns and diagonals.
+	GAME_BOARD game_board[2];
+	GAME_BOARD squares_mask;	// All the squares on the board.
+	alignas(GAME_STATE) char state_buffer[GAME_STATE_INLINE_SIZE];
 	int game_terminated;
 	GAME_ROLE winner;
 	GAME_ROLE current_player;
-	int ref_count;
+	REFCOUNT ref_count;
 	pthread_mutex_t mutex;
 } GAME;
 // {' ', ' ', ' ', '\n', '-', '-', '-', '-', '-', '\n',' ', ' ', ' ', '\n', '-', '-', '-', '-', '-', '\n', ' ', ' ', ' ', '\n', '\0'}
@@ -40,6 +216,128 @@ typedef struct game_move {
 	GAME_ROLE player;
 } GAME_MOVE;
 
+/*
+ * Get the bit of a bitboard that stands for a square, numbered from 1.
+ */
+static int game_square_bit(GAME *game, int square) {
+	int columns = game->geometry.columns;
+	return (square - 1) / columns * game->stride + (square - 1) % columns;
+}
+
+/*
+ * Get the offset in the rendered state of the character that shows a
+ * square, numbered from 1.  Each row of squares is followed by a row of
+ * dashes, both 2 * columns characters long with their newlines.
+ */
+static size_t game_square_offset(GAME *game, int square) {
+	int columns = game->geometry.columns;
+	return (square - 1) / columns * 4 * columns + (square - 1) % columns * 2;
+}
+
+/*
+ * Determine whether a side has a complete line.
+ */
+static int game_has_line(GAME *game, const GAME_WORD *board) {
+	GAME_WORD runs[GAME_BOARD_WORDS];
+	int won = 0;
+	if(game->words == 1) {
+		for(int d = 0; d < 4 && !won; d++)
+			won = game_runs_word(board[0], game->steps[d], game->geometry.line) != 0;
+		return won;
+	}
+	for(int d = 0; d < 4 && !won; d++)
+		won = game_runs(runs, board, game->steps[d], game->geometry.line, game->words);
+	return won;
+}
+
+/*
+ * Determine whether a side can still complete a line, given the squares
+ * held by each side and the number of moves it has left.  A line is out
+ * of reach if the other side holds any of it, or if it has more empty
+ * squares than there are moves left to fill them.
+ */
+static int game_can_win(GAME *game, const GAME_WORD *mine, const GAME_WORD *theirs, int moves) {
+	GAME_WORD free[GAME_BOARD_WORDS], empty[GAME_BOARD_WORDS], runs[GAME_BOARD_WORDS];
+	int words = game->words, line = game->geometry.line;
+	for(int i = 0; i < words; i++) {
+		free[i] = game->squares_mask[i] & ~theirs[i];
+		empty[i] = free[i] & ~mine[i];
+	}
+	int open = 0;
+	for(int d = 0; d < 4 && !open; d++) {
+		// With a move for every square of a line, only the other side's
+		// pieces can put it out of reach.
+		if(words == 1 && moves >= line)
+			open = game_runs_word(free[0], game->steps[d], line) != 0;
+		else if(words == 1)
+			open = game_windows_word(free[0], empty[0], game->steps[d], line, moves) != 0;
+		else if(moves >= line)
+			open = game_runs(runs, free, game->steps[d], line, words);
+		else
+			open = game_windows(free, empty, game->steps[d], line, moves, words);
+	}
+	return open;
+}
+
+/*
+ * Release the reference that a game holds to one of its states.  That
+ * reference to a state inside the game does not count as a reference to
+ * the game, so unlike the others it is not released by
+ * game_state_unref().
+ */
+static void game_drop_state(GAME_STATE *state) {
+	if(state->game)
+		atomic_fetch_sub_explicit(&state->ref_count, 1, memory_order_acq_rel);
+	else
+		game_state_unref(state);
+}
+
+/*
+ * Get the current state of a game in a form that may be modified.  If any
+ * reference to the current snapshot has been handed out, it is replaced
+ * by a private copy.  The caller must hold the game's mutex.
+ *
+ * @return  The GAME_STATE, or NULL if a copy could not be allocated.
+ */
+static GAME_STATE *game_writable_state(GAME *game) {
+	GAME_STATE *state = game->state;
+	// References are only handed out under the game's mutex, so if ours
+	// is the only one, it stays that way.
+	if(atomic_load_explicit(&state->ref_count, memory_order_acquire) == 1)
+		return state;
+	GAME_STATE *copy;
+	int pooled = game->state_size <= GAME_STATE_INLINE_SIZE;
+	if(!(copy = pooled ? slab_alloc(SLAB_GAME_STATE, GAME_STATE_INLINE_SIZE)
+			   : malloc(game->state_size))) {
+		error("malloc failed");
+		return NULL;
+	}
+	memcpy(copy, state, game->state_size);
+	atomic_init(&copy->ref_count, 1);
+	copy->game = NULL;
+	copy->pooled = pooled;
+	game->state = copy;
+	game_drop_state(state);
+	return copy;
+}
+
+/*
+ * Bring the "to move" line of a rendered state up to date with the
+ * game, and give the state a new version.  The caller must hold the
+ * game's mutex.
+ */
+static void game_render_trailer(GAME *game, GAME_STATE *state) {
+	char *trailer = state->text + game->trailer_offset;
+	if(game->current_player == NULL_ROLE) {
+		*trailer = '\0';
+		state->length = game->trailer_offset;
+	} else {
+		strcpy(trailer, game->current_player == FIRST_PLAYER_ROLE ? "X to move" : "O to move");
+		state->length = game->trailer_offset + strlen(trailer);
+	}
+	state->version = ++game->version;
+}
+
 /*
  * Create a new game in an initial state.  The returned game has a
  * reference count of one.
@@ -48,65 +346,83 @@ typedef struct game_move {
  * otherwise NULL.
  */
 GAME *game_create(void) {
-	GAME *game = malloc(sizeof(GAME));
+	return game_create_geometry(&GAME_GEOMETRY_DEFAULT);
+}
+
+/*
+ * Create a new game with a given geometry, in an initial state.  The
+ * returned game has a reference count of one.
+ *
+ * @param geometry  The geometry, which must be valid (see
+ * game_parse_geometry()).
+ * @return the newly created GAME, if initialization was successful,
+ * otherwise NULL.
+ */
+GAME *game_create_geometry(const GAME_GEOMETRY *geometry) {
+	int rows = geometry->rows, columns = geometry->columns;
+	if(rows < 1 || rows > GAME_MAX_SIDE || columns < 1 || columns > GAME_MAX_SIDE ||
+	   geometry->line < 1 || (geometry->line > rows && geometry->line > columns)) {
+		error("game_create: invalid geometry %d,%d,%d", rows, columns, geometry->line);
+		return NULL;
+	}
+	GAME *game = slab_alloc(SLAB_GAME, sizeof(GAME));
 	if (game == NULL) {
 		debug("game_create: malloc failed");
 		return NULL;
 	}
-	
+
+	// The mutex is a default one, set up by its static initializer
+	// rather than pthread_mutex_init(); it needs no destroying either.
+	int stride = columns + 1;
 	*game = (GAME) {
-		// .game_state = {' ', ' ', ' ', '\n', '-', '-', '-', '-', '-', '\n',' ', ' ', ' ', '\n', '-', '-', '-', '-', '-', '\n', ' ', ' ', ' ', '\n', '\0'},
+		.geometry = *geometry,
+		.stride = stride,
+		.words = (rows * stride + GAME_WORD_BITS - 1) / GAME_WORD_BITS,
+		.squares = rows * columns,
+		.state_size = sizeof(GAME_STATE) + GAME_STATE_SIZE_FOR(rows, columns),
+		.trailer_offset = (2 * rows - 1) * 2 * columns,
+		.steps = { 1, stride, stride + 1, stride - 1 },
 		.game_terminated = 0,
 		.current_player = FIRST_PLAYER_ROLE,
 		.winner = NULL_ROLE,
-		.ref_count = 0
+		.ref_count = 0,
+		.mutex = PTHREAD_MUTEX_INITIALIZER
 	};
-
-	game->game_state = calloc(31, sizeof(char));
-	strcpy(game->game_state, " | | \n-----\n | | \n-----\n | | \n");
-
-	// if(!(game->game_state)) {
-	// 	debug("game_create: calloc failed");
-	// 	free(game);
-	// 	return NULL;
-	// }
-
-	// char *game_state = " | | \n-----\n | | \n-----\n | | \n";
-	// game->game_state = game_state;
-
-	for(int i = 0; i < 9; i++) {
-		game->game_board[i] = 0;
+	for(int row = 0; row < rows * stride; row += stride) {
+		for(int bit = row; bit < row + columns; bit++)
+			game->squares_mask[bit / GAME_WORD_BITS] |= (GAME_WORD)1 << bit % GAME_WORD_BITS;
 	}
 
-	int j = 0;
-	for(int i = 0; i < 3; i++) {
-		game->box_indexes[i] = j;
-		// game->box_indexes[i] = &(game->game_state[i]);
-		// game->box_indexes[i] = game->game_state[i];
-		// debug("game_state[i] = %d into %d", game->game_state[i], i);
-		game->box_indexes[i + 3] = j + 12;
-		// game->box_indexes[i + 3] = &(game->game_state[i + 12]);
-		// game->box_indexes[i + 3] = game->game_state[i + 12];
-		// debug("game_state[i+12] = %d into %d", game->game_state[i + 12], i + 3);
-		game->box_indexes[i + 6] = j + 24;
-		// game->box_indexes[i + 6] = &(game->game_state[i + 24]);
-		// game->box_indexes[i + 6] = game->game_state[i + 24];
-		// debug("game_state[i+24] = %d into %d", game->game_state[i + 24], i + 6);
-
-		j += 2;
-	}
-
-	// for(int i = 0; i < 9; i++) {
-	// 	debug("box_indexes[%d] = %d", i, game->box_indexes[i]);
-	// 	debug("game_state[%d] = %d", game->box_indexes[i], game->game_state[game->box_indexes[i]]);
-	// }
-	// debug("game_state: %s", game->game_state);
-
-	if (pthread_mutex_init(&game->mutex, NULL) != 0) {
-		debug("game_create: pthread_mutex_init failed");
-		free(game);
-		return NULL;
+	if(game->state_size <= GAME_STATE_INLINE_SIZE) {
+		game->state = (GAME_STATE *)game->state_buffer;
+		*game->state = (GAME_STATE) {
+			.ref_count = 1,
+			.game = game
+		};
+	} else {
+		if(!(game->state = malloc(game->state_size))) {
+			debug("game_create: malloc failed");
+			slab_free(SLAB_GAME, game);
+			return NULL;
+		}
+		*game->state = (GAME_STATE) {
+			.ref_count = 1
+		};
+	}
+	// Rows of " | | " separated by rows of "-----", as wide as the board.
+	char *text = game->state->text;
+	for(int r = 0; r < rows; r++) {
+		if(r) {
+			memset(text, '-', 2 * columns - 1);
+			text += 2 * columns - 1;
+			*text++ = '\n';
+		}
+		for(int c = 0; c < columns; c++) {
+			*text++ = ' ';
+			*text++ = c < columns - 1 ? '|' : '\n';
+		}
 	}
+	game_render_trailer(game, game->state);
 
 	game_ref(game, "for newly created game");
 
@@ -123,16 +439,13 @@ GAME *game_create(void) {
  * @return  The same GAME object that was passed as a parameter.
  */
 GAME *game_ref(GAME *game, char *why) {
-	pthread_mutex_lock(&game->mutex);
-	if(!game) {
-		error("game_ref: game is NULL");
-		pthread_mutex_unlock(&game->mutex);
-		return NULL;
-	}
-	game->ref_count++;
-	debug("%ld: Increase reference count on game %p (%d -> %d) %s", 
-	pthread_self(), game, game->ref_count - 1, game->ref_count, why);
-	pthread_mutex_unlock(&game->mutex);
+#ifdef DEBUG
+	int count = refcount_inc(&game->ref_count);
+	debug("%ld: Increase reference count on game %p (%d -> %d) %s",
+	      pthread_self(), game, count - 1, count, why);
+#else
+	refcount_inc(&game->ref_count);
+#endif
 	return game;
 }
 
@@ -147,165 +460,134 @@ GAME *game_ref(GAME *game, char *why) {
  * the reference counting.
  */
 void game_unref(GAME *game, char *why) {
-	pthread_mutex_lock(&game->mutex);
-	if(!game) {
-		error("game_ref: game is NULL");
-		pthread_mutex_unlock(&game->mutex);
-		return;
-	}
-	game->ref_count--;
+	int count = refcount_dec(&game->ref_count);
 	debug("%ld: Decrease reference count on game %p (%d -> %d) %s",
-	pthread_self(), game, game->ref_count + 1, game->ref_count, why);
-	if (game->ref_count == 0) {
-		free(game->game_state);
-		pthread_mutex_unlock(&game->mutex);
-		pthread_mutex_destroy(&game->mutex);
+	      pthread_self(), game, count + 1, count, why);
+	if(count == 0) {
+		game_drop_state(game->state);
 		debug("Freeing game %p", game);
-		free(game);
-		return;
+		slab_free(SLAB_GAME, game);
 	}
-	pthread_mutex_unlock(&game->mutex);
 }
 
 /*
- * Apply a GAME_MOVE to a GAME.
- * If the move is illegal in the current GAME state, then it is an error.
+ * Play a move for a player, on a game whose mutex the caller holds.
  *
- * @param game  The GAME to which the move is to be applied.
- * @param move  The GAME_MOVE to be applied to the game.
- * @return 0 if application of the move was successful, otherwise -1.
+ * @param game  The GAME in which the move is made.
+ * @param square  The square, numbered from 1, to be occupied.
+ * @param player  The GAME_ROLE of the player making the move.
+ * @return 0 if the move was legal and was made, otherwise -1.
  */
-int game_apply_move(GAME *game, GAME_MOVE *move) {
-	pthread_mutex_lock(&game->mutex);
-	if(!game) {
-		error("game_apply_move: game is NULL");
-		pthread_mutex_unlock(&game->mutex);
-		return -1;
-	}
-	if(!move) {
-		error("game_apply_move: move is NULL");
-		pthread_mutex_unlock(&game->mutex);
+static int game_play_locked(GAME *game, int square, GAME_ROLE player) {
+	if(player == NULL_ROLE || game->current_player != player) {
+		error("game_apply_move: move is out of turn");
 		return -1;
 	}
-	if(game->current_player != move->player) {
-		error("game_apply_move: move is out of turn");
-		pthread_mutex_unlock(&game->mutex);
+	if(square < 1 || square > game->squares) {
+		error("game_apply_move: move is off the board");
 		return -1;
 	}
-	// debug("game_apply_move: move->moveBox = %d", move->moveBox);
-	// debug("game_apply_move: game->game_board[move->moveBox] = %d", game->game_board[move->moveBox]);
-	if(game->game_board[move->moveBox - 1]) {
+	int bit = game_square_bit(game, square);
+	int word = bit / GAME_WORD_BITS;
+	GAME_WORD mask = (GAME_WORD)1 << bit % GAME_WORD_BITS;
+	if((game->game_board[0][word] | game->game_board[1][word]) & mask) {
 		error("game_apply_move: move is illegal");
-		pthread_mutex_unlock(&game->mutex);
 		return -1;
 	}
-	switch(move->player){
-		case FIRST_PLAYER_ROLE:
-		// X
-			// game->game_board[move->moveBox] = -1;
-			game->game_board[move->moveBox - 1] = -1;
-			// debug("move->moveBox = %d", move->moveBox);
-			// debug("game->box_indexes[move->moveBox] = %d", game->box_indexes[move->moveBox - 1]);
-			// debug("game->game_state[game->box_indexes[move->moveBox]] = %c", game->game_state[game->box_indexes[move->moveBox]]);
-			debug("Apply move %d<-X to game %p", move->moveBox, game);
-			game->game_state[game->box_indexes[move->moveBox - 1]] = 'X';
-			// debug("game->game_state[game->box_indexes[move->moveBox]] = %c", game->game_state[game->box_indexes[move->moveBox]]);
-			// *(game->box_indexes[move->moveBox]) = 'X';
-			// game->box_indexes[move->moveBox] = 'X';
-			game->current_player = SECOND_PLAYER_ROLE;
-			break;
-		case SECOND_PLAYER_ROLE:
-		// O
-			game->game_board[move->moveBox - 1] = 1;
-			// debug("move->moveBox = %d", move->moveBox);
-			// debug("game->box_indexes[move->moveBox] = %d", game->box_indexes[move->moveBox]);
-			// debug("game->game_state[game->box_indexes[move->moveBox]] = %c", game->game_state[game->box_indexes[move->moveBox]]);
-			debug("Apply move %d<-O to game %p", move->moveBox, game);
-			game->game_state[game->box_indexes[move->moveBox - 1]] = 'O';
-			// debug("game->game_state[game->box_indexes[move->moveBox]] = %c", game->game_state[game->box_indexes[move->moveBox]]);
-			// *(game->box_indexes[move->moveBox]) = 'O';
-			// game->box_indexes[move->moveBox] = 'O';
-			game->current_player = FIRST_PLAYER_ROLE;
-			break;
-		case NULL_ROLE:
-			error("game_apply_move: move is NULL_ROLE");
-			pthread_mutex_unlock(&game->mutex);
-			return -1;
-	}
+	GAME_STATE *state;
+	if(!(state = game_writable_state(game)))
+		return -1;
+
+	int side = player == FIRST_PLAYER_ROLE ? 0 : 1;
+	game->game_board[side][word] |= mask;
+	game->filled++;
+	debug("Apply move %d<-%c to game %p", square, side ? 'O' : 'X', game);
+	state->text[game_square_offset(game, square)] = side ? 'O' : 'X';
+	game->current_player = side ? FIRST_PLAYER_ROLE : SECOND_PLAYER_ROLE;
 
-	//check for row wins
-	for(int i = 0; i < 9; i+= 3) {
-		if((game->game_board[i] + game->game_board[i + 1] + game->game_board[i + 2]) == 3) {
-			game->winner = SECOND_PLAYER_ROLE;
-		} else if ((game->game_board[i] + game->game_board[i + 1] + game->game_board[i + 2]) == -3) {
-			game->winner = FIRST_PLAYER_ROLE;
+	// Only the side that just moved can have completed a line.
+	if(game_has_line(game, game->game_board[side])) {
+		game->winner = player;
+		game->current_player = NULL_ROLE;
+		game->game_terminated = 1;
+	} else {
+		// Once neither side can complete a line, the rest of the game
+		// cannot change the result, so it is adjudicated a draw at once.
+		// The side to move has the odd one of the empty squares left.
+		int empty = game->squares - game->filled;
+		if(!game_can_win(game, game->game_board[!side], game->game_board[side], (empty + 1) / 2) &&
+		   !game_can_win(game, game->game_board[side], game->game_board[!side], empty / 2)) {
+			game->current_player = NULL_ROLE;
+			game->game_terminated = 1;
+			if(empty) {
+				debug("Game %p adjudicated a draw with %d squares empty", game, empty);
+				stats_add(STAT_DRAWS_ADJUDICATED, 1);
+				stats_add(STAT_MOVES_SAVED, empty);
+			}
 		}
 	}
-	//check for column wins
-	for(int i = 0; i < 3; i++) {
-		if((game->game_board[i] + game->game_board[i + 3] + game->game_board[i + 6]) == 3) {
-			game->winner = SECOND_PLAYER_ROLE;
-		} else if ((game->game_board[i] + game->game_board[i + 3] + game->game_board[i + 6]) == -3) {
-			game->winner = FIRST_PLAYER_ROLE;
-		}
+	game_render_trailer(game, state);
+	return 0;
+}
+
+/*
+ * Apply a GAME_MOVE to a GAME.
+ * If the move is illegal in the current GAME state, then it is an error.
+ *
+ * @param game  The GAME to which the move is to be applied.
+ * @param move  The GAME_MOVE to be applied to the game.
+ * @return 0 if application of the move was successful, otherwise -1.
+ */
+int game_apply_move(GAME *game, GAME_MOVE *move) {
+	if(!move) {
+		error("game_apply_move: move is NULL");
+		return -1;
 	}
-	//check for left to right diagonal wins
-	if((game->game_board[0] + game->game_board[4] + game->game_board[8]) == 3) {
-		game->winner = SECOND_PLAYER_ROLE;
-	} else if ((game->game_board[0] + game->game_board[4] + game->game_board[8]) == -3) {
-		game->winner = FIRST_PLAYER_ROLE;
-	}
-	//check for right to left diagonal wins
-	if((game->game_board[2] + game->game_board[4] + game->game_board[6]) == 3) {
-		game->winner = SECOND_PLAYER_ROLE;
-	} else if ((game->game_board[2] + game->game_board[4] + game->game_board[6]) == -3) {
-		game->winner = FIRST_PLAYER_ROLE;
-	}
-
-	int tie = 0;
-	//check for draw
-	for(int i = 0; i < 9; i++) {
-		if(game->game_board[i] == 0) {
-			break;
-		} else if (i == 8) {
-			// game->winner = NULL_ROLE;
-			tie = 1;
-		}
+	pthread_mutex_lock(&game->mutex);
+	int ret = game_play_locked(game, move->moveBox, move->player);
+	pthread_mutex_unlock(&game->mutex);
+	return ret;
+}
+
+/*
+ * Apply a move given as a GAME_MOVE_CODE to a GAME.
+ *
+ * @param game  The GAME to which the move is to be applied.
+ * @param code  The move, as produced by game_parse_move_code().
+ * @return 0 if application of the move was successful, otherwise -1.
+ */
+int game_apply_move_code(GAME *game, GAME_MOVE_CODE code) {
+	if(!code) {
+		error("game_apply_move_code: invalid move");
+		return -1;
 	}
+	pthread_mutex_lock(&game->mutex);
+	int ret = game_play_locked(game, GAME_MOVE_SQUARE(code), GAME_MOVE_ROLE(code));
+	pthread_mutex_unlock(&game->mutex);
+	return ret;
+}
 
-	if(game->winner == NULL_ROLE && tie == 1) {
-		game->winner = NULL_ROLE;
-		game->current_player = NULL_ROLE;
-		game->game_terminated = 1;
-	} else if(game->winner != NULL_ROLE) {
-		game->current_player = NULL_ROLE;
-		game->game_terminated = 1;
+/*
+ * Parse a move and apply it to a GAME, taking the game's mutex once
+ * for both.  This is equivalent to game_parse_move() followed by
+ * game_apply_move(), without allocating a GAME_MOVE.
+ *
+ * @param game  The GAME in which the move is to be made.
+ * @param role  The GAME_ROLE of the player making the move, which must
+ * be the role currently on the move.
+ * @param str  The string that is to be interpreted as a move.
+ * @return 0 if the move was parsed and applied, otherwise -1.
+ */
+int game_play_move(GAME *game, GAME_ROLE role, char *str) {
+	GAME_MOVE_CODE code;
+	if(!(code = game_parse_move_code(role, str))) {
+		error("game_play_move: invalid move");
+		return -1;
 	}
-	// debug("game->game_state: %s", game->game_state);
-	// int spaces = 0;
-	// // char *currentChar = game->game_state[0];
-	// int currIndex = 0;
-	// while(game->game_state[currIndex] != '\0') {
-	// 	if(game->game_state[currIndex] == ' ') {
-	// 		spaces++;
-	// 	}
-	// 	if(spaces == move->moveBox) {
-	// 		switch(move->player){
-	// 			case FIRST_PLAYER_ROLE:
-	// 				game->game_board[move->moveBox] = -1;
-	// 				game->game_state[currIndex] = 'X';
-	// 				break;
-	// 			case SECOND_PLAYER_ROLE:
-	// 				game->game_board[move->moveBox] = 1;
-	// 				game->game_state[currIndex] = 'O';
-	// 				break;
-	// 		}
-	// 		break;
-	// 	}
-	// 	currIndex++;
-	// }
+	pthread_mutex_lock(&game->mutex);
+	int ret = game_play_locked(game, GAME_MOVE_SQUARE(code), role);
 	pthread_mutex_unlock(&game->mutex);
-	return 0;
+	return ret;
 }
 
 /*
@@ -329,9 +611,15 @@ int game_resign(GAME *game, GAME_ROLE role) {
 		pthread_mutex_unlock(&game->mutex);
 		return -1;
 	}
+	GAME_STATE *state;
+	if(!(state = game_writable_state(game))) {
+		pthread_mutex_unlock(&game->mutex);
+		return -1;
+	}
 	game->current_player = NULL_ROLE;
 	game->winner = role == FIRST_PLAYER_ROLE ? SECOND_PLAYER_ROLE : FIRST_PLAYER_ROLE;
 	game->game_terminated = 1;
+	game_render_trailer(game, state);
 	pthread_mutex_unlock(&game->mutex);
 	return 0;
 }
@@ -347,25 +635,194 @@ int game_resign(GAME *game, GAME_ROLE role) {
  * @return  A string that describes the current GAME state.
  */
 char *game_unparse_state(GAME *game) {
-	if(game->current_player == FIRST_PLAYER_ROLE) {
-		int len = snprintf(NULL, 0, "%sX to move", game->game_state);
-		char *str = malloc(len + 1);
-		// snprintf(str, len + 1, "%s X to move", game->game_state);
-		if(str != NULL) {
-			snprintf(str, len + 1, "%sX to move", game->game_state);
-			str[len] = '\0'; // Add null terminator
-		}
-		return str;
-	} else if(game->current_player == SECOND_PLAYER_ROLE) {
-		int len = snprintf(NULL, 0, "%sO to move", game->game_state);
-		char *str = malloc(len + 1);
-		if(str != NULL) {
-			snprintf(str, len + 1, "%sO to move", game->game_state);
-			str[len] = '\0'; // Add null terminator
-		}
-		return str;
+	pthread_mutex_lock(&game->mutex);
+	char *str = strdup(game->state->text);
+	pthread_mutex_unlock(&game->mutex);
+	return str;
+}
+
+/*
+ * Get a snapshot of the current GAME state, rendered as for
+ * game_unparse_state().
+ *
+ * @param game  The GAME for which the state is to be obtained.
+ * @return  The current GAME_STATE, with its reference count incremented.
+ */
+GAME_STATE *game_get_state(GAME *game) {
+	pthread_mutex_lock(&game->mutex);
+	GAME_STATE *state = game->state;
+	atomic_fetch_add_explicit(&state->ref_count, 1, memory_order_relaxed);
+	if(state->game)
+		game_ref(game, "for snapshot of its state");
+	pthread_mutex_unlock(&game->mutex);
+	return state;
+}
+
+/*
+ * Release a reference to a GAME_STATE, freeing it if it was the last.
+ *
+ * @param state  The GAME_STATE to be released.
+ */
+void game_state_unref(GAME_STATE *state) {
+	GAME *game = state->game;
+	if(game) {
+		// The state lives as long as the game does.
+		atomic_fetch_sub_explicit(&state->ref_count, 1, memory_order_acq_rel);
+		game_unref(game, "after snapshot of its state");
+	} else if(atomic_fetch_sub_explicit(&state->ref_count, 1, memory_order_acq_rel) == 1) {
+		if(state->pooled)
+			slab_free(SLAB_GAME_STATE, state);
+		else
+			free(state);
 	}
-	return strdup(game->game_state);
+}
+
+/*
+ * Get the text of a GAME_STATE, which is null-terminated.
+ *
+ * @param state  The GAME_STATE.
+ * @return  The rendered state, valid for as long as the reference is held.
+ */
+const char *game_state_text(GAME_STATE *state) {
+	return state->text;
+}
+
+/*
+ * Get the length of the text of a GAME_STATE, not counting the null
+ * terminator.
+ *
+ * @param state  The GAME_STATE.
+ * @return  The length of the text.
+ */
+size_t game_state_length(GAME_STATE *state) {
+	return state->length;
+}
+
+/*
+ * Get the version of a GAME_STATE.  Every change to a game, whether a
+ * move or a resignation, produces a state with a higher version.
+ *
+ * @param state  The GAME_STATE.
+ * @return  The version number, starting from 1 for a new game.
+ */
+unsigned int game_state_version(GAME_STATE *state) {
+	return state->version;
+}
+
+/*
+ * Encode the current state of a GAME in compact binary form, without any
+ * string formatting.  See game_ext.h for the encoding.
+ *
+ * @param game  The GAME whose state is to be encoded.
+ * @param buf  Storage for at least GAME_PACKED_STATE_SIZE bytes.
+ * @return  The number of bytes stored.
+ */
+int game_pack_state(GAME *game, unsigned char *buf) {
+	int size = GAME_PACKED_STATE_SIZE_FOR(game->squares);
+	// Two bits per square, starting from the last byte.
+	memset(buf, 0, size);
+	pthread_mutex_lock(&game->mutex);
+	for(int square = 1; square <= game->squares; square++) {
+		int bit = game_square_bit(game, square);
+		int cell = 0;
+		if(game->game_board[0][bit / GAME_WORD_BITS] >> bit % GAME_WORD_BITS & 1)
+			cell = 1;
+		else if(game->game_board[1][bit / GAME_WORD_BITS] >> bit % GAME_WORD_BITS & 1)
+			cell = 2;
+		int shift = 2 * (square - 1);
+		buf[size - 1 - shift / 8] |= cell << shift % 8;
+	}
+	int to_move = 0;
+	if(game->current_player == FIRST_PLAYER_ROLE)
+		to_move = 1;
+	else if(game->current_player == SECOND_PLAYER_ROLE)
+		to_move = 2;
+	pthread_mutex_unlock(&game->mutex);
+	int shift = 2 * game->squares;
+	buf[size - 1 - shift / 8] |= to_move << shift % 8;
+	return size;
+}
+
+/*
+ * Get the squares held by each player in a game of tic-tac-toe, as 9-bit
+ * masks in which bit i stands for square i + 1.
+ *
+ * @param game  The GAME to be queried.
+ * @param x  Set to the squares held by the first player.
+ * @param o  Set to the squares held by the second player.
+ * @return 0 if the game is tic-tac-toe, otherwise -1, with the masks
+ * left unset.
+ */
+int game_get_position(GAME *game, unsigned int *x, unsigned int *o) {
+	if(!game_geometry_is_default(&game->geometry))
+		return -1;
+	pthread_mutex_lock(&game->mutex);
+	// Close up the spare bit at the end of each row of four.
+	GAME_WORD b0 = game->game_board[0][0], b1 = game->game_board[1][0];
+	*x = (b0 & 0x7) | (b0 >> 1 & 0x38) | (b0 >> 2 & 0x1c0);
+	*o = (b1 & 0x7) | (b1 >> 1 & 0x38) | (b1 >> 2 & 0x1c0);
+	pthread_mutex_unlock(&game->mutex);
+	return 0;
+}
+
+/*
+ * Get the geometry of a GAME.
+ *
+ * @param game  The GAME to be queried.
+ * @param geometry  Set to its geometry.
+ */
+void game_get_geometry(GAME *game, GAME_GEOMETRY *geometry) {
+	*geometry = game->geometry;
+}
+
+/*
+ * Interpret a string of the form "m,n,k" as a game geometry.  The numbers
+ * of rows and columns must be from 1 to GAME_MAX_SIDE, and the length of
+ * a winning line from 1 to the larger of them.
+ *
+ * @param str  The string.
+ * @param geometry  Set to the geometry described.
+ * @return 0 if the string describes a valid geometry, otherwise -1.
+ */
+int game_parse_geometry(const char *str, GAME_GEOMETRY *geometry) {
+	int values[3];
+	for(int i = 0; i < 3; i++) {
+		if(*str < '0' || *str > '9')
+			return -1;
+		values[i] = 0;
+		while(*str >= '0' && *str <= '9' && values[i] <= GAME_MAX_SIDE)
+			values[i] = 10 * values[i] + *str++ - '0';
+		if(*str++ != (i < 2 ? ',' : '\0'))
+			return -1;
+	}
+	*geometry = (GAME_GEOMETRY) { .rows = values[0], .columns = values[1], .line = values[2] };
+	if(geometry->rows < 1 || geometry->rows > GAME_MAX_SIDE ||
+	   geometry->columns < 1 || geometry->columns > GAME_MAX_SIDE || geometry->line < 1 ||
+	   (geometry->line > geometry->rows && geometry->line > geometry->columns))
+		return -1;
+	return 0;
+}
+
+/*
+ * Render a game geometry in the form accepted by game_parse_geometry().
+ *
+ * @param geometry  The geometry.
+ * @param buf  Storage for at least GAME_GEOMETRY_SIZE bytes.
+ * @return  The length of the string, not counting the null terminator.
+ */
+int game_unparse_geometry(const GAME_GEOMETRY *geometry, char *buf) {
+	return snprintf(buf, GAME_GEOMETRY_SIZE, "%d,%d,%d", geometry->rows, geometry->columns,
+			geometry->line);
+}
+
+/*
+ * Determine whether a game geometry is tic-tac-toe.
+ *
+ * @param geometry  The geometry.
+ * @return  1 if it is 3,3,3, otherwise 0.
+ */
+int game_geometry_is_default(const GAME_GEOMETRY *geometry) {
+	return geometry->rows == 3 && geometry->columns == 3 && geometry->line == 3;
 }
 
 /*
@@ -433,10 +890,10 @@ GAME_MOVE *game_parse_move(GAME *game, GAME_ROLE role, char *str) {
 
 	debug("game_parse_move: str = %s", str);
 
-	char num = str[0];
+	GAME_MOVE_CODE code = game_parse_move_code(role, str);
 
-	if(num < '1' || num > '9' || strlen(str) != 1) {
-		error("game_parse_move: num is not between 1 and 9");
+	if(!code || GAME_MOVE_SQUARE(code) > game->squares) {
+		error("game_parse_move: num is not between 1 and %d", game->squares);
 		pthread_mutex_unlock(&game->mutex);
 		return NULL;
 	}
@@ -449,7 +906,7 @@ GAME_MOVE *game_parse_move(GAME *game, GAME_ROLE role, char *str) {
 	}
 
 	*move = (GAME_MOVE) {
-		.moveBox = num - '0',
+		.moveBox = GAME_MOVE_SQUARE(code),
 		.player = role
 	};
 
@@ -458,6 +915,27 @@ GAME_MOVE *game_parse_move(GAME *game, GAME_ROLE role, char *str) {
 	return move;
 }
 
+/*
+ * Interpret a string as a move, without reference to any particular game
+ * and without allocating anything.
+ *
+ * @param role  The GAME_ROLE of the player making the move.
+ * @param str  The string that is to be interpreted as a move.
+ * @return  The GAME_MOVE_CODE for the move, or 0 if the string is not
+ * a move.
+ */
+GAME_MOVE_CODE game_parse_move_code(GAME_ROLE role, char *str) {
+	// A square number in decimal, without leading zeros.
+	if(!str || str[0] < '1' || str[0] > '9')
+		return 0;
+	int square = 0;
+	for(; *str >= '0' && *str <= '9' && square <= GAME_MAX_SQUARES; str++)
+		square = 10 * square + *str - '0';
+	if(*str != '\0' || square > GAME_MAX_SQUARES)
+		return 0;
+	return GAME_MOVE_CODE_MAKE(square, role);
+}
+
 /*
  * Get a string that describes a specified GAME_MOVE, in a format
  * appropriate to be shown to human users.  The returned string should
@@ -476,14 +954,13 @@ char *game_unparse_move(GAME_MOVE *move) {
 	}
 
 	char *str;
-	if(!(str = malloc(sizeof(char) * 2))) {
+	if(!(str = malloc(sizeof(char) * 4))) {
 		error("game_unparse_move: malloc failed");
 		return NULL;
 	}
 
 
-	str[0] = move->moveBox + '0';
-	str[1] = '\0';
+	snprintf(str, 4, "%d", move->moveBox);
 
 	// debug("game_unparse_move: str = %s", str);
 
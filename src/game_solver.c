@@ -0,0 +1,136 @@
+#include "game_solver.h"
+#include "game_ext.h"
+#include "debug.h"
+
+/*
+ * The table has an entry for every assignment of X, O or nothing to the
+ * nine squares, indexed by the base-3 number whose digit i is the content
+ * of square i + 1 (0 = empty, 1 = X, 2 = O).  "game_solver_base3" turns
+ * a 9-bit mask into the base-3 number with the same digits, so that the
+ * index of a position is two table lookups and an addition.  Entries
+ * for positions that cannot arise in play are left unsolved.
+ */
+#define GAME_SOLVER_KEYS 19683
+#define GAME_SOLVER_FULL 0x1ff
+#define GAME_SOLVER_UNSOLVED 0xff
+
+static const unsigned short game_solver_lines[] = {
+	0x007, 0x038, 0x1c0, 0x049, 0x092, 0x124, 0x111, 0x054
+};
+
+static unsigned short game_solver_base3[GAME_SOLVER_FULL + 1];
+static GAME_SOLUTION game_solver_table[GAME_SOLVER_KEYS];
+static int game_solver_solved;
+
+static int game_solver_has_line(unsigned int board) {
+	int won = 0;
+	for(int i = 0; i < sizeof(game_solver_lines) / sizeof(game_solver_lines[0]); i++)
+		won |= (board & game_solver_lines[i]) == game_solver_lines[i];
+	return won;
+}
+
+static unsigned int game_solver_key(unsigned int x, unsigned int o) {
+	return game_solver_base3[x] + 2 * game_solver_base3[o];
+}
+
+/*
+ * Solve a position and every position reachable from it, by minimax
+ * with the results of positions already solved reused.
+ */
+static GAME_SOLUTION *game_solver_search(unsigned int x, unsigned int o) {
+	GAME_SOLUTION *s = &game_solver_table[game_solver_key(x, o)];
+	if(s->winner != GAME_SOLVER_UNSOLVED)
+		return s;
+	game_solver_solved++;
+
+	if(game_solver_has_line(x)) {
+		*s = (GAME_SOLUTION) { .winner = FIRST_PLAYER_ROLE, .moves = 0, .best = 0 };
+		return s;
+	}
+	if(game_solver_has_line(o)) {
+		*s = (GAME_SOLUTION) { .winner = SECOND_PLAYER_ROLE, .moves = 0, .best = 0 };
+		return s;
+	}
+	if((x | o) == GAME_SOLVER_FULL) {
+		*s = (GAME_SOLUTION) { .winner = NULL_ROLE, .moves = 0, .best = 0 };
+		return s;
+	}
+
+	// Score each move for the side to move: 2 for a win, 1 for a draw,
+	// 0 for a loss.  Among equally scored moves, a win is best taken
+	// quickly and a loss put off.
+	int x_to_move = __builtin_popcount(x) == __builtin_popcount(o);
+	GAME_ROLE me = x_to_move ? FIRST_PLAYER_ROLE : SECOND_PLAYER_ROLE;
+	GAME_SOLUTION best = { .winner = NULL_ROLE, .moves = 0, .best = 0 };
+	int best_score = -1;
+	for(unsigned int bit = 1; bit <= GAME_SOLVER_FULL; bit <<= 1) {
+		if((x | o) & bit)
+			continue;
+		GAME_SOLUTION *child = x_to_move ? game_solver_search(x | bit, o)
+						 : game_solver_search(x, o | bit);
+		int score = child->winner == me ? 2 : child->winner == NULL_ROLE ? 1 : 0;
+		int moves = child->moves + 1;
+		if(score > best_score) {
+			best_score = score;
+			best = (GAME_SOLUTION) { .winner = child->winner, .moves = moves, .best = bit };
+		} else if(score == best_score) {
+			best.best |= bit;
+			if(score == 2 ? moves < best.moves : moves > best.moves)
+				best.moves = moves;
+		}
+	}
+	*s = best;
+	return s;
+}
+
+/*
+ * Solve all positions.  This must be called, once, before game_solve(),
+ * and takes about a millisecond.
+ *
+ * @return  The number of positions solved, GAME_SOLVER_POSITIONS.
+ */
+int game_solver_init(void) {
+	if(game_solver_solved)
+		return game_solver_solved;
+	for(unsigned int mask = 1; mask <= GAME_SOLVER_FULL; mask++) {
+		// Drop the lowest set bit, whose digit is 3 to the power of its
+		// position.
+		unsigned int low = __builtin_ctz(mask), power = 1;
+		for(unsigned int i = 0; i < low; i++)
+			power *= 3;
+		game_solver_base3[mask] = game_solver_base3[mask & (mask - 1)] + power;
+	}
+	for(int i = 0; i < GAME_SOLVER_KEYS; i++)
+		game_solver_table[i].winner = GAME_SOLVER_UNSOLVED;
+	game_solver_search(0, 0);
+	debug("Solved %d tic-tac-toe positions", game_solver_solved);
+	return game_solver_solved;
+}
+
+/*
+ * Look up the solution of a position.
+ *
+ * @param x  The squares held by X.
+ * @param o  The squares held by O.
+ * @return  The solution, or NULL if the position cannot arise in play.
+ */
+const GAME_SOLUTION *game_solve(unsigned int x, unsigned int o) {
+	if((x | o) > GAME_SOLVER_FULL || (x & o))
+		return NULL;
+	GAME_SOLUTION *s = &game_solver_table[game_solver_key(x, o)];
+	return s->winner == GAME_SOLVER_UNSOLVED ? NULL : s;
+}
+
+/*
+ * Look up the solution of the current position of a GAME.
+ *
+ * @param game  The GAME.
+ * @return  The solution of its position, as for game_solve(), or NULL if
+ * the game is not tic-tac-toe.
+ */
+const GAME_SOLUTION *game_solve_game(GAME *game) {
+	unsigned int x, o;
+	if(game_get_position(game, &x, &o) < 0)
+		return NULL;
+	return game_solve(x, o);
+}
@@ -1,5 +1,8 @@
 // #include "invitation.h"
 #include "client_registry.h"
+#include "invitation_ext.h"
+#include "refcount.h"
+#include "slab.h"
 #include "debug.h"
 #include <stdlib.h>
 #include <pthread.h>
@@ -17,8 +20,9 @@ typedef struct invitation {
 	CLIENT *target;
 	GAME_ROLE target_role;
 	INVITATION_STATE state;
+	GAME_GEOMETRY geometry;
 	GAME *game;
-	int reference_count;
+	REFCOUNT reference_count;
 	pthread_mutex_t mutex;
 } INVITATION;
 
@@ -36,13 +40,30 @@ typedef struct invitation {
  * was successful, otherwise NULL.
  */
 INVITATION *inv_create(CLIENT *source, CLIENT *target, GAME_ROLE source_role, GAME_ROLE target_role) {
+	return inv_create_geometry(source, target, source_role, target_role, &GAME_GEOMETRY_DEFAULT);
+}
+
+/*
+ * Create an INVITATION in the OPEN state, as for inv_create(), to a game
+ * of a given geometry.
+ *
+ * @param source  The CLIENT that is the source of this INVITATION.
+ * @param target  The CLIENT that is the target of this INVITATION.
+ * @param source_role  The GAME_ROLE to be played by the source of this INVITATION.
+ * @param target_role  The GAME_ROLE to be played by the target of this INVITATION.
+ * @param geometry  The geometry of the game.
+ * @return a reference to the newly created INVITATION, if initialization
+ * was successful, otherwise NULL.
+ */
+INVITATION *inv_create_geometry(CLIENT *source, CLIENT *target, GAME_ROLE source_role,
+				GAME_ROLE target_role, const GAME_GEOMETRY *geometry) {
 	if(client_get_fd(source) == client_get_fd(target)) {
 		debug("%ld: Source and target cannot be the same client", pthread_self());
 		return NULL;
 	}
 
 	INVITATION *inv;
-	if(!(inv = malloc(sizeof(INVITATION))))
+	if(!(inv = slab_alloc(SLAB_INVITATION, sizeof(INVITATION))))
 		return NULL;
 	
 	*inv = (INVITATION) {
@@ -51,16 +72,13 @@ INVITATION *inv_create(CLIENT *source, CLIENT *target, GAME_ROLE source_role, GA
 		.target = target,
 		.target_role = target_role,
 		.state = INV_OPEN_STATE,
+		.geometry = *geometry,
 		.game = NULL,
-		.reference_count = 0
+		.reference_count = 0,
+		// A default mutex needs no pthread_mutex_init() or destroying.
+		.mutex = PTHREAD_MUTEX_INITIALIZER
 	};
 
-	if (pthread_mutex_init(&inv->mutex, NULL) < 0) {
-		error("Mutex initialization failed");
-		free(inv);
-		return NULL;
-	}
-
 	client_ref(source, "as source of new invitation");
 	client_ref(target, "as target of new invitation");
 	inv_ref(inv, "for newly created invitation");
@@ -78,15 +96,12 @@ INVITATION *inv_create(CLIENT *source, CLIENT *target, GAME_ROLE source_role, GA
  * @return  The same INVITATION object that was passed as a parameter.
  */
 INVITATION *inv_ref(INVITATION *inv, char *why) {
-	pthread_mutex_lock(&inv->mutex);
-	if(!inv) {
-		error("NULL INV");
-		pthread_mutex_unlock(&inv->mutex);
-		return NULL;
-	} 
-	inv->reference_count++;
-	debug("%ld: Increase reference count on invitation %p (%d -> %d) %s", pthread_self(), inv, inv->reference_count - 1, inv->reference_count, why);
-	pthread_mutex_unlock(&inv->mutex);
+#ifdef DEBUG
+	int count = refcount_inc(&inv->reference_count);
+	debug("%ld: Increase reference count on invitation %p (%d -> %d) %s", pthread_self(), inv, count - 1, count, why);
+#else
+	refcount_inc(&inv->reference_count);
+#endif
 	return inv;
 }
 
@@ -102,30 +117,17 @@ INVITATION *inv_ref(INVITATION *inv, char *why) {
  *
  */
 void inv_unref(INVITATION *inv, char *why) {
-	pthread_mutex_lock(&inv->mutex);
-	if(!inv) {
-		error("NULL INV");
-		pthread_mutex_unlock(&inv->mutex);
-		return;
-	} 
-	inv->reference_count--;
-	debug("%ld: Decrease reference count on invitation %p (%d -> %d) %s", pthread_self(), inv, inv->reference_count + 1, inv->reference_count, why);
-	if(inv->reference_count == 0) {
+	int count = refcount_dec(&inv->reference_count);
+	debug("%ld: Decrease reference count on invitation %p (%d -> %d) %s", pthread_self(), inv, count + 1, count, why);
+	if(count == 0) {
 		debug("%ld: Free invitation %p", pthread_self(), inv);
 		client_unref(inv->source, "because invitation is being freed");
 		client_unref(inv->target, "because invitation is being freed");
 		if(inv->game) {
 			game_unref(inv->game, "because invitation is being freed");
 		}
-		pthread_mutex_unlock(&inv->mutex);
-		// inv_close(inv, );
-		pthread_mutex_destroy(&inv->mutex);
-		// free(inv->game);
-		free(inv);
-		// inv = NULL;
-		return;
+		slab_free(SLAB_INVITATION, inv);
 	}
-	pthread_mutex_unlock(&inv->mutex);
 }
 
 /*
@@ -208,6 +210,16 @@ GAME *inv_get_game(INVITATION *inv) {
 	return inv->game;
 }
 
+/*
+ * Get the geometry of the game offered by an INVITATION.
+ *
+ * @param inv  The INVITATION to be queried.
+ * @param geometry  Set to the geometry of the game.
+ */
+void inv_get_geometry(INVITATION *inv, GAME_GEOMETRY *geometry) {
+	*geometry = inv->geometry;
+}
+
 /*
  * Accept an INVITATION, changing it from the OPEN to the
  * ACCEPTED state, and creating a new GAME.  If the INVITATION was
@@ -229,7 +241,7 @@ int inv_accept(INVITATION *inv) {
 		return -1;
 	}
 	inv->state = INV_ACCEPTED_STATE;
-	inv->game = game_create();
+	inv->game = game_create_geometry(&inv->geometry);
 	if(!inv->game) {
 		error("Failed to create game");
 		pthread_mutex_unlock(&inv->mutex);
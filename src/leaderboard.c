@@ -0,0 +1,182 @@
+#include "leaderboard.h"
+#include "debug.h"
+#include <stdio.h>
+#include <pthread.h>
+
+#define LB_BUCKETS (LB_MAX_RATING - LB_MIN_RATING + 1)
+
+/*
+ * Buckets are numbered from the top, so that bucket 0 holds the best
+ * rating and the prefix sums of the Fenwick tree count the players
+ * rated above a bucket.  "lb_tree" is 1-based, as usual for a Fenwick
+ * tree, and lb_find() relies on LB_BUCKETS being a power of two.
+ */
+static int lb_tree[LB_BUCKETS + 1];
+static LB_NODE *lb_buckets[LB_BUCKETS];
+static pthread_mutex_t lb_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int lb_bucket(int rating) {
+	if(rating < LB_MIN_RATING)
+		rating = LB_MIN_RATING;
+	if(rating > LB_MAX_RATING)
+		rating = LB_MAX_RATING;
+	return LB_MAX_RATING - rating;
+}
+
+/*
+ * Add to the count of a bucket.
+ */
+static void lb_add(int bucket, int n) {
+	for(int i = bucket + 1; i <= LB_BUCKETS; i += i & -i)
+		lb_tree[i] += n;
+}
+
+/*
+ * Count the players in the buckets above a bucket.
+ */
+static int lb_above(int bucket) {
+	int n = 0;
+	for(int i = bucket; i > 0; i -= i & -i)
+		n += lb_tree[i];
+	return n;
+}
+
+/*
+ * Find the bucket holding the player of a given rank, counting from one,
+ * which must be no more than the number of players.
+ */
+static int lb_find(int rank) {
+	int bucket = 0;
+	for(int step = LB_BUCKETS; step; step >>= 1) {
+		if(bucket + step <= LB_BUCKETS && lb_tree[bucket + step] < rank) {
+			bucket += step;
+			rank -= lb_tree[bucket];
+		}
+	}
+	return bucket;
+}
+
+static void lb_link(LB_NODE *node) {
+	int bucket = lb_bucket(node->rating);
+	node->prev = NULL;
+	node->next = lb_buckets[bucket];
+	if(node->next)
+		node->next->prev = node;
+	lb_buckets[bucket] = node;
+	lb_add(bucket, 1);
+}
+
+static void lb_unlink(LB_NODE *node) {
+	int bucket = lb_bucket(node->rating);
+	if(node->prev)
+		node->prev->next = node->next;
+	else
+		lb_buckets[bucket] = node->next;
+	if(node->next)
+		node->next->prev = node->prev;
+	lb_add(bucket, -1);
+}
+
+/*
+ * Put a player on the leaderboard.
+ *
+ * @param node  The node embedded in the player, which must not already
+ * be on the leaderboard.
+ * @param player  The player.
+ * @param rating  Its rating.
+ */
+void lb_insert(LB_NODE *node, PLAYER *player, int rating) {
+	pthread_mutex_lock(&lb_mutex);
+	node->player = player;
+	node->rating = rating;
+	lb_link(node);
+	pthread_mutex_unlock(&lb_mutex);
+}
+
+/*
+ * Record a change in the rating of a player on the leaderboard.
+ *
+ * @param node  The player's node.
+ * @param rating  Its new rating.
+ */
+void lb_update(LB_NODE *node, int rating) {
+	pthread_mutex_lock(&lb_mutex);
+	if(lb_bucket(rating) != lb_bucket(node->rating)) {
+		lb_unlink(node);
+		node->rating = rating;
+		lb_link(node);
+	} else {
+		node->rating = rating;
+	}
+	pthread_mutex_unlock(&lb_mutex);
+}
+
+/*
+ * Take a player off the leaderboard.
+ *
+ * @param node  The player's node.
+ */
+void lb_remove(LB_NODE *node) {
+	pthread_mutex_lock(&lb_mutex);
+	lb_unlink(node);
+	pthread_mutex_unlock(&lb_mutex);
+}
+
+/*
+ * Get the rank of a player on the leaderboard.
+ *
+ * @param node  The player's node.
+ * @return  One more than the number of players rated above it.
+ */
+int lb_rank(LB_NODE *node) {
+	pthread_mutex_lock(&lb_mutex);
+	int rank = lb_above(lb_bucket(node->rating)) + 1;
+	pthread_mutex_unlock(&lb_mutex);
+	return rank;
+}
+
+/*
+ * List the best-rated players, with one "rank<TAB>name<TAB>rating" line
+ * per player, best first, the lines separated by newlines and the whole
+ * terminated by a null character.  The list ends early if the next line
+ * would not fit.
+ *
+ * @param k  The number of players wanted.
+ * @param buf  Storage for the list.
+ * @param size  The size of the storage, which must be at least one.
+ * @return  The length of the list, including the null character.
+ */
+size_t lb_top(int k, char *buf, size_t size) {
+	size_t len = 0;
+	int listed = 0;
+	pthread_mutex_lock(&lb_mutex);
+	// The whole of each bucket is taken before moving on to the next, so
+	// that the rank of the first player in a bucket is one more than the
+	// number listed so far.  Names are copied under the lock, because a
+	// player being destroyed cannot leave the leaderboard until then.
+	int total = lb_above(LB_BUCKETS);
+	while(listed < k && listed < total) {
+		int bucket = lb_find(listed + 1);
+		int rank = listed + 1;
+		for(LB_NODE *node = lb_buckets[bucket]; node && listed < k; node = node->next) {
+			// The newline goes where snprintf() put the null character,
+			// so that a last line that only fits once its newline has
+			// become the null character is not left out.
+			int n = snprintf(buf + len, size - len, "%d\t%s\t%d", rank,
+					 player_get_name(node->player), node->rating);
+			if(n < 0 || (size_t)n >= size - len)
+				goto full;
+			len += n;
+			buf[len++] = '\n';
+			listed++;
+		}
+	}
+full:
+	pthread_mutex_unlock(&lb_mutex);
+
+	// The last line has no newline; the null character takes its place.
+	if(len)
+		len--;
+	buf[len] = '\0';
+	return len + 1;
+}
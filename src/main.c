@@ -8,6 +8,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/resource.h>
 
 #include "debug.h"
 #include "protocol.h"
@@ -15,6 +16,16 @@
 #include "client_registry.h"
 #include "player_registry.h"
 #include "jeux_globals.h"
+#include "reactor.h"
+#include "service_pool.h"
+#include "transport.h"
+#include "out_queue.h"
+#include "acceptor.h"
+#include "stats.h"
+#include "slab.h"
+#include "epoch.h"
+#include "game_solver.h"
+#include "bot.h"
 #include "csapp.h"
 
 #ifdef DEBUG
@@ -25,15 +36,42 @@ static void terminate(int status);
 static void sigHandler(int sig);
 // static void echo(int connfd);
 static void *thread(void *vargp);
+static void dispatch_connection(int connfd);
+
+/*
+ * How accepted connections are to be serviced (see main()).
+ */
+static int eOption = 0;
+static int workers = 0;
 
 /*
  * "Jeux" game server.
  *
- * Usage: jeux <port>
+ * Usage: jeux -p <port> [-e [reactors] | -w <workers> [-q <depth>]] [-a <acceptors>] [-t rw|uring]
+ *             [-b <bots> [-l <level>]]
+ *
+ * With -e, client connections are serviced by a small number of epoll
+ * reactor threads (one by default) instead of a thread per connection.
+ * With -w, they are serviced by a fixed pool of worker threads, each of
+ * which takes whichever connection has requests ready, with at most
+ * <depth> connections waiting for a free worker.
+ * With -a, connections are accepted by <acceptors> threads, each with its
+ * own SO_REUSEPORT listening socket on the port.
+ * With -t uring, the reactors of -e wait for and receive packets through
+ * io_uring where the kernel supports it (see transport.h).
+ * With -b, <bots> built-in bot opponents are logged in, playing at
+ * <level> (0 for random moves up to BOT_LEVEL_PERFECT, the default, for
+ * perfect play).
  */
 int main(int argc, char *argv[])
 {
 	int pOption = 0;
+	int reactors = 1;
+	int acceptors = 1;
+	int queue_depth = 64;
+	int nbots = 0;
+	int bot_level = BOT_LEVEL_PERFECT;
+	TRANSPORT transport = TRANSPORT_RW;
 	// int hOption = 0;
 	// int dOption = 0;
 	// unsigned short port = 0;
@@ -55,6 +93,42 @@ int main(int argc, char *argv[])
 			// 	fprintf(stderr, "Usage: bin/jeux -p <port>\n");
 			// 	exit(EXIT_FAILURE);
 			// }
+		} else if(!strcmp(argv[i], "-e")) {
+			eOption = 1;
+			if(i + 1 < argc && argv[i + 1][0] >= '0' && argv[i + 1][0] <= '9') {
+				reactors = atoi(argv[i + 1]);
+				i++;
+			}
+		} else if(!strcmp(argv[i], "-w")) {
+			if(i + 1 < argc) {
+				workers = atoi(argv[i + 1]);
+				i++;
+			}
+		} else if(!strcmp(argv[i], "-q")) {
+			if(i + 1 < argc) {
+				queue_depth = atoi(argv[i + 1]);
+				i++;
+			}
+		} else if(!strcmp(argv[i], "-a")) {
+			if(i + 1 < argc) {
+				acceptors = atoi(argv[i + 1]);
+				i++;
+			}
+		} else if(!strcmp(argv[i], "-b")) {
+			if(i + 1 < argc) {
+				nbots = atoi(argv[i + 1]);
+				i++;
+			}
+		} else if(!strcmp(argv[i], "-l")) {
+			if(i + 1 < argc) {
+				bot_level = atoi(argv[i + 1]);
+				i++;
+			}
+		} else if(!strcmp(argv[i], "-t")) {
+			if(i + 1 < argc) {
+				transport = !strcmp(argv[i + 1], "uring") ? TRANSPORT_URING : TRANSPORT_RW;
+				i++;
+			}
 		// } else if(!strcmp(argv[i], "-h")) {
 		// 	hOption = 1;
 		// } else if(!strcmp(argv[i], "-d")) {
@@ -65,9 +139,9 @@ int main(int argc, char *argv[])
 	// on which the server should listen.
 	// debug("pOption: %d", pOption);
 	// debug("port: %s", port);
-	if(!pOption || !port) {
+	if(!pOption || !port || (eOption && workers)) {
 		// fprintf(stderr, "Usage: bin/jeux -p <port>\n");
-		error("Usage: bin/jeux -p <port>\n");
+		error("Usage: bin/jeux -p <port> [-e [reactors] | -w <workers> [-q <depth>]] [-a <acceptors>] [-t rw|uring] [-b <bots> [-l <level>]]\n");
 		exit(EXIT_FAILURE);
 	}
 	// debug("hi");
@@ -83,6 +157,7 @@ int main(int argc, char *argv[])
 	// player_registry.
 	client_registry = creg_init();
 	player_registry = preg_init();
+	game_solver_init();
 
 	// TODO: Set up the server socket and enter a loop to accept connections
 	// on this socket.  For each connection, a thread should be started to
@@ -117,15 +192,47 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+	// Every client needs a descriptor, so allow as many as we may.
+	struct rlimit rl;
+	if(!getrlimit(RLIMIT_NOFILE, &rl) && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		if(setrlimit(RLIMIT_NOFILE, &rl))
+			error("setrlimit: %s", strerror(errno));
+	}
+
 	//setup server socket
-	// int listenfd, *connfdp;
-	int listenfd, *connfdp, connfd;
-	socklen_t clientlen;
-	struct sockaddr_storage clientaddr; /* Enough space for any address */
-	// char client_hostname[MAXLINE], client_port[MAXLINE];
-	pthread_t tid;
+	int listenfd;
+
+	transport_init(transport);
 
-	if((listenfd = open_listenfd(port)) < 0) {
+	if(eOption && reactor_init(reactors) < 0) {
+		error("Failed to start reactor threads\n");
+		terminate(EXIT_FAILURE);
+	}
+
+	if(outq_init() < 0) {
+		error("Failed to start writer thread\n");
+		terminate(EXIT_FAILURE);
+	}
+
+	if(workers && pool_init(workers, queue_depth) < 0) {
+		error("Failed to start service workers\n");
+		terminate(EXIT_FAILURE);
+	}
+
+	if(nbots && bot_init(client_registry, player_registry, nbots, bot_level) < 0) {
+		error("Failed to start bots\n");
+		terminate(EXIT_FAILURE);
+	}
+
+	// Extra acceptors start accepting as soon as they are created, so
+	// everything they hand connections to has to be running first.
+	if(acceptors > 1) {
+		listenfd = acceptor_init(port, acceptors, dispatch_connection);
+	} else {
+		listenfd = open_listenfd(port);
+	}
+	if(listenfd < 0) {
 		fprintf(stderr, "bind: %s\n", strerror(errno));
 		// error("Open_listenfd: %s\n", strerror(errno));
 		terminate(EXIT_FAILURE);
@@ -133,39 +240,7 @@ int main(int argc, char *argv[])
 
 	debug("%ld: Jeux server listening on port %s\n", pthread_self(), port);
 
-	while(1) {
-		clientlen = sizeof(struct sockaddr_storage);
-		// connfdp = malloc(sizeof(int));
-		// if((*connfdp = accept(listenfd, (SA *)&clientaddr, &clientlen)) < 0) {
-		if((connfd = accept(listenfd, (SA *)&clientaddr, &clientlen)) < 0) {
-			// fprintf(stderr, "Accept: %s\n", strerror(errno));
-			error("Accept: %s\n", strerror(errno));
-			// terminate(EXIT_FAILURE);
-			free(connfdp);
-			continue;
-		} 
-		else {
-			if(!(connfdp = malloc(sizeof(int)))) {
-				// fprintf(stderr, "malloc: %s\n", strerror(errno));
-				error("malloc: %s\n", strerror(errno));
-				terminate(EXIT_FAILURE);
-			}
-			*connfdp = connfd;
-		}
-		// getnameinfo((SA *) &clientaddr, clientlen, client_hostname, MAXLINE,
-		// client_port, MAXLINiE, 0);
-		// printf("Connected to (%s, %s)\n", client_hostname, client_port);
-		// echo(connfd);
-		// Close(connfd);
-		// debug("Connection accepted");
-		// if(pthread_create(&tid, NULL, jeux_client_service, connfdp)) {
-		if(pthread_create(&tid, NULL, thread, connfdp)) {
-			// debug("errno: %d", errno);
-			// fprintf(stderr, "pthread_create: %s\n", strerror(errno));
-			error("pthread_create: %s\n", strerror(errno));
-			terminate(EXIT_FAILURE);
-		}
-	}
+	acceptor_loop(listenfd, dispatch_connection);
 
 	// fprintf(stderr, "You have to finish implementing main() "
 	// 				"before the Jeux server will function.\n");
@@ -183,6 +258,8 @@ void terminate(int status)
 	// Shutdown all client connections.
 	// This will trigger the eventual termination of service threads.
 	creg_shutdown_all(client_registry);
+	// Bots have no connection to shut down, so log them out directly.
+	bot_fini();
 
 	debug("%ld: Waiting for service threads to terminate...", pthread_self());
 	creg_wait_for_empty(client_registry);
@@ -191,6 +268,10 @@ void terminate(int status)
 	// Finalize modules.
 	creg_fini(client_registry);
 	preg_fini(player_registry);
+	epoch_fini();
+
+	stats_report();
+	slab_report();
 
 	debug("%ld: Jeux server terminating", pthread_self());
 	exit(status);
@@ -232,4 +313,34 @@ void *thread(void *vargp)
 	// close(*((int *)vargp));
 	// free(vargp);
 	return NULL;
-} 
\ No newline at end of file
+} 
+
+/*
+ * Hand an accepted connection to whatever is servicing connections:
+ * a reactor, the worker pool, or a new thread of its own.
+ */
+static void dispatch_connection(int connfd) {
+	int *connfdp;
+	pthread_t tid;
+
+	if(eOption) {
+		reactor_add(connfd);
+		return;
+	} else if(workers) {
+		pool_submit(connfd);
+		return;
+	}
+	if(!(connfdp = malloc(sizeof(int)))) {
+		error("malloc: %s\n", strerror(errno));
+		close(connfd);
+		return;
+	}
+	*connfdp = connfd;
+	if(pthread_create(&tid, NULL, thread, connfdp)) {
+		// Out of threads: refuse this connection but keep serving the
+		// ones we already have.
+		error("pthread_create: %s\n", strerror(errno));
+		free(connfdp);
+		close(connfd);
+	}
+}
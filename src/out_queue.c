@@ -0,0 +1,419 @@
+#include "out_queue.h"
+#include "transport.h"
+#include "debug.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#define OUTQ_MAX_IOV 64
+#define OUTQ_MAX_EVENTS 64
+
+/*
+ * A queued packet, or the unsent tail of one, with the header and payload
+ * copied into a single block.  Bytes data[off..len) remain to be sent.
+ */
+typedef struct outq_entry {
+	struct outq_entry *next;
+	size_t len;
+	size_t off;
+	char data[];
+} OUTQ_ENTRY;
+
+/*
+ * While "corked" is set, packets are only queued, to be sent together by
+ * outq_uncork().  "armed" is set while the writer thread is waiting for
+ * the socket to become writable; the writer holds a reference to the
+ * queue for as long as it is set.  "dead" means that no more output is accepted, either
+ * because the connection failed or because the owner has closed it
+ * ("closed").  Once closed, the file descriptor is closed by whichever
+ * of outq_close() and the writer thread is the last to refer to it.
+ */
+typedef struct out_queue {
+	int fd;
+	OUTQ_ENTRY *head;
+	OUTQ_ENTRY *tail;
+	size_t bytes;
+	int corked;
+	int armed;
+	int registered;
+	int dead;
+	int closed;
+	int reference_count;
+	pthread_mutex_t mutex;
+} OUT_QUEUE;
+
+static int writer_epfd = -1;
+static pthread_t writer_tid;
+
+static void *outq_writer(void *arg);
+
+/*
+ * Start the writer thread.  This must be called once, before any queue
+ * is created.
+ *
+ * @return 0 if the writer was started, otherwise -1.
+ */
+int outq_init(void) {
+	if((writer_epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+		error("epoll_create1: %s", strerror(errno));
+		return -1;
+	}
+	if(pthread_create(&writer_tid, NULL, outq_writer, NULL)) {
+		error("pthread_create failed");
+		close(writer_epfd);
+		writer_epfd = -1;
+		return -1;
+	}
+	debug("%ld: Started writer thread", pthread_self());
+	return 0;
+}
+
+/*
+ * Create an outbound queue for a connection.  From now on the queue owns
+ * the file descriptor, which is closed by outq_close().
+ *
+ * @param fd  The file descriptor of the connection.
+ * @return  The new OUT_QUEUE, or NULL if it could not be allocated.
+ */
+OUT_QUEUE *outq_create(int fd) {
+	OUT_QUEUE *q;
+	if(!(q = malloc(sizeof(OUT_QUEUE)))) {
+		error("malloc failed");
+		return NULL;
+	}
+	*q = (OUT_QUEUE) {
+		.fd = fd,
+		.reference_count = 1
+	};
+	if(pthread_mutex_init(&q->mutex, NULL) < 0) {
+		error("Mutex initialization failed");
+		free(q);
+		return NULL;
+	}
+	return q;
+}
+
+static void outq_unref(OUT_QUEUE *q) {
+	pthread_mutex_lock(&q->mutex);
+	int last = --q->reference_count == 0;
+	pthread_mutex_unlock(&q->mutex);
+	if(last) {
+		pthread_mutex_destroy(&q->mutex);
+		free(q);
+	}
+}
+
+/*
+ * Throw away everything that is queued.
+ */
+static void outq_discard(OUT_QUEUE *q) {
+	OUTQ_ENTRY *e;
+	while((e = q->head)) {
+		q->head = e->next;
+		free(e);
+	}
+	q->tail = NULL;
+	q->bytes = 0;
+}
+
+/*
+ * Give up on a connection that has failed or fallen too far behind.
+ * Shutting the socket down makes the service thread see EOF, so that it
+ * cleans up the client as for any other disconnection.
+ */
+static void outq_fail(OUT_QUEUE *q) {
+	if(q->dead)
+		return;
+	q->dead = 1;
+	outq_discard(q);
+	shutdown(q->fd, SHUT_RDWR);
+}
+
+/*
+ * Ask the writer thread to drain the queue once the socket is writable.
+ */
+static int outq_arm(OUT_QUEUE *q) {
+	if(q->armed)
+		return 0;
+	struct epoll_event ev = {
+		.events = EPOLLOUT | EPOLLONESHOT,
+		.data.ptr = q
+	};
+	if(epoll_ctl(writer_epfd, q->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, q->fd, &ev) < 0) {
+		error("epoll_ctl: %s", strerror(errno));
+		return -1;
+	}
+	q->registered = 1;
+	q->armed = 1;
+	q->reference_count++;
+	return 0;
+}
+
+/*
+ * Send as much of the queue as the socket will take without blocking.
+ *
+ * @return 0 if the queue was emptied or the socket is full, -1 if the
+ * connection has failed.
+ */
+static int outq_flush(OUT_QUEUE *q) {
+	while(q->head) {
+		struct iovec iov[OUTQ_MAX_IOV];
+		int iovcnt = 0;
+		for(OUTQ_ENTRY *e = q->head; e && iovcnt < OUTQ_MAX_IOV; e = e->next)
+			iov[iovcnt++] = (struct iovec){ e->data + e->off, e->len - e->off };
+		ssize_t res = transport_trysendv(q->fd, iov, iovcnt);
+		if(res < 0) {
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			debug("%ld: [%d] Error writing to socket: %s", pthread_self(), q->fd, strerror(errno));
+			return -1;
+		}
+		q->bytes -= res;
+		while(res > 0) {
+			OUTQ_ENTRY *e = q->head;
+			size_t left = e->len - e->off;
+			if(res < left) {
+				e->off += res;
+				break;
+			}
+			res -= left;
+			if(!(q->head = e->next))
+				q->tail = NULL;
+			free(e);
+		}
+	}
+	return 0;
+}
+
+/*
+ * Copy a packet onto the end of the queue, leaving out the first "skip"
+ * bytes, which have already been sent.
+ */
+static int outq_append(OUT_QUEUE *q, JEUX_PACKET_HEADER *hdr, void *data, size_t size, size_t skip) {
+	size_t len = sizeof(JEUX_PACKET_HEADER) + size - skip;
+	OUTQ_ENTRY *e;
+	if(!(e = malloc(sizeof(OUTQ_ENTRY) + len))) {
+		error("malloc failed");
+		return -1;
+	}
+	*e = (OUTQ_ENTRY) {
+		.len = len
+	};
+	if(skip < sizeof(JEUX_PACKET_HEADER)) {
+		memcpy(e->data, (char *)hdr + skip, sizeof(JEUX_PACKET_HEADER) - skip);
+		if(size)
+			memcpy(e->data + sizeof(JEUX_PACKET_HEADER) - skip, data, size);
+	} else {
+		memcpy(e->data, (char *)data + skip - sizeof(JEUX_PACKET_HEADER), len);
+	}
+	if(q->tail)
+		q->tail->next = e;
+	else
+		q->head = e;
+	q->tail = e;
+	q->bytes += len;
+	return 0;
+}
+
+/*
+ * Queue a batch of packets for sending, as a unit.  Either all of them are
+ * accepted or none is.
+ *
+ * @param q  The OUT_QUEUE.
+ * @param hdrs  The packet headers, in network byte order.
+ * @param data  The corresponding payloads, any of which may be NULL.
+ * @param n  The number of packets.
+ * @return 0 if the packets were sent or queued, -1 if the connection has
+ * failed, has been closed, or has just been shut down for exceeding
+ * OUTQ_HIGH_WATER.
+ */
+int outq_send(OUT_QUEUE *q, JEUX_PACKET_HEADER **hdrs, void **data, int n) {
+	size_t total = 0;
+	for(int i = 0; i < n; i++)
+		total += sizeof(JEUX_PACKET_HEADER) + (data[i] ? ntohs(hdrs[i]->size) : 0);
+
+	pthread_mutex_lock(&q->mutex);
+	if(q->dead) {
+		pthread_mutex_unlock(&q->mutex);
+		errno = EPIPE;
+		return -1;
+	}
+	if(q->bytes + total > OUTQ_HIGH_WATER) {
+		error("[%d] Client is not reading (%zu bytes queued), disconnecting", q->fd, q->bytes);
+		outq_fail(q);
+		pthread_mutex_unlock(&q->mutex);
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	// If nothing is waiting, try to send straight from the caller's
+	// buffers, so that only what the socket will not take gets copied.
+	size_t queued = q->bytes;
+	size_t sent = 0;
+	if(!q->head && !q->corked && 2 * n <= OUTQ_MAX_IOV) {
+		struct iovec iov[OUTQ_MAX_IOV];
+		int iovcnt = 0;
+		for(int i = 0; i < n; i++) {
+			iov[iovcnt++] = (struct iovec){ hdrs[i], sizeof(JEUX_PACKET_HEADER) };
+			if(data[i] && hdrs[i]->size)
+				iov[iovcnt++] = (struct iovec){ data[i], ntohs(hdrs[i]->size) };
+		}
+		ssize_t res = transport_trysendv(q->fd, iov, iovcnt);
+		if(res >= 0) {
+			sent = res;
+		} else if(errno != EAGAIN && errno != EWOULDBLOCK) {
+			outq_fail(q);
+			pthread_mutex_unlock(&q->mutex);
+			return -1;
+		}
+		if(sent == total) {
+			pthread_mutex_unlock(&q->mutex);
+			return 0;
+		}
+	}
+
+	for(int i = 0; i < n; i++) {
+		size_t size = data[i] ? ntohs(hdrs[i]->size) : 0;
+		if(sent >= sizeof(JEUX_PACKET_HEADER) + size) {
+			sent -= sizeof(JEUX_PACKET_HEADER) + size;
+			continue;
+		}
+		if(outq_append(q, hdrs[i], data[i], size, sent) < 0) {
+			// Part of the batch may already be on the wire, so the
+			// stream cannot be resumed.
+			outq_fail(q);
+			pthread_mutex_unlock(&q->mutex);
+			return -1;
+		}
+		sent = 0;
+	}
+
+	// A corked queue is only held back until there is enough in it to
+	// be worth a write of its own, so that a pipelined run of large
+	// replies does not pile up towards OUTQ_HIGH_WATER before uncorking.
+	if(q->corked && q->bytes < OUTQ_LOW_WATER) {
+		pthread_mutex_unlock(&q->mutex);
+		return 0;
+	}
+	int flush = q->corked ? !q->armed : queued && queued < OUTQ_LOW_WATER;
+	if(flush && outq_flush(q) < 0) {
+		outq_fail(q);
+		pthread_mutex_unlock(&q->mutex);
+		return -1;
+	}
+	if(q->head && outq_arm(q) < 0) {
+		outq_fail(q);
+		pthread_mutex_unlock(&q->mutex);
+		return -1;
+	}
+	pthread_mutex_unlock(&q->mutex);
+	return 0;
+}
+
+/*
+ * Hold back packets sent to a queue, so that a run of them can later go
+ * out together in one gather write.  Once OUTQ_LOW_WATER bytes are held
+ * back they are sent anyway, so a corked queue, like any other, only
+ * reaches OUTQ_HIGH_WATER if the peer is not reading.
+ *
+ * @param q  The OUT_QUEUE.
+ */
+void outq_cork(OUT_QUEUE *q) {
+	pthread_mutex_lock(&q->mutex);
+	q->corked = 1;
+	pthread_mutex_unlock(&q->mutex);
+}
+
+/*
+ * Stop holding back packets, and send everything that has been queued.
+ *
+ * @param q  The OUT_QUEUE.
+ * @return 0 if the packets were sent or left for the writer thread,
+ * -1 if the connection has failed.
+ */
+int outq_uncork(OUT_QUEUE *q) {
+	int ret = 0;
+	pthread_mutex_lock(&q->mutex);
+	q->corked = 0;
+	if(!q->dead && !q->armed && q->head) {
+		if(outq_flush(q) < 0 || (q->head && outq_arm(q) < 0)) {
+			outq_fail(q);
+			ret = -1;
+		}
+	}
+	pthread_mutex_unlock(&q->mutex);
+	return ret;
+}
+
+/*
+ * Close the connection.  Anything still queued is discarded, and no more
+ * packets are accepted.  The file descriptor is closed as soon as the
+ * writer thread no longer refers to it.
+ *
+ * @param q  The OUT_QUEUE.
+ */
+void outq_close(OUT_QUEUE *q) {
+	pthread_mutex_lock(&q->mutex);
+	if(q->closed) {
+		pthread_mutex_unlock(&q->mutex);
+		return;
+	}
+	q->closed = 1;
+	q->dead = 1;
+	outq_discard(q);
+	if(q->armed) {
+		// The writer has (or will get) an event for this descriptor.
+		// A shut-down socket always polls as writable, so it will
+		// wake up promptly and do the close itself.
+		shutdown(q->fd, SHUT_RDWR);
+	} else {
+		close(q->fd);
+		q->fd = -1;
+	}
+	pthread_mutex_unlock(&q->mutex);
+}
+
+/*
+ * Discard the caller's reference to a queue, closing it first if that has
+ * not already been done.  The queue is freed once the writer thread has
+ * also let go of it.
+ *
+ * @param q  The OUT_QUEUE.
+ */
+void outq_destroy(OUT_QUEUE *q) {
+	outq_close(q);
+	outq_unref(q);
+}
+
+static void *outq_writer(void *arg) {
+	struct epoll_event events[OUTQ_MAX_EVENTS];
+
+	while(1) {
+		int n = epoll_wait(writer_epfd, events, OUTQ_MAX_EVENTS, -1);
+		if(n < 0) {
+			if(errno == EINTR)
+				continue;
+			error("epoll_wait: %s", strerror(errno));
+			return NULL;
+		}
+		for(int i = 0; i < n; i++) {
+			OUT_QUEUE *q = events[i].data.ptr;
+			pthread_mutex_lock(&q->mutex);
+			q->armed = 0;
+			if(q->closed) {
+				close(q->fd);
+				q->fd = -1;
+			} else if(!q->dead) {
+				if(outq_flush(q) < 0 || (q->head && outq_arm(q) < 0))
+					outq_fail(q);
+			}
+			pthread_mutex_unlock(&q->mutex);
+			outq_unref(q);
+		}
+	}
+	return NULL;
+}
@@ -1,4 +1,8 @@
 #include "player.h"
+#include "player_ext.h"
+#include "leaderboard.h"
+#include "refcount.h"
+#include "slab.h"
 #include "debug.h"
 #include <stdlib.h>
 #include <pthread.h>
@@ -8,8 +12,9 @@
 typedef struct player {
 	char *username;
 	int rating;
-	int reference_count;
+	REFCOUNT reference_count;
 	pthread_mutex_t mutex;
+	LB_NODE leaderboard;
 } PLAYER;
 
 /*
@@ -30,24 +35,21 @@ PLAYER *player_create(char *name) {
 	// debug("name[strlen(name)] = [%c]", name[strlen(name) - 1]);
 	// debug("name[strlen(name)] = [%d]", name[strlen(name)]);
 
-	if(!(player = malloc(sizeof(PLAYER))))
+	if(!(player = slab_alloc(SLAB_PLAYER, sizeof(PLAYER))))
 		return NULL;
 
 	*player = (PLAYER) {
 		// .username = name,
 		.rating = PLAYER_INITIAL_RATING,
 		.reference_count = 0,
+		// A default mutex needs no pthread_mutex_init() or destroying.
+		.mutex = PTHREAD_MUTEX_INITIALIZER
 	};
 
 	// Allocate memory for the name parameter and copy the string
     player->username = strdup(name);
 
-	if (pthread_mutex_init(&player->mutex, NULL) < 0) {
-		error("Mutex initialization failed");
-		free(player);
-		return NULL;
-	}
-
+	lb_insert(&player->leaderboard, player, player->rating);
 	player_ref(player, "for newly created player");
 
 	return player;
@@ -63,16 +65,13 @@ PLAYER *player_create(char *name) {
  * @return  The same PLAYER object that was passed as a parameter.
  */
 PLAYER *player_ref(PLAYER *player, char *why) {
-	pthread_mutex_lock(&player->mutex);
-	if(!player) {
-		error("player_ref: NULL player");
-		pthread_mutex_unlock(&player->mutex); 
-		return NULL;
-	}
-	player->reference_count++;
+#ifdef DEBUG
+	int count = refcount_inc(&player->reference_count);
 	debug("%ld: Increase reference count on player [%s] (%d -> %d) %s",
-		pthread_self(), player->username, player->reference_count - 1, player->reference_count, why);
-	pthread_mutex_unlock(&player->mutex);
+		pthread_self(), player->username, count - 1, count, why);
+#else
+	refcount_inc(&player->reference_count);
+#endif
 	return player;
 }
 
@@ -88,23 +87,15 @@ PLAYER *player_ref(PLAYER *player, char *why) {
  *
  */
 void player_unref(PLAYER *player, char *why) {
-	pthread_mutex_lock(&player->mutex);
-	if(!player) {
-		error("player_unref: NULL player");
-		pthread_mutex_unlock(&player->mutex);
-		return;
-	}
-	player->reference_count--;
+	int count = refcount_dec(&player->reference_count);
 	debug("%ld: Decrease reference count on player [%s] (%d -> %d) %s",
-		pthread_self(), player->username, player->reference_count + 1, player->reference_count, why);
-	if(player->reference_count == 0) {
+		pthread_self(), player->username, count + 1, count, why);
+	if(count == 0) {
+		lb_remove(&player->leaderboard);
 		free(player->username);
-		pthread_mutex_unlock(&player->mutex);
-		pthread_mutex_destroy(&player->mutex);
 		debug("Free player %p", player);
-		free(player);
+		slab_free(SLAB_PLAYER, player);
 	}
-	pthread_mutex_unlock(&player->mutex);
 }
 
 /*
@@ -131,6 +122,16 @@ int player_get_rating(PLAYER *player){
 	return player->rating;
 }
 
+/*
+ * Get the rank of a player among all players, by rating.
+ *
+ * @param player  The PLAYER that is to be queried.
+ * @return  One more than the number of players rated above it.
+ */
+int player_get_rank(PLAYER *player) {
+	return lb_rank(&player->leaderboard);
+}
+
 /*
  * Post the result of a game between two players.
  * To update ratings, we use a system of a type devised by Arpad Elo,
@@ -182,6 +183,10 @@ void player_post_result(PLAYER *player1, PLAYER *player2, int result){
     //update ratings
     player1->rating += (int)(32*(S1-E1));
     player2->rating += (int)(32*(S2-E2));
+	// Still under the players' locks, so that the leaderboard sees each
+	// player's results in the order they were applied.
+	lb_update(&player1->leaderboard, player1->rating);
+	lb_update(&player2->leaderboard, player2->rating);
 	pthread_mutex_unlock(&player1->mutex);
 	pthread_mutex_unlock(&player2->mutex);
     // debug("R1' = %d, R2' = %d", player1->rating, player2->rating);
@@ -1,5 +1,7 @@
 #include "player_registry.h"
+#include "strmap.h"
 #include "debug.h"
+#include <stdint.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <string.h>
@@ -9,20 +11,102 @@
  * Entries persist for as long as the server is running.
  */
 
+/*
+ * Initial size of the hash table, and the number of slots of the old
+ * table that are moved into the new one by each registration while the
+ * table is being resized.
+ */
+#define PREG_INITIAL_SIZE 64
+#define PREG_MIGRATE_STEP 8
+
+/*
+ * A slot in the hash table.  The key is the username stored in the
+ * PLAYER itself, which is the one copy of the name kept by the server,
+ * and the hash of the name is kept alongside it so that neither probing
+ * nor resizing has to recompute it.
+ */
+typedef struct preg_entry {
+	PLAYER *player;
+	uint32_t hash;
+} PREG_ENTRY;
+
 /*
  * The PLAYER_REGISTRY type is a structure type that defines the state
  * of a player registry.  You will have to give a complete structure
  * definition in player_registry.c. The precise contents are up to
  * you.  Be sure that all the operations that might be called
  * concurrently are thread-safe.
+ *
+ * Players are kept in a hash table with open addressing and linear
+ * probing, whose size is a power of two and which is kept at most 3/4
+ * full.  Players are never removed.  When the table fills, a table of
+ * twice the size is allocated and the entries of the old one are moved
+ * across a few at a time by subsequent registrations, so that no single
+ * login pays for rehashing every player.  Until that is finished,
+ * lookups that miss in the new table also probe the old one.  The old
+ * table is always finished with before the new one fills up.
  */
 typedef struct player_registry {
 	int player_count;
-	int max_players;
-	PLAYER **players;
+	PREG_ENTRY *table;
+	uint32_t mask;
+	PREG_ENTRY *old_table;
+	uint32_t old_mask;
+	uint32_t migrated;
 	pthread_mutex_t mutex;
 } PLAYER_REGISTRY;
 
+/*
+ * Find the slot of a table holding a player with a given name, or the
+ * empty slot at which the search for it ended.
+ */
+static PREG_ENTRY *preg_probe(PREG_ENTRY *table, uint32_t mask, char *name, uint32_t hash) {
+	uint32_t i = hash & mask;
+	while(table[i].player) {
+		if(table[i].hash == hash && !strcmp(player_get_name(table[i].player), name))
+			break;
+		i = (i + 1) & mask;
+	}
+	return &table[i];
+}
+
+/*
+ * Move the next few entries of the old table, if there is one, into the
+ * current table.
+ */
+static void preg_migrate(PLAYER_REGISTRY *preg, uint32_t n) {
+	while(preg->old_table && n--) {
+		PREG_ENTRY *e = &preg->old_table[preg->migrated];
+		if(e->player)
+			*preg_probe(preg->table, preg->mask, player_get_name(e->player), e->hash) = *e;
+		if(preg->migrated++ == preg->old_mask) {
+			free(preg->old_table);
+			preg->old_table = NULL;
+		}
+	}
+}
+
+/*
+ * Start moving to a table of twice the size.
+ */
+static int preg_grow(PLAYER_REGISTRY *preg) {
+	// Only one old table at a time.
+	preg_migrate(preg, UINT32_MAX);
+	uint32_t size = (preg->mask + 1) * 2;
+	PREG_ENTRY *table;
+	if(!(table = calloc(size, sizeof(PREG_ENTRY)))) {
+		error("calloc failed");
+		return -1;
+	}
+	preg->old_table = preg->table;
+	preg->old_mask = preg->mask;
+	preg->migrated = 0;
+	preg->table = table;
+	preg->mask = size - 1;
+	debug("%ld: Grow player registry to %u slots", pthread_self(), size);
+	return 0;
+}
+
 /*
  * Initialize a new player registry.
  *
@@ -38,11 +122,12 @@ PLAYER_REGISTRY *preg_init(void) {
 
 	*preg = (PLAYER_REGISTRY) {
 		.player_count = 0,
-		.max_players = 0
-		// .players = calloc(preg->max_players + 1, sizeof(PLAYER *))
+		.table = calloc(PREG_INITIAL_SIZE, sizeof(PREG_ENTRY)),
+		.mask = PREG_INITIAL_SIZE - 1,
+		.old_table = NULL
 	};
 
-	if(!(preg->players = calloc(preg->max_players + 1, sizeof(PLAYER *)))) {
+	if(!preg->table) {
 		error("calloc failed");
 		free(preg);
 		return NULL;
@@ -50,7 +135,7 @@ PLAYER_REGISTRY *preg_init(void) {
 
 	if(pthread_mutex_init(&preg->mutex, NULL)) {
 		error("pthread_mutex_init failed");
-		free(preg->players);
+		free(preg->table);
 		free(preg);
 		return NULL;
 	}
@@ -66,13 +151,12 @@ PLAYER_REGISTRY *preg_init(void) {
  * be referenced again.
  */
 void preg_fini(PLAYER_REGISTRY *preg) {
-	for(int i = 0; i < preg->max_players; i++) {
-		if(preg->players[i]) {
-			player_unref(preg->players[i], "for closing player registry");
-			preg->players[i] = NULL;
-		}
+	preg_migrate(preg, UINT32_MAX);
+	for(uint32_t i = 0; i <= preg->mask; i++) {
+		if(preg->table[i].player)
+			player_unref(preg->table[i].player, "for closing player registry");
 	}
-	free(preg->players);
+	free(preg->table);
 	pthread_mutex_destroy(&preg->mutex);
 	free(preg);
 	debug("%ld: Finalize player registry", pthread_self());
@@ -93,61 +177,45 @@ void preg_fini(PLAYER_REGISTRY *preg) {
  *
  */
 PLAYER *preg_register(PLAYER_REGISTRY *preg, char *name) {
+	uint32_t hash = strmap_hash(name);
 	pthread_mutex_lock(&preg->mutex);
 	debug("%ld: Register player %s", pthread_self(), name);
-	int name_exists = 0;
-	PLAYER *player;
-	for(int i = 0; i < preg->max_players; i++) {
-		if(preg->players[i]) {
-			// debug("pname: %s", player_get_name(preg->players[i]));
-			// debug("name: %s", name);
-			if(!strcmp(player_get_name(preg->players[i]), name)) {
-				name_exists = 1;
-				player = preg->players[i];
-				break;
-			}
-		}
-		if(i == preg->player_count - 1) {
-			break;
-		}
-	}
+	preg_migrate(preg, PREG_MIGRATE_STEP);
 
-	if(name_exists) {
+	PREG_ENTRY *e = preg_probe(preg->table, preg->mask, name, hash);
+	if(!e->player && preg->old_table) {
+		PREG_ENTRY *old = preg_probe(preg->old_table, preg->old_mask, name, hash);
+		if(old->player)
+			e = old;
+	}
+	PLAYER *player;
+	if((player = e->player)) {
 		debug("%ld: Player exists with that name", pthread_self());
 		player_ref(player, "for new reference to existing player");
-	} else {
-		debug("%ld: Player with that name does not yet exist", pthread_self());
-		if(!(player = player_create(name))) {
-			error("player_create failed");
+		pthread_mutex_unlock(&preg->mutex);
+		return player;
+	}
+
+	debug("%ld: Player with that name does not yet exist", pthread_self());
+	if((preg->player_count + 1) * 4 > (preg->mask + 1) * 3) {
+		if(preg_grow(preg) < 0) {
 			pthread_mutex_unlock(&preg->mutex);
 			return NULL;
 		}
-		if(preg->player_count < preg->max_players) {
-			for(int i = 0; i < preg->max_players; i++) {
-				if(!preg->players[i]) {
-					preg->players[i] = player;
-					break;
-				}
-			}
-		} else {
-			PLAYER **temp;
-			if(!(temp = realloc(preg->players, (preg->max_players + 2) * sizeof(PLAYER *)))) {
-				error("realloc failed");
-				pthread_mutex_unlock(&preg->mutex);
-				return NULL;
-			} else {
-				preg->players = temp;
-				preg->max_players++;
-				preg->players[preg->max_players - 1] = player;
-				preg->players[preg->max_players] = NULL;
-			}
-		}
-		player_ref(player, "for reference being retained by player registry");
+		e = preg_probe(preg->table, preg->mask, name, hash);
 	}
-
+	if(!(player = player_create(name))) {
+		error("player_create failed");
+		pthread_mutex_unlock(&preg->mutex);
+		return NULL;
+	}
+	*e = (PREG_ENTRY) {
+		.player = player_ref(player, "for reference being retained by player registry"),
+		.hash = hash
+	};
 	preg->player_count++;
 
 	pthread_mutex_unlock(&preg->mutex);
 
 	return player;
-}
\ No newline at end of file
+}
@@ -1,4 +1,6 @@
 #include "protocol.h"
+#include "protocol_ext.h"
+#include "transport.h"
 #include "debug.h"
 #include <errno.h>
 #include <stdlib.h>
@@ -39,69 +41,20 @@ int proto_send_packet(int fd, JEUX_PACKET_HEADER *hdr, void *data) {
 	// hdr->timestamp_sec = htonl(hdr->timestamp_sec);
 	// hdr->timestamp_nsec = htonl(hdr->timestamp_nsec);
 
-	//write header
-	ssize_t bytes_written = 0;
-	size_t bytes_to_write = sizeof(JEUX_PACKET_HEADER);
-	char *buffer = (char *)hdr;
-
-
-	while(bytes_written < bytes_to_write) {
-		ssize_t results = write(fd, buffer + bytes_written, bytes_to_write - bytes_written);
-		if(results < 0) {
-			// fprintf(stderr, "Error writing header to socket: %s\n", strerror(errno));
-			error("Error writing header to socket: %s", strerror(errno));
-			return -1;
-			// break;
-		} else {
-			bytes_written += results;
-		}
+	//header and payload go out together, in one gather write
+	struct iovec iov[2] = {
+		{ .iov_base = hdr, .iov_len = sizeof(JEUX_PACKET_HEADER) },
+		{ .iov_base = data, .iov_len = data ? ntohs(hdr->size) : 0 }
+	};
+	if(transport_sendv(fd, iov, iov[1].iov_len ? 2 : 1) < 0) {
+		error("Error writing packet to socket: %s", strerror(errno));
+		return -1;
 	}
-
-	//reset them
-	// debug("hdr->size: %d", hdr->size);
-	// hdr->size = ntohs(hdr->size);
-	// hdr->timestamp_sec = ntohl(hdr->timestamp_sec);
-	// hdr->timestamp_nsec = ntohl(hdr->timestamp_nsec);
-	// debug("hdr->size: %d", hdr->size);
-	// hdr->size = htons(hdr->size);
-	// hdr->size = ntohs(hdr->size);
-	// debug("hdr->size: %d", hdr->size);
-	// hdr->size = htons(hdr->size);
-	// debug("hdr->size: %d", hdr->size);
-	// hdr->timestamp_sec = htonl(hdr->timestamp_sec);
-	// hdr->timestamp_nsec = htonl(hdr->timestamp_nsec);
-
-	// debug("hdr->size: %d", hdr->size);
-	// debug("htons(hdr->size): %d", htons(hdr->size));
-	// debug("ntohs(hdr->size): %d", ntohs(hdr->size));
-	// debug("payload: %s", (char *)data);
-
-	//write payload
 	if(data && ntohs(hdr->size) > 0) {
-		// debug("hi");
-		bytes_written = 0;
-		// bytes_to_write = hdr->size;
-		bytes_to_write = ntohs(hdr->size);
-		buffer = (char *)data;
-		// debug("data: %s", buffer);
-
-		while(bytes_written < bytes_to_write) {
-			ssize_t results = write(fd, buffer + bytes_written, bytes_to_write - bytes_written);
-			// debug("results: %d", results);
-			// debug("bytes_to_write: %d", bytes_to_write);
-			if(results < 0) {
-				// fprintf(stderr, "Error writing data to socket: %s\n", strerror(errno));
-				error("Error writing data to socket: %s\n", strerror(errno));
-				return -1;
-			} else {
-				bytes_written += results;
-			}
-		}
 		debug("payload=[%s]", (char *)data);
 	} else {
 		debug("(no payload)");
 	}
-	buffer = NULL;
 
 	return 0;
 }
@@ -132,7 +85,7 @@ int proto_recv_packet(int fd, JEUX_PACKET_HEADER *hdr, void **payloadp) {
 
 	while(bytes_read < bytes_to_read) {
 		// debug("byeeeeeeeee");
-		size_t results = read(fd, buffer + bytes_read, bytes_to_read - bytes_read);
+		ssize_t results = read(fd, buffer + bytes_read, bytes_to_read - bytes_read);
 		// debug("results from header: %d", results);
 		// debug("buffer: %s", buffer);
 		if(results < 0) {
@@ -0,0 +1,330 @@
+#include "reactor.h"
+#include "server_ext.h"
+#include "client_ext.h"
+#include "recv_buffer.h"
+#include "transport.h"
+#include "stats.h"
+#include "debug.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#define REACTOR_MAX_EVENTS 64
+
+/*
+ * The most connections an io_uring reactor will take on: each has a read
+ * outstanding, as does the reactor's eventfd, and no more reads may be
+ * outstanding than the ring has room to complete.
+ */
+#define REACTOR_RING_MAX_CONNS (TRANSPORT_RING_MAX_READS - 1)
+
+/*
+ * Per-connection state.  A connection is owned by exactly one reactor
+ * thread, so none of this needs to be locked, except "next", which links
+ * connections waiting to be taken up by an io_uring reactor.
+ */
+typedef struct reactor_conn {
+	int fd;
+	CLIENT *client;
+	RECV_BUFFER *rb;
+	struct reactor_conn *next;
+} REACTOR_CONN;
+
+/*
+ * A reactor waits either on an epoll instance or, with the io_uring
+ * transport, on a ring.  A ring can only be added to by its own thread,
+ * so new connections for it are left on the "added" list and the thread
+ * is woken through an eventfd, on which it keeps a read queued
+ * ("listening" says whether it has managed to).  "conns" counts the
+ * connections given to a ring, which may not exceed
+ * REACTOR_RING_MAX_CONNS.
+ */
+typedef struct reactor {
+	int epfd;
+	TRANSPORT_RING *ring;
+	int efd;
+	uint64_t wakeups;
+	int listening;
+	atomic_int conns;
+	pthread_mutex_t mutex;
+	REACTOR_CONN *added;
+	pthread_t tid;
+} REACTOR;
+
+static REACTOR *reactors;
+static int reactor_count;
+static unsigned int next_reactor;
+static pthread_mutex_t reactor_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void *reactor_thread(void *arg);
+static void *reactor_ring_thread(void *arg);
+
+/*
+ * Start the reactor threads.
+ *
+ * @param nthreads  The number of reactor threads to start.
+ * @return 0 if the reactors were started, otherwise -1.
+ */
+int reactor_init(int nthreads) {
+	if(nthreads <= 0) {
+		error("Invalid number of reactor threads: %d", nthreads);
+		return -1;
+	}
+	if(!(reactors = calloc(nthreads, sizeof(REACTOR)))) {
+		error("calloc failed");
+		return -1;
+	}
+	for(int i = 0; i < nthreads; i++) {
+		REACTOR *reactor = &reactors[i];
+		pthread_mutex_init(&reactor->mutex, NULL);
+		if(proto_transport == TRANSPORT_URING) {
+			if(!(reactor->ring = transport_ring_create()))
+				return -1;
+			if((reactor->efd = eventfd(0, EFD_CLOEXEC)) < 0) {
+				error("eventfd: %s", strerror(errno));
+				transport_ring_destroy(reactor->ring);
+				return -1;
+			}
+		} else if((reactor->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+			error("epoll_create1: %s", strerror(errno));
+			return -1;
+		}
+		if(pthread_create(&reactor->tid, NULL,
+				  reactor->ring ? reactor_ring_thread : reactor_thread, reactor)) {
+			error("pthread_create failed");
+			if(reactor->ring) {
+				transport_ring_destroy(reactor->ring);
+				close(reactor->efd);
+			} else {
+				close(reactor->epfd);
+			}
+			return -1;
+		}
+		reactor_count++;
+	}
+	debug("%ld: Started %d reactor thread(s)", pthread_self(), reactor_count);
+	return 0;
+}
+
+/*
+ * Choose the reactor to be given a new connection, in turn.  An io_uring
+ * reactor that already has as many connections as it can take is passed
+ * over.
+ *
+ * @return  The reactor, or NULL if every reactor is full.
+ */
+static REACTOR *reactor_choose(void) {
+	pthread_mutex_lock(&reactor_mutex);
+	unsigned int first = next_reactor++;
+	pthread_mutex_unlock(&reactor_mutex);
+	for(int i = 0; i < reactor_count; i++) {
+		REACTOR *reactor = &reactors[(first + i) % reactor_count];
+		if(!reactor->ring)
+			return reactor;
+		if(atomic_fetch_add(&reactor->conns, 1) < REACTOR_RING_MAX_CONNS)
+			return reactor;
+		atomic_fetch_sub(&reactor->conns, 1);
+	}
+	return NULL;
+}
+
+/*
+ * Give back a connection's place on the reactor that was chosen for it.
+ */
+static void reactor_release(REACTOR *reactor) {
+	if(reactor->ring)
+		atomic_fetch_sub(&reactor->conns, 1);
+}
+
+/*
+ * Hand a newly accepted connection over to one of the reactor threads,
+ * which will register it with the client registry and service it from
+ * then on.
+ *
+ * @param fd  The file descriptor of the connection.
+ * @return 0 if the connection was accepted by a reactor, otherwise -1,
+ * in which case the file descriptor has been closed.
+ */
+int reactor_add(int fd) {
+	REACTOR *reactor;
+	if(!(reactor = reactor_choose())) {
+		stats_add(STAT_CONNECTIONS_REFUSED, 1);
+		debug("%ld: [%d] Reactors full, connection refused", pthread_self(), fd);
+		close(fd);
+		return -1;
+	}
+	REACTOR_CONN *conn;
+	if(!(conn = calloc(1, sizeof(REACTOR_CONN)))) {
+		error("calloc failed");
+		reactor_release(reactor);
+		close(fd);
+		return -1;
+	}
+	conn->fd = fd;
+	if(!(conn->rb = rbuf_create(fd))) {
+		free(conn);
+		reactor_release(reactor);
+		close(fd);
+		return -1;
+	}
+	if(!(conn->client = jeux_client_open(fd))) {
+		rbuf_destroy(conn->rb);
+		free(conn);
+		reactor_release(reactor);
+		return -1;
+	}
+
+	if(reactor->ring) {
+		uint64_t one = 1;
+		pthread_mutex_lock(&reactor->mutex);
+		conn->next = reactor->added;
+		reactor->added = conn;
+		pthread_mutex_unlock(&reactor->mutex);
+		if(write(reactor->efd, &one, sizeof(one)) < 0)
+			error("write to eventfd: %s", strerror(errno));
+		debug("%ld: [%d] Connection handed to reactor %p", pthread_self(), fd, reactor);
+		return 0;
+	}
+
+	struct epoll_event ev = {
+		.events = EPOLLIN | EPOLLRDHUP,
+		.data.ptr = conn
+	};
+	if(epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		error("epoll_ctl: %s", strerror(errno));
+		jeux_client_close(conn->client);
+		rbuf_destroy(conn->rb);
+		free(conn);
+		return -1;
+	}
+	debug("%ld: [%d] Connection handed to reactor %p", pthread_self(), fd, reactor);
+	return 0;
+}
+
+static void *reactor_thread(void *arg) {
+	REACTOR *reactor = arg;
+	struct epoll_event events[REACTOR_MAX_EVENTS];
+
+	while(1) {
+		int n = epoll_wait(reactor->epfd, events, REACTOR_MAX_EVENTS, -1);
+		if(n < 0) {
+			if(errno == EINTR)
+				continue;
+			error("epoll_wait: %s", strerror(errno));
+			return NULL;
+		}
+		for(int i = 0; i < n; i++) {
+			REACTOR_CONN *conn = events[i].data.ptr;
+			if(jeux_serve_ready(conn->client, conn->rb) < 0) {
+				epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+				jeux_client_close(conn->client);
+				rbuf_destroy(conn->rb);
+				free(conn);
+			}
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Queue an io_uring read for whatever a connection sends next, into the
+ * free space of its receive buffer.
+ *
+ * @return 0 if the read was queued, otherwise -1.
+ */
+static int reactor_ring_arm(REACTOR *reactor, REACTOR_CONN *conn) {
+	char *space;
+	size_t len;
+	if(!(space = rbuf_space(conn->rb, &len)) ||
+	   transport_ring_read(reactor->ring, conn->fd, space, len, conn) < 0) {
+		error("Failed to queue read: %s", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static void reactor_ring_close(REACTOR *reactor, REACTOR_CONN *conn) {
+	jeux_client_close(conn->client);
+	rbuf_destroy(conn->rb);
+	free(conn);
+	reactor_release(reactor);
+}
+
+/*
+ * Queue a read on the eventfd through which the reactor is told about
+ * new connections, if one is not queued already.  A read that cannot be
+ * queued now is tried again before the next wait.
+ */
+static void reactor_ring_listen(REACTOR *reactor) {
+	if(reactor->listening)
+		return;
+	if(transport_ring_read(reactor->ring, reactor->efd, &reactor->wakeups,
+			       sizeof(reactor->wakeups), NULL) < 0) {
+		error("Failed to queue read on eventfd: %s", strerror(errno));
+		return;
+	}
+	reactor->listening = 1;
+}
+
+/*
+ * The io_uring counterpart of reactor_thread().  Every connection has
+ * one read outstanding at all times.  Each completion is one receive's
+ * worth of data, which is dispatched before the connection's next read
+ * is queued; the reads queued while handling a batch of completions are
+ * all submitted by the wait for the next batch.
+ */
+static void *reactor_ring_thread(void *arg) {
+	REACTOR *reactor = arg;
+	TRANSPORT_EVENT events[REACTOR_MAX_EVENTS];
+
+	while(1) {
+		reactor_ring_listen(reactor);
+		int n = transport_ring_wait(reactor->ring, events, REACTOR_MAX_EVENTS);
+		if(n < 0) {
+			// Returning strands every connection on the ring, so only
+			// an error that will not go away is allowed to do it.
+			if(errno == EINTR || errno == EBUSY || errno == EAGAIN)
+				continue;
+			error("io_uring_enter: %s", strerror(errno));
+			return NULL;
+		}
+		for(int i = 0; i < n; i++) {
+			REACTOR_CONN *conn = events[i].tag;
+			if(!conn) {
+				// Take up the connections added since the last wakeup.
+				reactor->listening = 0;
+				pthread_mutex_lock(&reactor->mutex);
+				REACTOR_CONN *added = reactor->added;
+				reactor->added = NULL;
+				pthread_mutex_unlock(&reactor->mutex);
+				while((conn = added)) {
+					added = conn->next;
+					if(reactor_ring_arm(reactor, conn) < 0)
+						reactor_ring_close(reactor, conn);
+				}
+				reactor_ring_listen(reactor);
+				continue;
+			}
+			if(events[i].res <= 0) {
+				if(events[i].res < 0)
+					error("Error reading from socket: %s", strerror(-events[i].res));
+				else
+					debug("%ld: EOF on fd: %d", pthread_self(), conn->fd);
+				reactor_ring_close(reactor, conn);
+				continue;
+			}
+			rbuf_commit(conn->rb, events[i].res);
+			if(jeux_dispatch_buffered(conn->client, conn->rb) < 0 ||
+			   reactor_ring_arm(reactor, conn) < 0)
+				reactor_ring_close(reactor, conn);
+		}
+	}
+	return NULL;
+}
@@ -0,0 +1,231 @@
+#include "recv_buffer.h"
+#include "transport.h"
+#include "stats.h"
+#include "debug.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+/*
+ * Initial buffer size.  The buffer grows (once) if a packet larger than
+ * this arrives, up to the size of the largest possible packet.
+ */
+#define RBUF_INITIAL_SIZE 4096
+#define RBUF_MAX_PACKET (sizeof(JEUX_PACKET_HEADER) + UINT16_MAX)
+
+/*
+ * Unconsumed data lives in buf[head..tail).  To be able to null-terminate
+ * a payload slice in place, the byte just past the payload is saved in
+ * "saved" and restored before the buffer is next examined.
+ */
+typedef struct recv_buffer {
+	int fd;
+	char *buf;
+	size_t size;
+	size_t head;
+	size_t tail;
+	char *saved_at;
+	char saved;
+} RECV_BUFFER;
+
+/*
+ * Create a receive buffer for a connection.
+ *
+ * @param fd  The file descriptor of the connection.
+ * @return  The new RECV_BUFFER, or NULL if it could not be allocated.
+ */
+RECV_BUFFER *rbuf_create(int fd) {
+	RECV_BUFFER *rb;
+	if(!(rb = malloc(sizeof(RECV_BUFFER)))) {
+		error("malloc failed");
+		return NULL;
+	}
+	*rb = (RECV_BUFFER) {
+		.fd = fd,
+		.buf = malloc(RBUF_INITIAL_SIZE + 1),
+		.size = RBUF_INITIAL_SIZE
+	};
+	if(!rb->buf) {
+		error("malloc failed");
+		free(rb);
+		return NULL;
+	}
+	stats_add(STAT_RECV_ALLOCS, 2);
+	return rb;
+}
+
+/*
+ * Free a receive buffer.  Any slice previously handed out is invalidated.
+ *
+ * @param rb  The RECV_BUFFER to be freed.
+ */
+void rbuf_destroy(RECV_BUFFER *rb) {
+	free(rb->buf);
+	free(rb);
+}
+
+/*
+ * Undo the null termination of the previously returned slice.
+ */
+static void rbuf_restore(RECV_BUFFER *rb) {
+	if(rb->saved_at) {
+		*rb->saved_at = rb->saved;
+		rb->saved_at = NULL;
+	}
+}
+
+/*
+ * Make room at the end of the buffer for more data to be received,
+ * without receiving anything.  This and rbuf_commit() are for a caller
+ * that receives into the buffer itself, e.g. asynchronously; nothing
+ * else may be done with the buffer in between.
+ *
+ * @param rb  The RECV_BUFFER.
+ * @param lenp  Set to the number of bytes that may be received.
+ * @return  Where the data is to be received, or NULL with errno set if
+ * the buffer could not be grown.
+ */
+char *rbuf_space(RECV_BUFFER *rb, size_t *lenp) {
+	rbuf_restore(rb);
+
+	// Slide any partial packet down to make room at the end.
+	if(rb->head == rb->tail) {
+		rb->head = rb->tail = 0;
+	} else if(rb->head > 0 && rb->tail == rb->size) {
+		memmove(rb->buf, rb->buf + rb->head, rb->tail - rb->head);
+		rb->tail -= rb->head;
+		rb->head = 0;
+	}
+
+	// A packet bigger than the whole buffer needs a bigger buffer.
+	if(rb->tail == rb->size && rb->size < RBUF_MAX_PACKET) {
+		char *bigger;
+		if(!(bigger = realloc(rb->buf, RBUF_MAX_PACKET + 1))) {
+			error("realloc failed");
+			errno = ENOMEM;
+			return NULL;
+		}
+		rb->buf = bigger;
+		rb->size = RBUF_MAX_PACKET;
+		stats_add(STAT_RECV_ALLOCS, 1);
+	}
+	*lenp = rb->size - rb->tail;
+	return rb->buf + rb->tail;
+}
+
+/*
+ * Add data received into the space returned by rbuf_space() to the
+ * buffer.
+ *
+ * @param rb  The RECV_BUFFER.
+ * @param n  The number of bytes received.
+ */
+void rbuf_commit(RECV_BUFFER *rb, size_t n) {
+	rb->tail += n;
+}
+
+/*
+ * Receive whatever data is available on the connection into the buffer,
+ * with a single receive call.
+ *
+ * @param rb  The RECV_BUFFER.
+ * @param flags  Flags to be passed to the receive call, e.g. MSG_DONTWAIT.
+ * @return  The number of bytes received, 0 at EOF, or -1 with errno set.
+ */
+ssize_t rbuf_fill(RECV_BUFFER *rb, int flags) {
+	char *space;
+	size_t len;
+	if(!(space = rbuf_space(rb, &len)))
+		return -1;
+
+	ssize_t n;
+	do {
+		n = transport_recv(rb->fd, space, len, flags);
+	} while(n < 0 && errno == EINTR);
+	if(n > 0)
+		rbuf_commit(rb, n);
+	return n;
+}
+
+/*
+ * Parse the next complete packet out of the buffer, if there is one,
+ * without receiving any more data.
+ *
+ * @param rb  The RECV_BUFFER.
+ * @param hdr  Storage for the packet header, in network byte order.
+ * @param payloadp  Pointer to a variable into which to store a slice
+ * containing the payload, or NULL if the packet has none.
+ * @return 1 if a packet was parsed, 0 if no complete packet is buffered.
+ */
+int rbuf_next_packet(RECV_BUFFER *rb, JEUX_PACKET_HEADER *hdr, void **payloadp) {
+	rbuf_restore(rb);
+
+	size_t avail = rb->tail - rb->head;
+	if(avail < sizeof(JEUX_PACKET_HEADER))
+		return 0;
+	memcpy(hdr, rb->buf + rb->head, sizeof(JEUX_PACKET_HEADER));
+	size_t size = ntohs(hdr->size);
+	if(avail < sizeof(JEUX_PACKET_HEADER) + size)
+		return 0;
+
+	char *payload = rb->buf + rb->head + sizeof(JEUX_PACKET_HEADER);
+	rb->head += sizeof(JEUX_PACKET_HEADER) + size;
+	stats_add(STAT_PACKETS_RECEIVED, 1);
+	if(size > 0) {
+		// The buffer has one spare byte past its end, so this is
+		// always in bounds.
+		rb->saved_at = payload + size;
+		rb->saved = *rb->saved_at;
+		*rb->saved_at = '\0';
+		*payloadp = payload;
+	} else {
+		*payloadp = NULL;
+	}
+	return 1;
+}
+
+/*
+ * Determine whether a complete packet is already buffered, so that the
+ * next rbuf_next_packet() call will succeed without receiving any more
+ * data.  Like rbuf_next_packet(), this invalidates any slice previously
+ * handed out.
+ *
+ * @param rb  The RECV_BUFFER.
+ * @return 1 if a complete packet is buffered, otherwise 0.
+ */
+int rbuf_has_packet(RECV_BUFFER *rb) {
+	rbuf_restore(rb);
+
+	JEUX_PACKET_HEADER hdr;
+	size_t avail = rb->tail - rb->head;
+	if(avail < sizeof(JEUX_PACKET_HEADER))
+		return 0;
+	memcpy(&hdr, rb->buf + rb->head, sizeof(JEUX_PACKET_HEADER));
+	return avail >= sizeof(JEUX_PACKET_HEADER) + ntohs(hdr.size);
+}
+
+/*
+ * Receive a packet, blocking until one is available.  This is the
+ * buffered counterpart of proto_recv_packet().
+ *
+ * @param rb  The RECV_BUFFER.
+ * @param hdr  Storage for the packet header, in network byte order.
+ * @param payloadp  Pointer to a variable into which to store a slice
+ * containing the payload, or NULL if the packet has none.
+ * @return 0 if a packet was received, -1 on EOF or error.
+ */
+int rbuf_recv_packet(RECV_BUFFER *rb, JEUX_PACKET_HEADER *hdr, void **payloadp) {
+	while(!rbuf_next_packet(rb, hdr, payloadp)) {
+		ssize_t n = rbuf_fill(rb, 0);
+		if(n < 0) {
+			error("Error reading from socket: %s", strerror(errno));
+			return -1;
+		} else if(n == 0) {
+			debug("%ld: EOF on fd: %d", pthread_self(), rb->fd);
+			return -1;
+		}
+	}
+	return 0;
+}
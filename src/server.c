@@ -1,9 +1,22 @@
 #include "server.h"
+#include "server_ext.h"
+#include "client_ext.h"
+#include "client_registry_ext.h"
+#include "epoch.h"
+#include "leaderboard.h"
+#include "player_ext.h"
+#include "bot.h"
+#include "protocol_ext.h"
+#include "recv_buffer.h"
 #include "jeux_globals.h"
 #include <stdlib.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <sys/socket.h>
 #include "debug.h"
 
 /*
@@ -13,7 +26,6 @@
 // extern CLIENT_REGISTRY *client_registry;
 // CLIENT_REGISTRY *client_registry;
 
-
 /*
  * Thread function for the thread that handles a particular client.
  *
@@ -40,535 +52,737 @@ void *jeux_client_service(void *arg) {
 
 	pthread_detach(pthread_self());
 
+	jeux_serve_connection(fd);
+	return NULL;
+}
+
+/*
+ * Run the service loop for a connection on the calling thread, returning
+ * once the connection has ended and the client has been cleaned up.
+ *
+ * @param fd  The file descriptor of the connection.
+ */
+void jeux_serve_connection(int fd) {
 	// CLIENT_REGISTRY *cr = client_registry;
 	debug("%ld: [%d] Starting client service", pthread_self(), fd);
 
+	CLIENT *client;
+	if(!(client = jeux_client_open(fd))) {
+		return;
+	}
+
+	// The receive buffer is the connection's only receive-side storage:
+	// headers are copied out onto the stack and payloads are slices of
+	// the buffer, so handling a packet allocates nothing.
+	JEUX_PACKET_HEADER hdr;
+	void *payload = NULL;
+
+	RECV_BUFFER *rb;
+	if(!(rb = rbuf_create(fd))) {
+		error("Failed to allocate receive buffer");
+		jeux_client_close(client);
+		return;
+	}
+
+	// Requests that arrive pipelined are answered together: responses
+	// are held back until no further complete request is buffered.
+	while(!(rbuf_recv_packet(rb, &hdr, &payload))) {
+		client_cork(client);
+		if(jeux_dispatch_packet(client, &hdr, payload)) {
+			break;
+		}
+		if(!rbuf_has_packet(rb)) {
+			client_uncork(client);
+		}
+	}
+	rbuf_destroy(rb);
+	jeux_client_close(client);
+}
+
+/*
+ * Service a non-blocking connection that has become readable, without
+ * waiting for anything: receive what is available and carry out every
+ * request that is complete, answering each batch of requests together.
+ * At most JEUX_READS_PER_WAKEUP receives are made, so that a client that
+ * keeps streaming requests cannot hold on to the calling thread; a
+ * caller that stops with data still unread is told about it again by
+ * epoll, which is level-triggered.
+ *
+ * @param client  The CLIENT of the connection.
+ * @param rb  The receive buffer of the connection.
+ * @return 0 if the connection should remain open, -1 if it has reached
+ * EOF, failed, or been asked to shut down by the dispatcher.
+ */
+int jeux_serve_ready(CLIENT *client, RECV_BUFFER *rb) {
+	for(int i = 0; i < JEUX_READS_PER_WAKEUP; i++) {
+		ssize_t n = rbuf_fill(rb, MSG_DONTWAIT);
+		if(n < 0) {
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			error("Error reading from socket: %s", strerror(errno));
+			return -1;
+		} else if(n == 0) {
+			debug("%ld: EOF on fd: %d", pthread_self(), client_get_fd(client));
+			return -1;
+		}
+		if(jeux_dispatch_buffered(client, rb) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Carry out every request that is complete in a connection's receive
+ * buffer, answering them together.
+ *
+ * @param client  The CLIENT of the connection.
+ * @param rb  The receive buffer of the connection.
+ * @return 0 if the connection should remain open, -1 if it has been
+ * asked to shut down by the dispatcher.
+ */
+int jeux_dispatch_buffered(CLIENT *client, RECV_BUFFER *rb) {
+	JEUX_PACKET_HEADER hdr;
+	void *payload;
+	// Everything received in one go is answered in one go.
+	client_cork(client);
+	while(rbuf_next_packet(rb, &hdr, &payload)) {
+		if(jeux_dispatch_packet(client, &hdr, payload))
+			return -1;
+	}
+	client_uncork(client);
+	return 0;
+}
+
+/*
+ * Register a newly accepted connection with the client registry.
+ *
+ * @param fd  The file descriptor of the connection.
+ * @return  The newly registered CLIENT, otherwise NULL, in which case
+ * the file descriptor has been closed.
+ */
+CLIENT *jeux_client_open(int fd) {
 	CLIENT *client;
 	if(!(client = creg_register(client_registry, fd))) {
 		error("Failed to register client");
 		close(fd);
 		return NULL;
 	}
+	return client;
+}
 
-	JEUX_PACKET_HEADER *hdr;
-	if(!(hdr = calloc(1, sizeof(JEUX_PACKET_HEADER)))) {
-	// if(!(hdr = malloc(sizeof(JEUX_PACKET_HEADER)))) {
-		error("Failed to allocate memory for packet header");
-		creg_unregister(client_registry, client);
-		close(fd);
-		return NULL;
+/*
+ * Tear down the service state of a client whose connection has ended:
+ * log it out if it was logged in, unregister it and close its socket.
+ *
+ * @param client  The CLIENT whose connection has ended.  The reference
+ * held by the registry is discarded, so it must not be used afterwards.
+ */
+void jeux_client_close(CLIENT *client) {
+#ifdef DEBUG
+	int fd = client_get_fd(client);
+#endif
+	if(client_get_player(client)) {
+		player_unref(client_get_player(client), "because server thread is discarding reference to logged in player");
+		debug("%ld: [%d] Logging out client", pthread_self(), fd);
+		client_logout(client);
 	}
+	// Keep the CLIENT alive until its connection is closed, but take it
+	// out of the registry first, so that the descriptor cannot be handed
+	// to a new connection while it is still registered.
+	client_ref(client, "while closing connection");
+	creg_unregister(client_registry, client);
+	debug("%ld: [%d] Ending client service", pthread_self(), fd);
+	client_disconnect(client);
+	client_unref(client, "after closing connection");
+}
 
-	// memset(hdr, 0, sizeof(JEUX_PACKET_HEADER));
-	// *hdr = (JEUX_PACKET_HEADER) {
-	// 	.type = JEUX_LOGIN_PKT,
-	// 	.id = 0,
-	// 	.role = 0,
-	// 	.size = 0,
-	// };
+/*
+ * Parse the payload of a paged USERS request, described in
+ * protocol_ext.h.  The payload is split up in place, and the strings in
+ * the query point into it.
+ *
+ * @param payload  The null-terminated payload.
+ * @param query  The query to be filled in.
+ * @return 0 if the payload is well formed, otherwise -1.
+ */
+static int jeux_parse_users_query(char *payload, CREG_USERS_QUERY *query) {
+	*query = (CREG_USERS_QUERY) {
+		.after = NULL,
+		.prefix = NULL,
+		.min_rating = INT_MIN,
+		.max_rating = INT_MAX,
+		.limit = JEUX_USERS_PAGE_MAX
+	};
+	char *field;
+	while((field = strsep(&payload, "\t"))) {
+		char *value, *end;
+		long n = 0;
+		if(!*field)
+			continue;
+		if(!(value = strchr(field, '=')))
+			return -1;
+		*value++ = '\0';
+		if(!strcmp(field, "after")) {
+			query->after = value;
+			continue;
+		}
+		if(!strcmp(field, "prefix")) {
+			query->prefix = value;
+			continue;
+		}
+		n = strtol(value, &end, 10);
+		if(!*value || *end || n < INT_MIN || n > INT_MAX)
+			return -1;
+		if(!strcmp(field, "min"))
+			query->min_rating = n;
+		else if(!strcmp(field, "max"))
+			query->max_rating = n;
+		else if(!strcmp(field, "limit") && n > 0)
+			query->limit = n < JEUX_USERS_PAGE_MAX ? n : JEUX_USERS_PAGE_MAX;
+		else
+			return -1;
+	}
+	return 0;
+}
 
-	// client_send_packet(client, hdr, NULL);
+/*
+ * Send the ACK to a paged USERS request.  The page is formatted on this
+ * function's stack, since it only has to last until the ACK carrying it
+ * has been sent or queued; keeping it out of jeux_dispatch_packet()
+ * means that only USERS requests pay for the stack it takes.
+ *
+ * @param client  The CLIENT that made the request.
+ * @param query  The query.
+ * @return 0 if the ACK was sent or queued, 1 if the connection failed,
+ * -1 if the page could not be made, in which case a NACK is due.
+ */
+static __attribute__((noinline)) int jeux_send_users_page(CLIENT *client, const CREG_USERS_QUERY *query) {
+	char page[UINT16_MAX];
+	size_t page_len;
+	int more;
+	if((more = creg_users_page(client_registry, query, page, sizeof(page), &page_len)) < 0)
+		return -1;
+	debug("%ld: [%d] Users page (%zu bytes%s)", pthread_self(), client_get_fd(client), page_len,
+	      more ? ", more" : "");
+	if(client_send_ack_role(client, more ? JEUX_USERS_MORE : 0, page, page_len) < 0) {
+		error("Failed to send ACK packet");
+		return 1;
+	}
+	return 0;
+}
 
-	void *payload = NULL;
+/*
+ * Send the ACK to a LEADERS request.  As for jeux_send_users_page(), the
+ * listing is formatted on this function's stack.
+ *
+ * @param client  The CLIENT that made the request.
+ * @param hdr  The header of the request, in network byte order.
+ * @return 0 if the ACK was sent or queued, otherwise -1.
+ */
+static __attribute__((noinline)) int jeux_send_leaders(CLIENT *client, JEUX_PACKET_HEADER *hdr) {
+	char leaders[UINT16_MAX];
+	size_t leaders_len = lb_top(hdr->id ? hdr->id : JEUX_LEADERS_DEFAULT, leaders, sizeof(leaders));
+	if(hdr->role & JEUX_LEADERS_SELF) {
+		PLAYER *self = client_get_player(client);
+		size_t at = leaders_len - 1;
+		int n = snprintf(leaders + at, sizeof(leaders) - at, "%s%d\t%s\t%d", at ? "\n" : "",
+				 player_get_rank(self), player_get_name(self), player_get_rating(self));
+		if(n > 0 && (size_t)n < sizeof(leaders) - at)
+			leaders_len += n;
+		else
+			leaders[at] = '\0';
+	}
+	if(client_send_ack(client, leaders, leaders_len) < 0) {
+		error("Failed to send ACK packet");
+		return -1;
+	}
+	return 0;
+}
 
+/*
+ * Carry out a single request received from a client and send the
+ * corresponding ACK or NACK.
+ *
+ * @param client  The CLIENT from which the packet was received.
+ * @param hdr  The header of the received packet, in network byte order.
+ * It is used as scratch storage for the reply and is overwritten.
+ * @param data  The null-terminated payload of the packet, or NULL if
+ * there was none.  It remains owned by the caller.
+ * @return 0 if the service loop should continue, -1 if the connection
+ * should be shut down.
+ */
+int jeux_dispatch_packet(CLIENT *client, JEUX_PACKET_HEADER *hdr, void *data) {
+#ifdef DEBUG
+	int fd = client_get_fd(client);
+#endif
 	int nack_flag = 0;
 	int EOF_flag = 0;
 	struct timespec ts;
-	while(!(proto_recv_packet(fd, hdr, &payload))) {
-		if(payload) {
-			void *payload_tmp;
-			if((payload_tmp = realloc(payload, ntohs(hdr->size) + 1))) {
-				payload = payload_tmp;
-			} 
-			char *payload_str = (char *)payload;
-			payload_str[ntohs(hdr->size)] = '\0';
-			// debug("payload[ntohs(hdr->size)] = %c", payload_str[ntohs(hdr->size)]);
-			// debug("payload[ntohs(hdr->size)] = %d", payload_str[ntohs(hdr->size)]);
-			// debug("payload[ntohs(hdr->size) - 1] = %c", payload_str[ntohs(hdr->size) - 1]);
-			// debug("payload[ntohs(hdr->size) - 1] = %d", payload_str[ntohs(hdr->size) - 1]);
-			// debug("ntohs(hdr->size) = %d", ntohs(hdr->size));
-		}
-		switch(hdr->type) {
-			case JEUX_LOGIN_PKT:
-				if(payload) {
-					debug("<= %u.%u: type=LOGIN, size=%u, id=%u, role=%u, payload=[%s]", 
-					ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role, (char *)payload);
-				} else {
-					debug("<= %u.%u: type=LOGIN, size=%u, id=%u, role=%u, (no payload)", 
-					ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role);
-				}
-				debug("%ld: [%d] LOGIN packet received", pthread_self(), fd);
 
-				// debug("hdr->timestamp_sec = %u", hdr->timestamp_sec);
-				// debug("hdr->timestamp_nsec = %u", hdr->timestamp_nsec);
+	switch(hdr->type) {
+		case JEUX_LOGIN_PKT:
+			if(data) {
+				debug("<= %u.%u: type=LOGIN, size=%u, id=%u, role=%u, payload=[%s]", 
+				ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role, (char *)data);
+			} else {
+				debug("<= %u.%u: type=LOGIN, size=%u, id=%u, role=%u, (no payload)", 
+				ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role);
+			}
+			debug("%ld: [%d] LOGIN packet received", pthread_self(), fd);
+
+			if(!data) {
+				debug("%ld: [%d] No user name to log in as", pthread_self(), fd);
+				nack_flag = 1;
+				break;
+			}
 
-				// uint32_t timestamp_sec_prev = hdr->timestamp_sec;
-				// uint32_t timestamp_nsec_prev = hdr->timestamp_nsec; 
+			// debug("hdr->timestamp_sec = %u", hdr->timestamp_sec);
+			// debug("hdr->timestamp_nsec = %u", hdr->timestamp_nsec);
 
+			// uint32_t timestamp_sec_prev = hdr->timestamp_sec;
+			// uint32_t timestamp_nsec_prev = hdr->timestamp_nsec; 
 
-				if(!client_get_player(client)) {
-					PLAYER *player;
+
+			if(!client_get_player(client)) {
+				PLAYER *player;
+				// debug("hdr->timestamp_sec = %u", hdr->timestamp_sec);
+				// debug("hdr->timestamp_nsec = %u", hdr->timestamp_nsec);
+				// debug("timestamp_sec_prev = %u", timestamp_sec_prev);
+				// debug("timestamp_nsec_prev = %u", timestamp_nsec_prev);
+				// debug("hiiiiiiiiiiiiiiiii");
+				// if((player = player_create(payload))) {
+				if((player = preg_register(player_registry, (char *)data))) {
+					// debug("hiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiii");
 					// debug("hdr->timestamp_sec = %u", hdr->timestamp_sec);
 					// debug("hdr->timestamp_nsec = %u", hdr->timestamp_nsec);
 					// debug("timestamp_sec_prev = %u", timestamp_sec_prev);
 					// debug("timestamp_nsec_prev = %u", timestamp_nsec_prev);
-					// debug("hiiiiiiiiiiiiiiiii");
-					// if((player = player_create(payload))) {
-					if((player = preg_register(player_registry, (char *)payload))) {
-						// debug("hiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiii");
+					// struct timespec ts;
+					// clock_gettime(CLOCK_MONOTONIC, &ts);
+					if(client_login(client, player) == 0) {
+						client_set_compact_state(client, hdr->role & JEUX_LOGIN_COMPACT_STATE);
+						// *hdr = (JEUX_PACKET_HEADER) {
+						// 	.type = JEUX_ACK_PKT,
+						// 	.id = 0,
+						// 	.role = 0,
+						// 	.size = 0,
+						// 	// .timestamp_sec = timestamp_sec_prev,
+						// 	// .timestamp_nsec = timestamp_nsec_prev
+						// 	.timestamp_sec = htonl((uint32_t)ts.tv_sec),
+						// 	.timestamp_nsec = htonl((uint32_t)ts.tv_nsec)
+						// };
+						// hdr->type = JEUX_ACK_PKT;
+						// hdr->id = 0;
+						// hdr->role = 0;
+						// hdr->size = 0;
+						// hdr->timestamp_sec = htonl((uint32_t)ts.tv_sec);
+						// hdr->timestamp_nsec = htonl((uint32_t)ts.tv_nsec);
+						// if(client_send_ack(client, NULL, 0) < 0) {
 						// debug("hdr->timestamp_sec = %u", hdr->timestamp_sec);
 						// debug("hdr->timestamp_nsec = %u", hdr->timestamp_nsec);
 						// debug("timestamp_sec_prev = %u", timestamp_sec_prev);
 						// debug("timestamp_nsec_prev = %u", timestamp_nsec_prev);
-						// struct timespec ts;
-						// clock_gettime(CLOCK_MONOTONIC, &ts);
-						if(client_login(client, player) == 0) {
-							// *hdr = (JEUX_PACKET_HEADER) {
-							// 	.type = JEUX_ACK_PKT,
-							// 	.id = 0,
-							// 	.role = 0,
-							// 	.size = 0,
-							// 	// .timestamp_sec = timestamp_sec_prev,
-							// 	// .timestamp_nsec = timestamp_nsec_prev
-							// 	.timestamp_sec = htonl((uint32_t)ts.tv_sec),
-							// 	.timestamp_nsec = htonl((uint32_t)ts.tv_nsec)
-							// };
-							// hdr->type = JEUX_ACK_PKT;
-							// hdr->id = 0;
-							// hdr->role = 0;
-							// hdr->size = 0;
-							// hdr->timestamp_sec = htonl((uint32_t)ts.tv_sec);
-							// hdr->timestamp_nsec = htonl((uint32_t)ts.tv_nsec);
-							// if(client_send_ack(client, NULL, 0) < 0) {
-							// debug("hdr->timestamp_sec = %u", hdr->timestamp_sec);
-							// debug("hdr->timestamp_nsec = %u", hdr->timestamp_nsec);
-							// debug("timestamp_sec_prev = %u", timestamp_sec_prev);
-							// debug("timestamp_nsec_prev = %u", timestamp_nsec_prev);
-							// if(client_send_packet(client, hdr, NULL) < 0) {
-							// 	error("Failed to send ACK packet");
-							// 	EOF_flag = 1;
-							// }
-							if(client_send_ack(client, NULL, 0) < 0) {
-								error("Failed to send ACK packet");
-								EOF_flag = 1;
-							}
-							// debug("=> %u.%u: type=ACK, size=%u, id=%u, role=%u, (no payload)", 
-							// ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role);
-							break;
-						} else {
-							nack_flag = 1;
+						// if(client_send_packet(client, hdr, NULL) < 0) {
+						// 	error("Failed to send ACK packet");
+						// 	EOF_flag = 1;
+						// }
+						if(client_send_ack(client, NULL, 0) < 0) {
+							error("Failed to send ACK packet");
+							EOF_flag = 1;
 						}
+						// debug("=> %u.%u: type=ACK, size=%u, id=%u, role=%u, (no payload)", 
+						// ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role);
+						break;
 					} else {
 						nack_flag = 1;
 					}
 				} else {
-					debug("%ld: [%d] Already logged in (player %p [%s])", pthread_self(), fd, client_get_player(client), player_get_name(client_get_player(client)));
 					nack_flag = 1;
 				}
-				break;
-			case JEUX_USERS_PKT:
-				if(payload) {
-					debug("<= %u.%u: type=USERS, size=%u, id=%u, role=%u, payload=[%s]", 
-					ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role, (char *)payload);
-				} else {
-					debug("<= %u.%u: type=USERS, size=%u, id=%u, role=%u, (no payload)", 
-					ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role);
-				}
-				debug("%ld: [%d] USERS packet received", pthread_self(), fd);
-
-				if(!client_get_player(client)) {
-					debug("%ld: [%d] Login required", pthread_self(), fd);
-					nack_flag = 1;
-					break;
-				}
+			} else {
+				debug("%ld: [%d] Already logged in (player %p [%s])", pthread_self(), fd, client_get_player(client), player_get_name(client_get_player(client)));
+				nack_flag = 1;
+			}
+			break;
+		case JEUX_USERS_PKT:
+			if(data) {
+				debug("<= %u.%u: type=USERS, size=%u, id=%u, role=%u, payload=[%s]", 
+				ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role, (char *)data);
+			} else {
+				debug("<= %u.%u: type=USERS, size=%u, id=%u, role=%u, (no payload)", 
+				ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role);
+			}
+			debug("%ld: [%d] USERS packet received", pthread_self(), fd);
 
-				PLAYER** players_list = creg_all_players(client_registry);
-				payload = NULL;
-				int i = 0;
-				PLAYER *curr_player = players_list[i];;
-				debug("%ld: [%d] Users", pthread_self(), fd);
-				while(curr_player) {
-					//making the line
-					int len = snprintf(NULL, 0, "%s\t%d\n", player_get_name(curr_player), player_get_rating(curr_player));
-					char *line;
-					if(!(line = malloc(len + 1))) {
-						error("Failed to allocate memory for line");
-						// EOF_flag = 1;
-						nack_flag = 1;
-						break;
-					}
-					line[len] = '\0';
-					snprintf(line, len, "%s\t%d\n", player_get_name(curr_player), player_get_rating(curr_player));
-					//combine the lines
-					if(!payload) {
-						payload = strdup(line);
-					} else {
-						char *temp;
-						if(!(temp = realloc(payload, strlen((char *)payload) + strlen(line) + 2))) {
-							error("Failed to reallocate memory for payload");
-							// EOF_flag = 1;
-							nack_flag = 1;
-							break;
-						}
-						// temp[strlen(payload) + strlen(line)] = '\0';
-						// payload = temp;
-						// strcat((char *)payload, line);
-						strcat(temp, "\n");
-						// memcpy(temp, payload, strlen((char *)payload));
-						strcpy(temp + strlen(temp), line);
-						// temp[strlen((char *)payload) + strlen(line)] = '\0';
-						payload = temp;
-					}
-					// debug("payload: %s", (char *)payload);
-					free(line);
-					players_list[i] = NULL;
-					player_unref(curr_player, "for player removed from players list");
-					i++;
-					curr_player = players_list[i];
-				}
-				free(players_list);
-				// debug("payload: %s", (char *)payload);
-				if(client_send_ack(client, payload, strlen((char *)payload) + 1) < 0) {
-					error("Failed to send ACK packet");
-					EOF_flag = 1;
-				}
-				// debug("=> %u.%u: type=ACK, size=%u, id=%u, role=%u, payload=[%s]", 
-				// ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role, (char *)payload);
+			if(!client_get_player(client)) {
+				debug("%ld: [%d] Login required", pthread_self(), fd);
+				nack_flag = 1;
 				break;
-			case JEUX_INVITE_PKT:
-				if(payload) {
-					debug("<= %u.%u: type=INVITE, size=%u, id=%u, role=%u, payload=[%s]", 
-					ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role, (char *)payload);
-				} else {
-					debug("<= %u.%u: type=INVITE, size=%u, id=%u, role=%u, (no payload)", 
-					ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role);
-				}
-				debug("%ld: [%d] INVITE packet received", pthread_self(), fd);
+			}
 
-				if(!client_get_player(client)) {
-					debug("%ld: [%d] Login required", pthread_self(), fd);
+			if(data) {
+				CREG_USERS_QUERY query;
+				if(jeux_parse_users_query(data, &query) < 0) {
+					debug("%ld: [%d] Bad USERS query", pthread_self(), fd);
 					nack_flag = 1;
 					break;
 				}
+				int sent = jeux_send_users_page(client, &query);
+				nack_flag = sent < 0;
+				EOF_flag = sent > 0;
+				break;
+			}
 
-				debug("%ld: [%d] Invite '%s'", pthread_self(), fd, (char *)payload);
-
-				CLIENT *target;
-				if((target = creg_lookup(client_registry, (char *)payload))) {
-					// debug("%ld: [%d] Make an invitation", pthread_self(), fd);
-					// client_ref(client, "as source of new invitation");
-					// client_ref(target, "as target of new invitation");
-					int inv_ID;
-					GAME_ROLE source_role;
-					GAME_ROLE target_role;
-					if(hdr->role == 1) {
-						target_role = FIRST_PLAYER_ROLE;
-						source_role = SECOND_PLAYER_ROLE;
-					} else {
-						target_role = SECOND_PLAYER_ROLE;
-						source_role = FIRST_PLAYER_ROLE;
-					} 
-					if((inv_ID = client_make_invitation(client, target, source_role, target_role)) < 0) {
-						debug("%ld: [%d] Failed to create invitation", pthread_self(), fd);
-						client_unref(target, "after invitation attempt");
-						// EOF_flag = 1;
-						nack_flag = 1;
-						break;
-					}
+			// The listing is shared by all requests, and only needs to stay
+			// put until the ACK carrying it has been sent or queued.
+			epoch_enter();
+			size_t users_len;
+			const char *users;
+			if(!(users = creg_users(client_registry, &users_len))) {
+				epoch_exit();
+				nack_flag = 1;
+				break;
+			}
+			if(users_len > UINT16_MAX) {
+				// Too big for one packet; the client has to ask for pages.
+				debug("%ld: [%d] Users listing too long (%zu bytes)", pthread_self(), fd, users_len);
+				epoch_exit();
+				nack_flag = 1;
+				break;
+			}
+			debug("%ld: [%d] Users", pthread_self(), fd);
+			if(client_send_ack(client, (void *)users, users_len) < 0) {
+				error("Failed to send ACK packet");
+				EOF_flag = 1;
+			}
+			epoch_exit();
+			// debug("=> %u.%u: type=ACK, size=%u, id=%u, role=%u, payload=[%s]", 
+			// ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role, (char *)payload);
+			break;
+		case JEUX_INVITE_PKT:
+			if(data) {
+				debug("<= %u.%u: type=INVITE, size=%u, id=%u, role=%u, payload=[%s]", 
+				ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role, (char *)data);
+			} else {
+				debug("<= %u.%u: type=INVITE, size=%u, id=%u, role=%u, (no payload)", 
+				ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role);
+			}
+			debug("%ld: [%d] INVITE packet received", pthread_self(), fd);
 
-					client_unref(target, "after invitation attempt");
-					// debug("%ld: [%d] Add invitation as source", pthread_self(), fd);
-					// struct timespec start_time;
-					// clock_gettime(CLOCK_REALTIME, &start_time);
-					// *hdr = (JEUX_PACKET_HEADER) {
-					// 	.type = JEUX_ACK_PKT,
-					// 	.size = 0,
-					// 	.id = inv_ID,
-					// 	.role = 0,
-					// 	// .timestamp_sec = htonl((uint32_t)start_time.tv_sec),
-					// 	// .timestamp_nsec = htonl(start_time.tv_nsec)
-					// 	// .timestamp_sec = ntohl((uint32_t)start_time.tv_sec),
-					// 	// .timestamp_nsec = ntohl((uint32_t)start_time.tv_nsec)
-					// };
-					// hdr->type = JEUX_ACK_PKT;
-					// hdr->id = inv_ID;
-					// hdr->role = 0;
-					// hdr->size = 0;
-					// JEUX_PACKET_HEADER *temphdr;
-					// if(!(temphdr = calloc(1, sizeof(JEUX_PACKET_HEADER)))) {
-					// 	error("Failed to allocate memory for ACK packet header");
-					// 	EOF_flag = 1;
-					// 	break;
-					// }
-					// *temphdr = (JEUX_PACKET_HEADER) {
-					// 	.type = JEUX_ACK_PKT,
-					// 	.size = 0,
-					// 	.id = inv_ID,
-					// 	.role = 0
-					// };
-					// if(client_send_packet(client, temphdr, NULL) < 0) {
-					clock_gettime(CLOCK_MONOTONIC, &ts);
-					// *hdr = (JEUX_PACKET_HEADER) {
-					// 	.type = JEUX_ACK_PKT,
-					// 	.id = inv_ID,
-					// 	.role = 0,
-					// 	.size = 0,
-					// 	.timestamp_sec = htonl((uint32_t)ts.tv_sec),
-					// 	.timestamp_nsec = htonl((uint32_t)ts.tv_nsec)
-					// };
-					// free(hdr);
-					// hdr = malloc(sizeof(JEUX_PACKET_HEADER));
-					*hdr = (JEUX_PACKET_HEADER) {
-						.type = JEUX_ACK_PKT,
-						.id = inv_ID,
-						.role = 0,
-						.size = 0,
-						.timestamp_sec = htonl((uint32_t)ts.tv_sec),
-						.timestamp_nsec = htonl((uint32_t)ts.tv_nsec)
-					};
-					if(client_send_packet(client, hdr, NULL) < 0) {
-						error("Failed to send ACK packet");
-						EOF_flag = 1;
-						break;
-					}
-					// free(temphdr);
-				} else {
-					debug("%ld: [%d] No client logged in as user 'u'", pthread_self(), fd);
-					nack_flag = 1;
-					break;
-				}
+			if(!client_get_player(client)) {
+				debug("%ld: [%d] Login required", pthread_self(), fd);
+				nack_flag = 1;
+				break;
+			}
 
+			if(!data) {
+				debug("%ld: [%d] No user to invite", pthread_self(), fd);
+				nack_flag = 1;
 				break;
-			case JEUX_REVOKE_PKT:
-				if(payload) {
-					debug("<= %u.%u: type=REVOKED, size=%u, id=%u, role=%u, payload=[%s]", 
-					ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role, (char *)payload);
-				} else {
-					debug("<= %u.%u: type=REVOKED, size=%u, id=%u, role=%u, (no payload)", 
-					ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role);
-				}
-				debug("%ld: [%d] REVOKED packet received", pthread_self(), fd);
+			}
+
+			debug("%ld: [%d] Invite '%s'", pthread_self(), fd, (char *)data);
 
-				if(!client_get_player(client)) {
-					debug("%ld: [%d] Login required", pthread_self(), fd);
+			// The name of the target may be followed by a tab and the
+			// geometry of the game; otherwise it is tic-tac-toe.
+			GAME_GEOMETRY geometry = GAME_GEOMETRY_DEFAULT;
+			char *shape;
+			if((shape = strchr(data, '\t'))) {
+				*shape++ = '\0';
+				if(game_parse_geometry(shape, &geometry) < 0) {
+					debug("%ld: [%d] Invalid geometry '%s'", pthread_self(), fd, shape);
 					nack_flag = 1;
 					break;
 				}
+			}
 
-				debug("%ld: [%d] Revoke '%d'", pthread_self(), fd, hdr->id);
-
-				if(client_revoke_invitation(client, hdr->id) < 0) {
-					// error("Failed to revoke invitation");
-					// debug("%ld: [%d] )
+			CLIENT *target;
+			if((target = creg_lookup(client_registry, (char *)data))) {
+				// debug("%ld: [%d] Make an invitation", pthread_self(), fd);
+				// client_ref(client, "as source of new invitation");
+				// client_ref(target, "as target of new invitation");
+				int inv_ID;
+				GAME_ROLE source_role;
+				GAME_ROLE target_role;
+				if(hdr->role == 1) {
+					target_role = FIRST_PLAYER_ROLE;
+					source_role = SECOND_PLAYER_ROLE;
+				} else {
+					target_role = SECOND_PLAYER_ROLE;
+					source_role = FIRST_PLAYER_ROLE;
+				} 
+				if((inv_ID = client_make_invitation_geometry(client, target, source_role,
+									     target_role, &geometry)) < 0) {
+					debug("%ld: [%d] Failed to create invitation", pthread_self(), fd);
+					client_unref(target, "after invitation attempt");
 					// EOF_flag = 1;
 					nack_flag = 1;
 					break;
 				}
 
-				if(client_send_ack(client, NULL, 0) < 0) {
+				client_unref(target, "after invitation attempt");
+				// debug("%ld: [%d] Add invitation as source", pthread_self(), fd);
+				// struct timespec start_time;
+				// clock_gettime(CLOCK_REALTIME, &start_time);
+				// *hdr = (JEUX_PACKET_HEADER) {
+				// 	.type = JEUX_ACK_PKT,
+				// 	.size = 0,
+				// 	.id = inv_ID,
+				// 	.role = 0,
+				// 	// .timestamp_sec = htonl((uint32_t)start_time.tv_sec),
+				// 	// .timestamp_nsec = htonl(start_time.tv_nsec)
+				// 	// .timestamp_sec = ntohl((uint32_t)start_time.tv_sec),
+				// 	// .timestamp_nsec = ntohl((uint32_t)start_time.tv_nsec)
+				// };
+				// hdr->type = JEUX_ACK_PKT;
+				// hdr->id = inv_ID;
+				// hdr->role = 0;
+				// hdr->size = 0;
+				// JEUX_PACKET_HEADER *temphdr;
+				// if(!(temphdr = calloc(1, sizeof(JEUX_PACKET_HEADER)))) {
+				// 	error("Failed to allocate memory for ACK packet header");
+				// 	EOF_flag = 1;
+				// 	break;
+				// }
+				// *temphdr = (JEUX_PACKET_HEADER) {
+				// 	.type = JEUX_ACK_PKT,
+				// 	.size = 0,
+				// 	.id = inv_ID,
+				// 	.role = 0
+				// };
+				// if(client_send_packet(client, temphdr, NULL) < 0) {
+				clock_gettime(CLOCK_MONOTONIC, &ts);
+				// *hdr = (JEUX_PACKET_HEADER) {
+				// 	.type = JEUX_ACK_PKT,
+				// 	.id = inv_ID,
+				// 	.role = 0,
+				// 	.size = 0,
+				// 	.timestamp_sec = htonl((uint32_t)ts.tv_sec),
+				// 	.timestamp_nsec = htonl((uint32_t)ts.tv_nsec)
+				// };
+				// free(hdr);
+				// hdr = malloc(sizeof(JEUX_PACKET_HEADER));
+				*hdr = (JEUX_PACKET_HEADER) {
+					.type = JEUX_ACK_PKT,
+					.id = inv_ID,
+					.role = 0,
+					.size = 0,
+					.timestamp_sec = htonl((uint32_t)ts.tv_sec),
+					.timestamp_nsec = htonl((uint32_t)ts.tv_nsec)
+				};
+				if(client_send_packet(client, hdr, NULL) < 0) {
 					error("Failed to send ACK packet");
 					EOF_flag = 1;
 					break;
 				}
-
+				// free(temphdr);
+			} else {
+				debug("%ld: [%d] No client logged in as user 'u'", pthread_self(), fd);
+				nack_flag = 1;
 				break;
-			case JEUX_ACCEPT_PKT:
-				if(payload) {
-					debug("<= %u.%u: type=ACCEPTED, size=%u, id=%u, role=%u, payload=[%s]", 
-					ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role, (char *)payload);
-				} else {
-					debug("<= %u.%u: type=ACCEPTED, size=%u, id=%u, role=%u, (no payload)", 
-					ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role);
-				}
-				debug("%ld: [%d] ACCEPTED packet received", pthread_self(), fd);
+			}
 
-				if(!client_get_player(client)) {
-					debug("%ld: [%d] Login required", pthread_self(), fd);
-					nack_flag = 1;
-					break;
-				}
+			break;
+		case JEUX_REVOKE_PKT:
+			if(data) {
+				debug("<= %u.%u: type=REVOKED, size=%u, id=%u, role=%u, payload=[%s]", 
+				ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role, (char *)data);
+			} else {
+				debug("<= %u.%u: type=REVOKED, size=%u, id=%u, role=%u, (no payload)", 
+				ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role);
+			}
+			debug("%ld: [%d] REVOKED packet received", pthread_self(), fd);
 
-				debug("%ld: [%d] Accept '%d'", pthread_self(), fd, hdr->id);
+			if(!client_get_player(client)) {
+				debug("%ld: [%d] Login required", pthread_self(), fd);
+				nack_flag = 1;
+				break;
+			}
 
-				char *strp = NULL;
-				if(client_accept_invitation(client, hdr->id, &strp) < 0) {
-					// error("Failed to accept invitation");
-					// EOF_flag = 1;
-					nack_flag = 1;
-					break;
-				}
+			debug("%ld: [%d] Revoke '%d'", pthread_self(), fd, hdr->id);
 
-				// debug("strp = %s", strp ? strp : "(null)");
-
-				if(strp) {
-					// *hdr = (JEUX_PACKET_HEADER) {
-					// 	.type = JEUX_ACK_PKT,
-					// 	.id = 0,
-					// 	.role = 0,
-					// 	.size = 0,
-					// };
-					if(client_send_ack(client, strp, strlen(strp) + 1) < 0) {
-						error("Failed to send ACCEPTED packet");
-						EOF_flag = 1;
-						break;
-					}
-					free(strp);
-					// if(client_send_packet(client, hdr, strp) < 0) {
-					// 	error("Failed to send ACCEPTED packet");
-					// 	EOF_flag = 1;
-					// 	break;
-					// }
-				} else {
-					if(client_send_ack(client, NULL, 0) < 0) {
-						error("Failed to send ACCEPTED packet");
-						EOF_flag = 1;
-						break;
-					}
-				}
+			if(client_revoke_invitation(client, hdr->id) < 0) {
+				// error("Failed to revoke invitation");
+				// debug("%ld: [%d] )
+				// EOF_flag = 1;
+				nack_flag = 1;
+				break;
+			}
 
+			if(client_send_ack(client, NULL, 0) < 0) {
+				error("Failed to send ACK packet");
+				EOF_flag = 1;
+				break;
+			}
 
-				// *hdr = (JEUX_PACKET_HEADER) {
-				// 	.type = JEUX_ACK_PKT,
-				// 	.id = 0,
-				// 	.role = 0,
-				// 	.size = 0,
-				// };
-				// if(client_send_packet(client, hdr, strp) < 0) {
-				// 	error("Failed to send ACCEPTED packet");
-				// 	EOF_flag = 1;
-				// 	break;
-				// }
+			break;
+		case JEUX_ACCEPT_PKT:
+			if(data) {
+				debug("<= %u.%u: type=ACCEPTED, size=%u, id=%u, role=%u, payload=[%s]", 
+				ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role, (char *)data);
+			} else {
+				debug("<= %u.%u: type=ACCEPTED, size=%u, id=%u, role=%u, (no payload)", 
+				ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role);
+			}
+			debug("%ld: [%d] ACCEPTED packet received", pthread_self(), fd);
 
+			if(!client_get_player(client)) {
+				debug("%ld: [%d] Login required", pthread_self(), fd);
+				nack_flag = 1;
 				break;
-			case JEUX_DECLINE_PKT:
-				if(payload) {
-					debug("<= %u.%u: type=DECLINED, size=%u, id=%u, role=%u, payload=[%s]", 
-					ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role, (char *)payload);
-				} else {
-					debug("<= %u.%u: type=DECLINED, size=%u, id=%u, role=%u, (no payload)", 
-					ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role);
-				}
-				debug("%ld: [%d] DECLINED packet received", pthread_self(), fd);
+			}
 
-				if(!client_get_player(client)) {
-					debug("%ld: [%d] Login required", pthread_self(), fd);
-					nack_flag = 1;
-					break;
-				}
+			debug("%ld: [%d] Accept '%d'", pthread_self(), fd, hdr->id);
 
-				debug("%ld: [%d] Decline '%d'", pthread_self(), fd, hdr->id);
+			char state[CLIENT_STATE_MAX];
+			size_t len;
+			if(client_accept_invitation_state(client, hdr->id, state, &len) < 0) {
+				nack_flag = 1;
+				break;
+			}
+			if(client_send_ack(client, len ? state : NULL, len) < 0) {
+				error("Failed to send ACCEPTED packet");
+				EOF_flag = 1;
+				break;
+			}
 
-				if(client_decline_invitation(client, hdr->id) < 0) {
-					// error("Failed to decline invitation");
-					// EOF_flag = 1;
-					nack_flag = 1;
-					break;
-				}
 
-				if(client_send_ack(client, NULL, 0) < 0) {
-					error("Failed to send ACK packet");
-					EOF_flag = 1;
-					break;
-				}
+			// *hdr = (JEUX_PACKET_HEADER) {
+			// 	.type = JEUX_ACK_PKT,
+			// 	.id = 0,
+			// 	.role = 0,
+			// 	.size = 0,
+			// };
+			// if(client_send_packet(client, hdr, strp) < 0) {
+			// 	error("Failed to send ACCEPTED packet");
+			// 	EOF_flag = 1;
+			// 	break;
+			// }
 
+			break;
+		case JEUX_DECLINE_PKT:
+			if(data) {
+				debug("<= %u.%u: type=DECLINED, size=%u, id=%u, role=%u, payload=[%s]", 
+				ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role, (char *)data);
+			} else {
+				debug("<= %u.%u: type=DECLINED, size=%u, id=%u, role=%u, (no payload)", 
+				ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role);
+			}
+			debug("%ld: [%d] DECLINED packet received", pthread_self(), fd);
+
+			if(!client_get_player(client)) {
+				debug("%ld: [%d] Login required", pthread_self(), fd);
+				nack_flag = 1;
 				break;
-			case JEUX_MOVE_PKT:
-				if(payload) {
-					debug("<= %u.%u: type=MOVE, size=%u, id=%u, role=%u, payload=[%s]", 
-					ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role, (char *)payload);
-				} else {
-					debug("<= %u.%u: type=MOVE, size=%u, id=%u, role=%u, (no payload)", 
-					ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role);
-				}
-				debug("%ld: [%d] MOVE packet received", pthread_self(), fd);
+			}
 
-				if(!client_get_player(client)) {
-					debug("%ld: [%d] Login required", pthread_self(), fd);
-					nack_flag = 1;
-					break;
-				}
+			debug("%ld: [%d] Decline '%d'", pthread_self(), fd, hdr->id);
 
-				debug("%ld: [%d] Move '%d' (%s)", pthread_self(), fd, hdr->id, (char *)payload);
+			if(client_decline_invitation(client, hdr->id) < 0) {
+				// error("Failed to decline invitation");
+				// EOF_flag = 1;
+				nack_flag = 1;
+				break;
+			}
 
-				if(client_make_move(client, hdr->id, payload) < 0) {
-					// error("Failed to make move");
-					// EOF_flag = 1;
-					nack_flag = 1;
-					break;
-				}
+			if(client_send_ack(client, NULL, 0) < 0) {
+				error("Failed to send ACK packet");
+				EOF_flag = 1;
+				break;
+			}
 
-				if(client_send_ack(client, NULL, 0) < 0) {
-					error("Failed to send ACK packet");
-					EOF_flag = 1;
-					break;
-				}
+			break;
+		case JEUX_MOVE_PKT:
+			if(data) {
+				debug("<= %u.%u: type=MOVE, size=%u, id=%u, role=%u, payload=[%s]", 
+				ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role, (char *)data);
+			} else {
+				debug("<= %u.%u: type=MOVE, size=%u, id=%u, role=%u, (no payload)", 
+				ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role);
+			}
+			debug("%ld: [%d] MOVE packet received", pthread_self(), fd);
 
+			if(!client_get_player(client)) {
+				debug("%ld: [%d] Login required", pthread_self(), fd);
+				nack_flag = 1;
 				break;
-			case JEUX_RESIGN_PKT:
-				if(payload) {
-					debug("<= %u.%u: type=RESIGN, size=%u, id=%u, role=%u, payload=[%s]", 
-					ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role, (char *)payload);
-				} else {
-					debug("<= %u.%u: type=RESIGN, size=%u, id=%u, role=%u, (no payload)", 
-					ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role);
-				}
-				debug("%ld: [%d] RESIGN packet received", pthread_self(), fd);
+			}
 
-				if(!client_get_player(client)) {
-					debug("%ld: [%d] Login required", pthread_self(), fd);
-					nack_flag = 1;
-					break;
-				}
+			debug("%ld: [%d] Move '%d' (%s)", pthread_self(), fd, hdr->id, (char *)data);
 
-				debug("%ld: [%d] Resign '%d'", pthread_self(), fd, hdr->id);
+			if(client_make_move(client, hdr->id, data) < 0) {
+				// error("Failed to make move");
+				// EOF_flag = 1;
+				nack_flag = 1;
+				break;
+			}
 
-				if(client_resign_game(client, hdr->id) < 0) {
-					// error("Failed to resign game");
-					// EOF_flag = 1;
-					nack_flag = 1;
-					break;
-				}
+			if(client_send_ack(client, NULL, 0) < 0) {
+				error("Failed to send ACK packet");
+				EOF_flag = 1;
+				break;
+			}
 
-				if(client_send_ack(client, NULL, 0) < 0) {
-					error("Failed to send ACK packet");
-					EOF_flag = 1;
-					break;
-				}
+			break;
+		case JEUX_RESIGN_PKT:
+			if(data) {
+				debug("<= %u.%u: type=RESIGN, size=%u, id=%u, role=%u, payload=[%s]", 
+				ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role, (char *)data);
+			} else {
+				debug("<= %u.%u: type=RESIGN, size=%u, id=%u, role=%u, (no payload)", 
+				ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role);
+			}
+			debug("%ld: [%d] RESIGN packet received", pthread_self(), fd);
 
+			if(!client_get_player(client)) {
+				debug("%ld: [%d] Login required", pthread_self(), fd);
+				nack_flag = 1;
 				break;
-			default:
+			}
+
+			debug("%ld: [%d] Resign '%d'", pthread_self(), fd, hdr->id);
+
+			if(client_resign_game(client, hdr->id) < 0) {
+				// error("Failed to resign game");
+				// EOF_flag = 1;
+				nack_flag = 1;
 				break;
-		}
+			}
 
-		if(payload) {
-			free(payload);
-			payload = NULL;
-		}
+			if(client_send_ack(client, NULL, 0) < 0) {
+				error("Failed to send ACK packet");
+				EOF_flag = 1;
+				break;
+			}
 
-		if(nack_flag) {
-			nack_flag = 0;
-			if(client_send_nack(client) < 0) {
-				error("Failed to send NACK packet");
+			break;
+		case JEUX_LEADERS_PKT:
+			debug("<= %u.%u: type=LEADERS, size=%u, id=%u, role=%u", 
+			ntohl(hdr->timestamp_sec), ntohl(hdr->timestamp_nsec), ntohs(hdr->size), hdr->id, hdr->role);
+			debug("%ld: [%d] LEADERS packet received", pthread_self(), fd);
+
+			if(!client_get_player(client)) {
+				debug("%ld: [%d] Login required", pthread_self(), fd);
+				nack_flag = 1;
 				break;
 			}
-		}
 
-		if(EOF_flag) {
+			if(jeux_send_leaders(client, hdr) < 0)
+				EOF_flag = 1;
+			break;
+		default:
 			break;
-		}
-	}
-	if(payload) {
-		free(payload);
-		payload = NULL;
 	}
-	free(hdr);
-	if(client_get_player(client)) {
-		player_unref(client_get_player(client), "because server thread is discarding reference to logged in player");
-		debug("%ld: [%d] Logging out client", pthread_self(), fd);
-		client_logout(client);
+
+	if(nack_flag && client_send_nack(client) < 0) {
+		error("Failed to send NACK packet");
+		EOF_flag = 1;
 	}
-	creg_unregister(client_registry, client);
-	debug("%ld: [%d] Ending client service", pthread_self(), fd);
-	close(fd);
-	return NULL;
-}
\ No newline at end of file
+
+	// Only now that the reply is on its way may bots react to the request.
+	// This has to happen even if the connection has failed, as the events
+	// waiting on this thread hold references to the bots' CLIENTs.
+	bot_flush();
+
+	return EOF_flag ? -1 : 0;
+}
@@ -0,0 +1,188 @@
+#include "service_pool.h"
+#include "work_queue.h"
+#include "server_ext.h"
+#include "recv_buffer.h"
+#include "stats.h"
+#include "debug.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#define POOL_MAX_EVENTS 64
+
+/*
+ * Per-connection state.  A connection is registered with epoll for one
+ * event at a time (EPOLLONESHOT), so at most one worker has it at once
+ * and none of this needs to be locked.  A connection whose client is
+ * still NULL has just been accepted and has yet to be opened.
+ */
+typedef struct pool_conn {
+	int fd;
+	CLIENT *client;
+	RECV_BUFFER *rb;
+} POOL_CONN;
+
+static WORK_QUEUE *pool_queue;
+static int pool_epfd;
+
+static void *pool_poller(void *arg);
+static void *pool_worker(void *arg);
+
+/*
+ * Start the service workers, and the thread that waits for their
+ * connections to become ready.
+ *
+ * @param nworkers  The number of worker threads.
+ * @param qdepth  The capacity of the queue of connections waiting for
+ * a worker.
+ * @return 0 if the pool was started, otherwise -1.
+ */
+int pool_init(int nworkers, int qdepth) {
+	pthread_t tid;
+	if(nworkers <= 0) {
+		error("Invalid number of service workers: %d", nworkers);
+		return -1;
+	}
+	if(!(pool_queue = wq_init(qdepth)))
+		return -1;
+	if((pool_epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+		error("epoll_create1: %s", strerror(errno));
+		return -1;
+	}
+	if(pthread_create(&tid, NULL, pool_poller, NULL)) {
+		error("pthread_create failed");
+		return -1;
+	}
+	pthread_detach(tid);
+
+	for(int i = 0; i < nworkers; i++) {
+		if(pthread_create(&tid, NULL, pool_worker, NULL)) {
+			error("pthread_create failed after %d workers", i);
+			if(i == 0)
+				return -1;
+			break;
+		}
+		pthread_detach(tid);
+	}
+	debug("%ld: Started %d service workers (queue depth %d)", pthread_self(), nworkers, qdepth);
+	return 0;
+}
+
+/*
+ * Offer an accepted connection to the pool.  If the queue is full, the
+ * caller is held back for up to POOL_ADMIT_WAIT_MS, after which the
+ * connection is refused and closed.
+ *
+ * @param fd  The file descriptor of the connection.
+ * @return 0 if the connection was queued, otherwise -1.
+ */
+int pool_submit(int fd) {
+	POOL_CONN *conn;
+	if(!(conn = malloc(sizeof(POOL_CONN)))) {
+		error("malloc failed");
+		close(fd);
+		return -1;
+	}
+	*conn = (POOL_CONN) {
+		.fd = fd,
+		.client = NULL,
+		.rb = NULL
+	};
+	if(wq_put_timed(pool_queue, conn, POOL_ADMIT_WAIT_MS) < 0) {
+		// Several acceptors may be refusing connections at once.
+		stats_add(STAT_CONNECTIONS_REFUSED, 1);
+		debug("%ld: [%d] Service queue full, connection refused (%ld so far)", pthread_self(), fd,
+		      stats_get(STAT_CONNECTIONS_REFUSED));
+		free(conn);
+		close(fd);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Wait for connections to become readable, and queue each one that does
+ * for a worker.  The queue being full holds this thread back, and with
+ * it the admission of new connections, until the workers catch up.
+ */
+static void *pool_poller(void *arg) {
+	struct epoll_event events[POOL_MAX_EVENTS];
+	while(1) {
+		int n = epoll_wait(pool_epfd, events, POOL_MAX_EVENTS, -1);
+		if(n < 0) {
+			if(errno == EINTR)
+				continue;
+			error("epoll_wait: %s", strerror(errno));
+			return NULL;
+		}
+		for(int i = 0; i < n; i++)
+			wq_put(pool_queue, events[i].data.ptr);
+	}
+	return NULL;
+}
+
+/*
+ * Register a newly accepted connection with the client registry, and
+ * with epoll for its first event.
+ *
+ * @return 0 if the connection was opened, otherwise -1, in which case it
+ * has been closed and freed.
+ */
+static int pool_open(POOL_CONN *conn) {
+	if(!(conn->rb = rbuf_create(conn->fd))) {
+		close(conn->fd);
+		free(conn);
+		return -1;
+	}
+	if(!(conn->client = jeux_client_open(conn->fd))) {
+		rbuf_destroy(conn->rb);
+		free(conn);
+		return -1;
+	}
+	struct epoll_event ev = {
+		.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT,
+		.data.ptr = conn
+	};
+	if(epoll_ctl(pool_epfd, EPOLL_CTL_ADD, conn->fd, &ev) < 0) {
+		error("epoll_ctl: %s", strerror(errno));
+		jeux_client_close(conn->client);
+		rbuf_destroy(conn->rb);
+		free(conn);
+		return -1;
+	}
+	debug("%ld: [%d] Connection opened by service worker", pthread_self(), conn->fd);
+	return 0;
+}
+
+static void *pool_worker(void *arg) {
+	while(1) {
+		POOL_CONN *conn = wq_get(pool_queue);
+		if(!conn->client) {
+			pool_open(conn);
+			continue;
+		}
+		if(jeux_serve_ready(conn->client, conn->rb) < 0) {
+			epoll_ctl(pool_epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+			jeux_client_close(conn->client);
+			rbuf_destroy(conn->rb);
+			free(conn);
+			continue;
+		}
+		// Wait for the connection's next event, which may already be
+		// there if jeux_serve_ready() left data unread.
+		struct epoll_event ev = {
+			.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT,
+			.data.ptr = conn
+		};
+		if(epoll_ctl(pool_epfd, EPOLL_CTL_MOD, conn->fd, &ev) < 0) {
+			error("epoll_ctl: %s", strerror(errno));
+			jeux_client_close(conn->client);
+			rbuf_destroy(conn->rb);
+			free(conn);
+		}
+	}
+	return NULL;
+}
@@ -0,0 +1,228 @@
+#include "slab.h"
+#include "debug.h"
+#include <stdlib.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+typedef struct slab_object {
+	struct slab_object *next;
+} SLAB_OBJECT;
+
+/*
+ * A thread's free list for one type of object.
+ */
+typedef struct slab_local {
+	SLAB_OBJECT *free;
+	int count;
+} SLAB_LOCAL;
+
+/*
+ * The list shared by all threads, and the counters, for one type of
+ * object.  Each is kept on a cache line of its own, as the counters
+ * are updated on every allocation and free.
+ */
+typedef struct slab_cache {
+	alignas(64) pthread_mutex_t mutex;
+	SLAB_OBJECT *free;
+	atomic_long allocs;
+	atomic_long frees;
+	atomic_long slabs;
+	atomic_long transfers;
+} SLAB_CACHE;
+
+static SLAB_CACHE slab_caches[SLAB_COUNT] = {
+	[0 ... SLAB_COUNT - 1] = { .mutex = PTHREAD_MUTEX_INITIALIZER }
+};
+static __thread SLAB_LOCAL slab_local[SLAB_COUNT];
+static __thread int slab_registered;
+static pthread_key_t slab_key;
+static pthread_once_t slab_key_once = PTHREAD_ONCE_INIT;
+
+#ifdef INFO
+static const char *slab_names[SLAB_COUNT] = {
+	[SLAB_GAME] = "game",
+	[SLAB_GAME_STATE] = "game state",
+	[SLAB_INVITATION] = "invitation",
+	[SLAB_PLAYER] = "player",
+};
+#endif
+
+/*
+ * Detach the first "n" objects of a free list, which must have at least
+ * that many.
+ *
+ * @return  The first of them; *tailp is set to the last.
+ */
+static SLAB_OBJECT *slab_take(SLAB_OBJECT **list, int n, SLAB_OBJECT **tailp) {
+	SLAB_OBJECT *head = *list, *tail = head;
+	for(int i = 1; i < n; i++)
+		tail = tail->next;
+	*list = tail->next;
+	*tailp = tail;
+	return head;
+}
+
+/*
+ * Put a batch of objects on the shared list of a type.
+ */
+static void slab_give_back(SLAB_TYPE type, SLAB_OBJECT *head, SLAB_OBJECT *tail) {
+	SLAB_CACHE *cache = &slab_caches[type];
+	pthread_mutex_lock(&cache->mutex);
+	tail->next = cache->free;
+	cache->free = head;
+	pthread_mutex_unlock(&cache->mutex);
+	atomic_fetch_add_explicit(&cache->transfers, 1, memory_order_relaxed);
+}
+
+/*
+ * Return the free lists of an exiting thread to the shared lists.
+ */
+static void slab_thread_exit(void *arg) {
+	SLAB_LOCAL *local = arg;
+	for(int type = 0; type < SLAB_COUNT; type++) {
+		if(!local[type].count)
+			continue;
+		SLAB_OBJECT *tail;
+		SLAB_OBJECT *head = slab_take(&local[type].free, local[type].count, &tail);
+		slab_give_back(type, head, tail);
+		local[type].count = 0;
+	}
+}
+
+static void slab_make_key(void) {
+	pthread_key_create(&slab_key, slab_thread_exit);
+}
+
+/*
+ * Arrange for the calling thread's free lists to be given back when it
+ * exits.  A thread may only ever free objects that others allocated, so
+ * this has to happen on the first free as well as on the first refill.
+ */
+static void slab_register_thread(void) {
+	pthread_once(&slab_key_once, slab_make_key);
+	pthread_setspecific(slab_key, slab_local);
+	slab_registered = 1;
+}
+
+/*
+ * Fill the calling thread's empty free list for a type, from the shared
+ * list if it has anything, otherwise from a new slab.
+ *
+ * @return 0 if the list now has at least one object, -1 if memory is
+ * exhausted.
+ */
+static int slab_refill(SLAB_TYPE type, size_t size) {
+	SLAB_CACHE *cache = &slab_caches[type];
+	SLAB_LOCAL *local = &slab_local[type];
+	if(!slab_registered)
+		slab_register_thread();
+
+	int n = 0;
+	pthread_mutex_lock(&cache->mutex);
+	SLAB_OBJECT *head = cache->free, *tail = NULL;
+	for(SLAB_OBJECT *obj = head; obj && n < SLAB_BATCH; obj = obj->next) {
+		tail = obj;
+		n++;
+	}
+	if(n) {
+		cache->free = tail->next;
+		tail->next = NULL;
+	}
+	pthread_mutex_unlock(&cache->mutex);
+	if(n) {
+		atomic_fetch_add_explicit(&cache->transfers, 1, memory_order_relaxed);
+		local->free = head;
+		local->count = n;
+		return 0;
+	}
+
+	// Keep every object aligned as malloc() would.
+	size = (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+	char *slab;
+	if(!(slab = malloc(SLAB_OBJECTS * size))) {
+		error("malloc failed");
+		return -1;
+	}
+	for(int i = SLAB_OBJECTS - 1; i >= 0; i--) {
+		SLAB_OBJECT *obj = (SLAB_OBJECT *)(slab + i * size);
+		obj->next = local->free;
+		local->free = obj;
+	}
+	local->count = SLAB_OBJECTS;
+	atomic_fetch_add_explicit(&cache->slabs, 1, memory_order_relaxed);
+	debug("%ld: New slab of %d objects of %zu bytes for type %d", pthread_self(),
+	      SLAB_OBJECTS, size, type);
+	return 0;
+}
+
+/*
+ * Allocate an object.
+ *
+ * @param type  The type of object.
+ * @param size  Its size, which must be the same for every object of the
+ * type.
+ * @return  The object, uninitialized, or NULL if memory is exhausted.
+ */
+void *slab_alloc(SLAB_TYPE type, size_t size) {
+	SLAB_LOCAL *local = &slab_local[type];
+	if(!local->free && slab_refill(type, size) < 0)
+		return NULL;
+	SLAB_OBJECT *obj = local->free;
+	local->free = obj->next;
+	local->count--;
+	atomic_fetch_add_explicit(&slab_caches[type].allocs, 1, memory_order_relaxed);
+	return obj;
+}
+
+/*
+ * Free an object allocated by slab_alloc().
+ *
+ * @param type  The type of object.
+ * @param obj  The object.
+ */
+void slab_free(SLAB_TYPE type, void *obj) {
+	SLAB_LOCAL *local = &slab_local[type];
+	SLAB_OBJECT *o = obj;
+	if(!slab_registered)
+		slab_register_thread();
+	o->next = local->free;
+	local->free = o;
+	atomic_fetch_add_explicit(&slab_caches[type].frees, 1, memory_order_relaxed);
+	if(++local->count > SLAB_LOCAL_MAX) {
+		SLAB_OBJECT *tail;
+		SLAB_OBJECT *head = slab_take(&local->free, SLAB_BATCH, &tail);
+		local->count -= SLAB_BATCH;
+		slab_give_back(type, head, tail);
+	}
+}
+
+/*
+ * Get the allocator statistics for a type of object.
+ *
+ * @param type  The type of object.
+ * @param stats  Set to its statistics.
+ */
+void slab_get_stats(SLAB_TYPE type, SLAB_STATS *stats) {
+	SLAB_CACHE *cache = &slab_caches[type];
+	*stats = (SLAB_STATS) {
+		.allocs = atomic_load_explicit(&cache->allocs, memory_order_relaxed),
+		.frees = atomic_load_explicit(&cache->frees, memory_order_relaxed),
+		.slabs = atomic_load_explicit(&cache->slabs, memory_order_relaxed),
+		.transfers = atomic_load_explicit(&cache->transfers, memory_order_relaxed)
+	};
+}
+
+/*
+ * Print the allocator statistics for every type of object.  Like
+ * stats_report(), this only prints anything in builds with INFO defined.
+ */
+void slab_report(void) {
+	for(int type = 0; type < SLAB_COUNT; type++) {
+		SLAB_STATS stats;
+		slab_get_stats(type, &stats);
+		info("%s objects: %ld allocated, %ld freed, %ld in use, %ld slabs, %ld transfers",
+		     slab_names[type], stats.allocs, stats.frees, stats.allocs - stats.frees,
+		     stats.slabs, stats.transfers);
+	}
+}
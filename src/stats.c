@@ -0,0 +1,44 @@
+#include "stats.h"
+#include "debug.h"
+#include <stdatomic.h>
+
+static atomic_long counters[STAT_COUNT];
+
+#ifdef INFO
+static const char *stat_names[STAT_COUNT] = {
+	[STAT_PACKETS_RECEIVED] = "packets received",
+	[STAT_RECV_ALLOCS] = "receive path allocations",
+	[STAT_DRAWS_ADJUDICATED] = "draws adjudicated early",
+	[STAT_MOVES_SAVED] = "moves saved by adjudication",
+	[STAT_CONNECTIONS_REFUSED] = "connections refused",
+};
+#endif
+
+/*
+ * Add to a counter.
+ *
+ * @param stat  The counter.
+ * @param n  The amount to add.
+ */
+void stats_add(STAT stat, long n) {
+	atomic_fetch_add_explicit(&counters[stat], n, memory_order_relaxed);
+}
+
+/*
+ * Get the current value of a counter.
+ *
+ * @param stat  The counter.
+ * @return  Its value.
+ */
+long stats_get(STAT stat) {
+	return atomic_load_explicit(&counters[stat], memory_order_relaxed);
+}
+
+/*
+ * Print all counters.  Like the rest of the server's informational
+ * output, this only appears in builds with INFO defined.
+ */
+void stats_report(void) {
+	for(int i = 0; i < STAT_COUNT; i++)
+		info("%s: %ld", stat_names[i], stats_get(i));
+}
@@ -0,0 +1,197 @@
+#include "strmap.h"
+#include "debug.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STRMAP_INITIAL_SIZE 64
+
+/*
+ * The table size is a power of two, and the table is kept at most 3/4
+ * full, so that probe sequences stay short.  Removal shifts later entries
+ * of the same probe sequence back into the hole, so there are no
+ * tombstones and lookups of missing keys stay fast however many removals
+ * have been made.  The hash of each key is kept alongside it, both to
+ * avoid most string comparisons and to avoid rehashing when growing.
+ */
+typedef struct strmap_entry {
+	const char *key;
+	void *value;
+	uint32_t hash;
+} STRMAP_ENTRY;
+
+typedef struct strmap {
+	STRMAP_ENTRY *entries;
+	uint32_t mask;
+	int count;
+} STRMAP;
+
+/*
+ * Hash a string, with the same function as is used by a STRMAP.
+ *
+ * @param key  The string to be hashed.
+ * @return  Its 32-bit FNV-1a hash.
+ */
+uint32_t strmap_hash(const char *key) {
+	uint32_t hash = 2166136261u;
+	while(*key) {
+		hash ^= (unsigned char)*key++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/*
+ * Find the slot holding a key, or the empty slot at which the search
+ * for it ended.
+ */
+static uint32_t strmap_find(STRMAP *map, const char *key, uint32_t hash) {
+	uint32_t i = hash & map->mask;
+	while(map->entries[i].key) {
+		if(map->entries[i].hash == hash && !strcmp(map->entries[i].key, key))
+			break;
+		i = (i + 1) & map->mask;
+	}
+	return i;
+}
+
+/*
+ * Create a new, empty map.
+ *
+ * @return  The newly created map, or NULL if creation failed.
+ */
+STRMAP *strmap_init(void) {
+	STRMAP *map;
+	if(!(map = malloc(sizeof(STRMAP)))) {
+		error("malloc failed");
+		return NULL;
+	}
+	*map = (STRMAP) {
+		.entries = calloc(STRMAP_INITIAL_SIZE, sizeof(STRMAP_ENTRY)),
+		.mask = STRMAP_INITIAL_SIZE - 1,
+		.count = 0
+	};
+	if(!map->entries) {
+		error("calloc failed");
+		free(map);
+		return NULL;
+	}
+	return map;
+}
+
+/*
+ * Finalize a map, freeing its resources.  The keys and values it still
+ * contains are not freed.
+ *
+ * @param map  The map to be finalized, which must not be used again.
+ */
+void strmap_fini(STRMAP *map) {
+	free(map->entries);
+	free(map);
+}
+
+/*
+ * Look up a key.
+ *
+ * @param map  The map.
+ * @param key  The key to be looked up.
+ * @return  The value stored under the key, or NULL if there is none.
+ */
+void *strmap_get(STRMAP *map, const char *key) {
+	return map->entries[strmap_find(map, key, strmap_hash(key))].value;
+}
+
+/*
+ * Double the size of the table.
+ */
+static int strmap_grow(STRMAP *map) {
+	uint32_t size = (map->mask + 1) * 2;
+	STRMAP_ENTRY *entries;
+	if(!(entries = calloc(size, sizeof(STRMAP_ENTRY)))) {
+		error("calloc failed");
+		return -1;
+	}
+	for(uint32_t i = 0; i <= map->mask; i++) {
+		STRMAP_ENTRY *e = &map->entries[i];
+		if(!e->key)
+			continue;
+		uint32_t j = e->hash & (size - 1);
+		while(entries[j].key)
+			j = (j + 1) & (size - 1);
+		entries[j] = *e;
+	}
+	free(map->entries);
+	map->entries = entries;
+	map->mask = size - 1;
+	return 0;
+}
+
+/*
+ * Store a value under a key that is not already in the map.
+ *
+ * @param map  The map.
+ * @param key  The key, which is retained by the map.
+ * @param value  The value, which must not be NULL.
+ * @return 0 if the value was stored, -1 if the key is already in the map
+ * or the map could not grow.
+ */
+int strmap_put(STRMAP *map, const char *key, void *value) {
+	uint32_t hash = strmap_hash(key);
+	uint32_t i = strmap_find(map, key, hash);
+	if(map->entries[i].key)
+		return -1;
+	if((map->count + 1) * 4 > (map->mask + 1) * 3) {
+		if(strmap_grow(map) < 0)
+			return -1;
+		i = strmap_find(map, key, hash);
+	}
+	map->entries[i] = (STRMAP_ENTRY) {
+		.key = key,
+		.value = value,
+		.hash = hash
+	};
+	map->count++;
+	return 0;
+}
+
+/*
+ * Remove a key from the map.
+ *
+ * @param map  The map.
+ * @param key  The key to be removed.
+ * @return  The value that was stored under the key, or NULL if there
+ * was none.
+ */
+void *strmap_remove(STRMAP *map, const char *key) {
+	uint32_t i = strmap_find(map, key, strmap_hash(key));
+	if(!map->entries[i].key)
+		return NULL;
+	void *value = map->entries[i].value;
+
+	// Move back any later entry whose home slot is not between the hole
+	// and its current slot, so that it can still be found.
+	uint32_t j = i;
+	while(1) {
+		j = (j + 1) & map->mask;
+		if(!map->entries[j].key)
+			break;
+		uint32_t home = map->entries[j].hash & map->mask;
+		if(((j - home) & map->mask) >= ((j - i) & map->mask)) {
+			map->entries[i] = map->entries[j];
+			i = j;
+		}
+	}
+	map->entries[i] = (STRMAP_ENTRY) { 0 };
+	map->count--;
+	return value;
+}
+
+/*
+ * Get the number of keys in the map.
+ *
+ * @param map  The map.
+ * @return  The number of keys.
+ */
+int strmap_count(STRMAP *map) {
+	return map->count;
+}
@@ -0,0 +1,342 @@
+#include "transport.h"
+#include "debug.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/io_uring.h>
+
+/*
+ * There is no liburing dependency: the handful of io_uring operations we
+ * need are issued directly through the io_uring_setup(2) and
+ * io_uring_enter(2) system calls.  A ring belongs to one thread, which
+ * queues reads on it for any number of descriptors and then, with a
+ * single io_uring_enter(2) call, submits them all and waits for whichever
+ * completes first.
+ */
+
+#define URING_ENTRIES 256
+
+TRANSPORT proto_transport = TRANSPORT_RW;
+
+typedef struct transport_ring {
+	int fd;
+	unsigned queued;
+	unsigned sq_entries;
+	void *sq_ptr;
+	size_t sq_len;
+	void *cq_ptr;
+	size_t cq_len;
+	struct io_uring_sqe *sqes;
+	size_t sqes_len;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+} TRANSPORT_RING;
+
+static int uring_setup(TRANSPORT_RING *ring) {
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = TRANSPORT_RING_MAX_READS;
+	if((ring->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p)) < 0)
+		return -1;
+
+	ring->queued = 0;
+	ring->sq_entries = p.sq_entries;
+	ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if(ring->sq_ptr == MAP_FAILED || ring->cq_ptr == MAP_FAILED || ring->sqes == MAP_FAILED) {
+		if(ring->sq_ptr != MAP_FAILED)
+			munmap(ring->sq_ptr, ring->sq_len);
+		if(ring->cq_ptr != MAP_FAILED)
+			munmap(ring->cq_ptr, ring->cq_len);
+		if(ring->sqes != MAP_FAILED)
+			munmap(ring->sqes, ring->sqes_len);
+		close(ring->fd);
+		return -1;
+	}
+
+	ring->sq_head = (unsigned *)((char *)ring->sq_ptr + p.sq_off.head);
+	ring->sq_tail = (unsigned *)((char *)ring->sq_ptr + p.sq_off.tail);
+	ring->sq_mask = (unsigned *)((char *)ring->sq_ptr + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)((char *)ring->sq_ptr + p.sq_off.array);
+	ring->cq_head = (unsigned *)((char *)ring->cq_ptr + p.cq_off.head);
+	ring->cq_tail = (unsigned *)((char *)ring->cq_ptr + p.cq_off.tail);
+	ring->cq_mask = (unsigned *)((char *)ring->cq_ptr + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ptr + p.cq_off.cqes);
+	return 0;
+}
+
+/*
+ * Create an io_uring instance for the calling thread to wait on.
+ *
+ * @return  The new ring, or NULL if io_uring is not available.
+ */
+TRANSPORT_RING *transport_ring_create(void) {
+	TRANSPORT_RING *ring;
+	if(!(ring = malloc(sizeof(TRANSPORT_RING)))) {
+		error("malloc failed");
+		return NULL;
+	}
+	if(uring_setup(ring) < 0) {
+		error("io_uring_setup: %s", strerror(errno));
+		free(ring);
+		return NULL;
+	}
+	return ring;
+}
+
+/*
+ * Destroy an io_uring instance.  Reads still in progress are cancelled.
+ *
+ * @param ring  The ring.
+ */
+void transport_ring_destroy(TRANSPORT_RING *ring) {
+	munmap(ring->sqes, ring->sqes_len);
+	munmap(ring->cq_ptr, ring->cq_len);
+	munmap(ring->sq_ptr, ring->sq_len);
+	close(ring->fd);
+	free(ring);
+}
+
+/*
+ * Submit up to "submit" of the operations queued on a ring, and wait for
+ * a number of completions.
+ *
+ * @return  The number of submissions consumed, or -1 with errno set.
+ */
+static int uring_enter(TRANSPORT_RING *ring, unsigned submit, unsigned min_complete) {
+	int ret = syscall(__NR_io_uring_enter, ring->fd, submit, min_complete,
+			  min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	if(ret > 0)
+		ring->queued -= ret;
+	return ret;
+}
+
+/*
+ * Queue a read on a ring, to be submitted with the next wait.  This has
+ * the semantics of read(2), so it serves for sockets and for eventfds
+ * alike.  The storage must remain valid until the read completes.
+ *
+ * @param ring  The ring.
+ * @param fd  The descriptor from which to read.
+ * @param buf  Storage for the bytes read.
+ * @param len  The maximum number of bytes to read.
+ * @param tag  Returned with the completion, to identify it.
+ * @return 0 if the read was queued, otherwise -1 with errno set.
+ */
+int transport_ring_read(TRANSPORT_RING *ring, int fd, void *buf, size_t len, void *tag) {
+	unsigned tail = *ring->sq_tail;
+	if(tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) == ring->sq_entries) {
+		// The submission queue is full: hand it to the kernel now.
+		if(uring_enter(ring, ring->queued, 0) < 0)
+			return -1;
+	}
+	unsigned index = tail & *ring->sq_mask;
+	ring->sqes[index] = (struct io_uring_sqe) {
+		.opcode = IORING_OP_READ,
+		.fd = fd,
+		.addr = (unsigned long)buf,
+		.len = len,
+		.user_data = (unsigned long)tag
+	};
+	ring->sq_array[index] = index;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->queued++;
+	return 0;
+}
+
+/*
+ * Take completions off a ring, without waiting.
+ *
+ * @return  The number of completions taken.
+ */
+static int uring_reap(TRANSPORT_RING *ring, TRANSPORT_EVENT *events, int max) {
+	unsigned head = *ring->cq_head;
+	unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	int n = 0;
+	while(head != tail && n < max) {
+		struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+		events[n++] = (TRANSPORT_EVENT) {
+			.tag = (void *)(unsigned long)cqe->user_data,
+			.res = cqe->res
+		};
+		head++;
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	return n;
+}
+
+/*
+ * Submit every read queued on a ring, and collect completed reads,
+ * waiting for one if none has completed yet.  This takes at most one
+ * system call, however many reads are submitted or collected.
+ *
+ * @param ring  The ring.
+ * @param events  Storage for the completions.
+ * @param max  The most completions to be collected.
+ * @return  The number of completions collected, or -1 with errno set.
+ */
+int transport_ring_wait(TRANSPORT_RING *ring, TRANSPORT_EVENT *events, int max) {
+	int n = uring_reap(ring, events, max);
+	if(n == 0 || ring->queued) {
+		int ret = uring_enter(ring, ring->queued, n ? 0 : 1);
+		if(ret < 0 && errno == EBUSY && !n) {
+			// Completions the kernel could not post are backed up behind
+			// the completion queue.  Submit nothing until they have been
+			// collected: waiting without submitting posts them.
+			ret = uring_enter(ring, 0, 1);
+		}
+		if(ret < 0)
+			return n ? n : -1;
+		n += uring_reap(ring, events + n, max - n);
+	}
+	return n;
+}
+
+/*
+ * Check that the kernel can read through io_uring, by reading from an
+ * eventfd that is ready.
+ *
+ * @return 0 if it can, otherwise -1.
+ */
+static int uring_probe(void) {
+	TRANSPORT_RING *ring;
+	TRANSPORT_EVENT event;
+	uint64_t value = 0;
+	int efd, ok = 0;
+	if((efd = eventfd(1, EFD_CLOEXEC)) < 0)
+		return -1;
+	if((ring = transport_ring_create())) {
+		ok = transport_ring_read(ring, efd, &value, sizeof(value), &value) == 0 &&
+		     transport_ring_wait(ring, &event, 1) == 1 &&
+		     event.tag == &value && event.res == sizeof(value) && value == 1;
+		transport_ring_destroy(ring);
+	}
+	close(efd);
+	return ok ? 0 : -1;
+}
+
+/*
+ * Select the transport to be used for all connections.  If io_uring is
+ * requested but is not supported by the running kernel (or is disallowed
+ * by the environment), the ordinary read/write transport is used instead.
+ *
+ * @param requested  The transport that is desired.
+ * @return  The transport that was actually selected.
+ */
+TRANSPORT transport_init(TRANSPORT requested) {
+	proto_transport = TRANSPORT_RW;
+	if(requested == TRANSPORT_URING) {
+		if(uring_probe() == 0) {
+			proto_transport = TRANSPORT_URING;
+		} else {
+			error("io_uring unavailable, falling back to read/write transport");
+		}
+	}
+	debug("%ld: Using %s transport", pthread_self(),
+	      proto_transport == TRANSPORT_URING ? "io_uring" : "read/write");
+	return proto_transport;
+}
+
+/*
+ * Receive whatever data is available on a socket, up to a limit.  This
+ * is recv(2): a single receive is no cheaper through io_uring.
+ *
+ * @param fd  The socket from which to receive.
+ * @param buf  Storage for the received bytes.
+ * @param len  The maximum number of bytes to receive.
+ * @param flags  Flags as for recv(2), e.g. MSG_DONTWAIT.
+ * @return  The number of bytes received, 0 at EOF, or -1 with errno set.
+ */
+ssize_t transport_recv(int fd, void *buf, size_t len, int flags) {
+	return recv(fd, buf, len, flags);
+}
+
+/*
+ * Advance a gather list past a number of bytes that have been sent.
+ *
+ * @return  The number of entries remaining in the list.
+ */
+static int iov_advance(struct iovec **iovp, int iovcnt, size_t sent) {
+	struct iovec *iov = *iovp;
+	while(iovcnt > 0 && sent >= iov->iov_len) {
+		sent -= iov->iov_len;
+		iov++;
+		iovcnt--;
+	}
+	if(iovcnt > 0) {
+		iov->iov_base = (char *)iov->iov_base + sent;
+		iov->iov_len -= sent;
+	}
+	*iovp = iov;
+	return iovcnt;
+}
+
+/*
+ * Send the entire contents of a gather list on a socket.  This is a
+ * writev(2) loop, in which a partial send just resumes from wherever it
+ * left off, so a caller can hand over any number of packets and expect
+ * them to go out in as few system calls (and TCP segments) as the kernel
+ * allows.
+ *
+ * @param fd  The socket on which to send.
+ * @param iov  The buffers to be sent, in order.  The array is modified
+ * to track progress across partial sends.
+ * @param iovcnt  The number of entries in iov, at most IOV_MAX.
+ * @return 0 if everything was sent, otherwise -1 with errno set.
+ */
+int transport_sendv(int fd, struct iovec *iov, int iovcnt) {
+	while(iovcnt > 0) {
+		ssize_t res = writev(fd, iov, iovcnt);
+		if(res < 0) {
+			if(errno == EINTR || errno == EAGAIN)
+				continue;
+			return -1;
+		}
+		// Skip over whatever was sent; usually that is everything.
+		iovcnt = iov_advance(&iov, iovcnt, res);
+	}
+	return 0;
+}
+
+/*
+ * Make a single non-blocking attempt to send a gather list on a socket.
+ *
+ * @param fd  The socket on which to send.
+ * @param iov  The buffers to be sent, in order.
+ * @param iovcnt  The number of entries in iov, at most IOV_MAX.
+ * @return  The number of bytes sent, which may be less than the total,
+ * or -1 with errno set (EAGAIN if the socket buffer is full).
+ */
+ssize_t transport_trysendv(int fd, struct iovec *iov, int iovcnt) {
+	struct msghdr msg = {
+		.msg_iov = iov,
+		.msg_iovlen = iovcnt
+	};
+	ssize_t res;
+	do {
+		res = sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+	} while(res < 0 && errno == EINTR);
+	return res;
+}
@@ -0,0 +1,157 @@
+#include "work_queue.h"
+#include "debug.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+
+/*
+ * The queue is a circular array of item slots protected by a mutex,
+ * with one condition variable for each side to wait on.
+ */
+typedef struct work_queue {
+	void **items;
+	int capacity;
+	int front;
+	int count;
+	pthread_mutex_t mutex;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+} WORK_QUEUE;
+
+/*
+ * Create a new, empty work queue.
+ *
+ * @param capacity  The maximum number of items the queue can hold.
+ * @return  The newly created queue, or NULL if creation failed.
+ */
+WORK_QUEUE *wq_init(int capacity) {
+	WORK_QUEUE *wq;
+	if(capacity <= 0) {
+		error("Invalid queue capacity: %d", capacity);
+		return NULL;
+	}
+	if(!(wq = malloc(sizeof(WORK_QUEUE)))) {
+		error("malloc failed");
+		return NULL;
+	}
+	*wq = (WORK_QUEUE) {
+		.items = calloc(capacity, sizeof(void *)),
+		.capacity = capacity,
+		.front = 0,
+		.count = 0
+	};
+	if(!wq->items) {
+		error("calloc failed");
+		free(wq);
+		return NULL;
+	}
+	pthread_mutex_init(&wq->mutex, NULL);
+	pthread_cond_init(&wq->not_empty, NULL);
+	pthread_cond_init(&wq->not_full, NULL);
+	return wq;
+}
+
+/*
+ * Finalize a work queue, freeing its resources.  Items still in the
+ * queue are discarded.
+ *
+ * @param wq  The queue to be finalized, which must not be used again.
+ */
+void wq_fini(WORK_QUEUE *wq) {
+	pthread_cond_destroy(&wq->not_full);
+	pthread_cond_destroy(&wq->not_empty);
+	pthread_mutex_destroy(&wq->mutex);
+	free(wq->items);
+	free(wq);
+}
+
+/*
+ * Insert an item.  The caller must hold the mutex and have verified
+ * that there is room.
+ */
+static void wq_insert(WORK_QUEUE *wq, void *item) {
+	wq->items[(wq->front + wq->count) % wq->capacity] = item;
+	wq->count++;
+	pthread_cond_signal(&wq->not_empty);
+}
+
+/*
+ * Add an item to the tail of a work queue, blocking until there is room.
+ *
+ * @param wq  The queue.
+ * @param item  The item to be added.
+ */
+void wq_put(WORK_QUEUE *wq, void *item) {
+	pthread_mutex_lock(&wq->mutex);
+	while(wq->count == wq->capacity)
+		pthread_cond_wait(&wq->not_full, &wq->mutex);
+	wq_insert(wq, item);
+	pthread_mutex_unlock(&wq->mutex);
+}
+
+/*
+ * Add an item to the tail of a work queue, waiting at most a specified
+ * time for room to become available.
+ *
+ * @param wq  The queue.
+ * @param item  The item to be added.
+ * @param msec  The maximum time to wait, in milliseconds.  If zero, the
+ * call does not block at all.
+ * @return 0 if the item was added, -1 if the queue remained full.
+ */
+int wq_put_timed(WORK_QUEUE *wq, void *item, int msec) {
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += msec / 1000;
+	deadline.tv_nsec += (long)(msec % 1000) * 1000000;
+	if(deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&wq->mutex);
+	while(wq->count == wq->capacity) {
+		if(msec <= 0 || pthread_cond_timedwait(&wq->not_full, &wq->mutex, &deadline) == ETIMEDOUT) {
+			if(wq->count < wq->capacity)
+				break;
+			pthread_mutex_unlock(&wq->mutex);
+			return -1;
+		}
+	}
+	wq_insert(wq, item);
+	pthread_mutex_unlock(&wq->mutex);
+	return 0;
+}
+
+/*
+ * Remove and return the item at the head of a work queue, blocking
+ * until one is available.
+ *
+ * @param wq  The queue.
+ * @return  The item removed from the queue.
+ */
+void *wq_get(WORK_QUEUE *wq) {
+	pthread_mutex_lock(&wq->mutex);
+	while(wq->count == 0)
+		pthread_cond_wait(&wq->not_empty, &wq->mutex);
+	void *item = wq->items[wq->front];
+	wq->front = (wq->front + 1) % wq->capacity;
+	wq->count--;
+	pthread_cond_signal(&wq->not_full);
+	pthread_mutex_unlock(&wq->mutex);
+	return item;
+}
+
+/*
+ * Get the number of items currently in a work queue.
+ *
+ * @param wq  The queue.
+ * @return  The number of queued items.
+ */
+int wq_length(WORK_QUEUE *wq) {
+	pthread_mutex_lock(&wq->mutex);
+	int count = wq->count;
+	pthread_mutex_unlock(&wq->mutex);
+	return count;
+}
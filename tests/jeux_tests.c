@@ -5,6 +5,21 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <wait.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+
+#include "game_ext.h"
+#include "client_ext.h"
+#include "client_registry_ext.h"
+#include "server_ext.h"
+#include "protocol_ext.h"
+#include "player_ext.h"
+#include "leaderboard.h"
+#include "epoch.h"
+#include "jeux_globals.h"
 
 /* Directory in which to create test output files. */
 #define TEST_OUTPUT "test_output/"
@@ -74,3 +89,497 @@ Test(student_suite, 01_connect, .init = init, .fini = fini, .timeout = 5) {
     int ret = system("util/jclient -p 9999 </dev/null | grep 'Connected to server'");
     cr_assert_eq(ret, 0, "expected %d, was %d\n", 0, ret);
 }
+
+/*
+ * Plain scan of a board for a line of k squares held by one side,
+ * to check the engine against.
+ */
+static int scan_line(const unsigned char *cells, GAME_GEOMETRY *g, int side) {
+    static const int dr[] = { 0, 1, 1, 1 }, dc[] = { 1, 0, 1, -1 };
+    for(int r = 0; r < g->rows; r++) {
+	for(int c = 0; c < g->columns; c++) {
+	    for(int d = 0; d < 4; d++) {
+		int n = 0, rr = r, cc = c;
+		while(n < g->line && rr >= 0 && rr < g->rows && cc >= 0 && cc < g->columns &&
+		      cells[rr * g->columns + cc] == side) {
+		    n++;
+		    rr += dr[d];
+		    cc += dc[d];
+		}
+		if(n == g->line)
+		    return 1;
+	    }
+	}
+    }
+    return 0;
+}
+
+// Every geometry whose board fits in a single word takes the engine's
+// one-word path, where a line as long as the board must not shift past
+// the end of the word (4,14,8 used to give false wins).
+Test(game_suite, 00_single_word_geometries, .timeout = 30) {
+    unsigned char cells[GAME_MAX_SQUARES];
+    int order[GAME_MAX_SQUARES];
+    char square[12];
+    srand(1);
+    for(int rows = 1; rows <= GAME_MAX_SIDE; rows++) {
+	for(int cols = 1; cols <= GAME_MAX_SIDE && rows * (cols + 1) <= 64; cols++) {
+	    int squares = rows * cols;
+	    int longest = rows > cols ? rows : cols;
+	    for(int line = 1; line <= longest; line++) {
+		GAME_GEOMETRY g = { .rows = rows, .columns = cols, .line = line };
+		for(int t = 0; t < 20; t++) {
+		    for(int i = 0; i < squares; i++)
+			order[i] = i;
+		    for(int i = squares - 1; i > 0; i--) {
+			int j = rand() % (i + 1);
+			int x = order[i];
+			order[i] = order[j];
+			order[j] = x;
+		    }
+		    memset(cells, 0, sizeof(cells));
+		    GAME *game = game_create_geometry(&g);
+		    cr_assert_not_null(game, "Failed to create %d,%d,%d game", rows, cols, line);
+		    for(int n = 0; n < squares && !game_is_over(game); n++) {
+			int side = (n & 1) ? SECOND_PLAYER_ROLE : FIRST_PLAYER_ROLE;
+			snprintf(square, sizeof(square), "%d", order[n] + 1);
+			cr_assert_eq(game_play_move(game, side, square), 0,
+				     "%d,%d,%d: move %s was refused", rows, cols, line, square);
+			cells[order[n]] = side;
+			if(scan_line(cells, &g, side)) {
+			    cr_assert(game_is_over(game), "%d,%d,%d: win not seen", rows, cols, line);
+			    cr_assert_eq(game_get_winner(game), side,
+					 "%d,%d,%d: wrong winner", rows, cols, line);
+			} else {
+			    cr_assert_eq(game_get_winner(game), NULL_ROLE,
+					 "%d,%d,%d: false win after move %s", rows, cols, line, square);
+			}
+		    }
+		    game_unref(game, "end of test game");
+		}
+	    }
+	}
+    }
+}
+
+/*
+ * Play a sequence of tic-tac-toe moves, X first, asserting that each is
+ * accepted and that the game is not over before the last of them.
+ */
+static GAME *play_moves(char **moves, int n) {
+    GAME *game = game_create();
+    cr_assert_not_null(game, "Failed to create game");
+    for(int i = 0; i < n; i++) {
+	cr_assert(!game_is_over(game), "Game over before move %s", moves[i]);
+	GAME_ROLE role = (i & 1) ? SECOND_PLAYER_ROLE : FIRST_PLAYER_ROLE;
+	cr_assert_eq(game_play_move(game, role, moves[i]), 0, "Move %s was refused", moves[i]);
+    }
+    return game;
+}
+
+// Two squares are left, and neither side can complete a line with the
+// moves that remain, so the game is a draw now.
+Test(game_suite, 01_dead_draw_adjudicated, .timeout = 5) {
+    char *moves[] = { "1", "2", "3", "5", "4", "7", "8" };
+    GAME *game = play_moves(moves, 7);
+    cr_assert(game_is_over(game), "Dead position was not adjudicated");
+    cr_assert_eq(game_get_winner(game), NULL_ROLE, "Dead position has a winner");
+    cr_assert_neq(game_play_move(game, SECOND_PLAYER_ROLE, "6"), 0, "Move after the draw was accepted");
+    game_unref(game, "end of test game");
+}
+
+// Two squares are left, and X can still complete 4-5-6, so the game must
+// go on until O blocks it.
+Test(game_suite, 02_open_line_not_adjudicated, .timeout = 5) {
+    char *moves[] = { "5", "1", "9", "3", "2", "8", "4" };
+    GAME *game = play_moves(moves, 7);
+    cr_assert(!game_is_over(game), "Position with an open line was adjudicated");
+    cr_assert_eq(game_get_winner(game), NULL_ROLE, "Unfinished game has a winner");
+    game_unref(game, "end of test game");
+}
+
+// A drawn game played out as far as it can be.  The board can never fill
+// up: once one square is left, either it completes a line for the side to
+// move or the position is already dead, so the draw comes on the eighth
+// move and the last square cannot be played.
+Test(game_suite, 03_full_board_draw, .timeout = 5) {
+    char *moves[] = { "5", "1", "9", "3", "2", "8", "4", "6" };
+    GAME *game = play_moves(moves, 8);
+    cr_assert(game_is_over(game), "Drawn game is not over");
+    cr_assert_eq(game_get_winner(game), NULL_ROLE, "Drawn game has a winner");
+    cr_assert_neq(game_play_move(game, FIRST_PLAYER_ROLE, "7"), 0, "Last square was accepted");
+    game_unref(game, "end of test game");
+}
+
+/*
+ * Set up the registries for tests that use them directly, without a
+ * server process.
+ */
+static void registries_init(void) {
+    client_registry = creg_init();
+    player_registry = preg_init();
+    cr_assert_not_null(client_registry, "Failed to create client registry");
+    cr_assert_not_null(player_registry, "Failed to create player registry");
+}
+
+#define LOGIN_THREADS 4
+#define LOGINS_PER_THREAD 250
+#define LOGINS (LOGIN_THREADS * LOGINS_PER_THREAD)
+
+static CLIENT *login_clients[LOGINS];
+static atomic_int login_threads_done;
+
+static void *login_thread(void *arg) {
+    long t = (long)arg, failed = 0;
+    char name[32];
+    for(int i = t * LOGINS_PER_THREAD; i < (t + 1) * LOGINS_PER_THREAD; i++) {
+	snprintf(name, sizeof(name), "user%04d", i);
+	PLAYER *player = preg_register(player_registry, name);
+	if(!player || client_login(login_clients[i], player) < 0)
+	    failed++;
+	if(player)
+	    player_unref(player, "after test login");
+    }
+    atomic_fetch_add(&login_threads_done, 1);
+    return (void *)failed;
+}
+
+/*
+ * Count the lines of a listing, which has none if it is empty.
+ */
+static int count_lines(const char *text) {
+    int n = *text != '\0';
+    for(; *text; text++)
+	n += *text == '\n';
+    return n;
+}
+
+// The USERS listing is rebuilt while clients are logging in, which can
+// add players between any two looks at the registry.
+Test(registry_suite, 00_users_during_logins, .timeout = 30) {
+    registries_init();
+    // The clients only log in, so they can share a descriptor.
+    int fd = open("/dev/null", O_WRONLY);
+    for(int i = 0; i < LOGINS; i++) {
+	login_clients[i] = creg_register(client_registry, fd);
+	cr_assert_not_null(login_clients[i], "Failed to register client %d", i);
+    }
+    pthread_t tids[LOGIN_THREADS];
+    for(long t = 0; t < LOGIN_THREADS; t++)
+	pthread_create(&tids[t], NULL, login_thread, (void *)t);
+
+    CREG_USERS_QUERY query = {
+	.after = "user0100", .prefix = NULL, .min_rating = INT_MIN, .max_rating = INT_MAX, .limit = 50
+    };
+    char page[4096];
+    int done, lines;
+    do {
+	// Checked before looking, so that the last look sees every login.
+	done = atomic_load(&login_threads_done) == LOGIN_THREADS;
+	epoch_enter();
+	size_t len;
+	const char *users = creg_users(client_registry, &len);
+	cr_assert_not_null(users, "No users listing");
+	cr_assert_eq(strlen(users) + 1, len, "Listing length is wrong");
+	lines = count_lines(users);
+	cr_assert(lines <= LOGINS, "Listing has %d lines", lines);
+	epoch_exit();
+	size_t page_len;
+	cr_assert_geq(creg_users_page(client_registry, &query, page, sizeof(page), &page_len), 0,
+		      "No users page");
+	cr_assert(count_lines(page) <= 50, "Page is too long");
+    } while(!done);
+    for(int t = 0; t < LOGIN_THREADS; t++) {
+	void *failed;
+	pthread_join(tids[t], &failed);
+	cr_assert_null(failed, "%ld logins failed", (long)failed);
+    }
+    cr_assert_eq(lines, LOGINS, "Listing has %d lines after every login", lines);
+}
+
+/*
+ * A logged-in client whose requests are handed straight to the
+ * dispatcher, with the far end of its connection kept for reading the
+ * replies.
+ */
+typedef struct test_client {
+    CLIENT *client;
+    int peer;
+} TEST_CLIENT;
+
+/*
+ * Make a request as a client, and get the reply.
+ *
+ * @return  The type of the reply; *datap is set to its payload, which
+ * the caller must free, or NULL if it has none.
+ */
+static int test_request(TEST_CLIENT *tc, int type, int id, int role, const char *payload,
+			JEUX_PACKET_HEADER *reply, char **datap) {
+    JEUX_PACKET_HEADER hdr = {
+	.type = type, .id = id, .role = role, .size = htons(payload ? strlen(payload) : 0)
+    };
+    char *data = payload ? strdup(payload) : NULL;
+    jeux_dispatch_packet(tc->client, &hdr, data);
+    free(data);
+    *datap = NULL;
+    cr_assert_eq(proto_recv_packet(tc->peer, reply, (void **)datap), 0, "No reply to request");
+    return reply->type;
+}
+
+static TEST_CLIENT test_login(char *name) {
+    int fds[2];
+    JEUX_PACKET_HEADER reply;
+    char *data;
+    cr_assert_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0, "socketpair failed");
+    TEST_CLIENT tc = { .client = jeux_client_open(fds[0]), .peer = fds[1] };
+    cr_assert_not_null(tc.client, "Failed to open client");
+    cr_assert_eq(test_request(&tc, JEUX_LOGIN_PKT, 0, 0, name, &reply, &data), JEUX_ACK_PKT,
+		 "Login as %s failed", name);
+    free(data);
+    return tc;
+}
+
+/*
+ * Ask for a page of users, which must be given, and check it.
+ */
+static void users_page(TEST_CLIENT *tc, const char *query, const char *expected, int more) {
+    JEUX_PACKET_HEADER reply;
+    char *data;
+    cr_assert_eq(test_request(tc, JEUX_USERS_PKT, 0, 0, query, &reply, &data), JEUX_ACK_PKT,
+		 "USERS [%s] was refused", query);
+    cr_assert_not_null(data, "USERS [%s] gave no payload", query);
+    cr_assert_str_eq(data, expected, "USERS [%s] gave [%s]", query, data);
+    cr_assert_eq(reply.role, more ? JEUX_USERS_MORE : 0, "USERS [%s] has the wrong role", query);
+    free(data);
+}
+
+static char *user_names[] = { "al", "ali", "alice", "alicia", "bob", "carol", "dave" };
+#define USER_COUNT (sizeof(user_names) / sizeof(user_names[0]))
+
+static void users_init(TEST_CLIENT *tcs) {
+    registries_init();
+    // Logged in out of order, to show that pages are in order of name.
+    for(int i = USER_COUNT - 1; i >= 0; i--)
+	tcs[i] = test_login(user_names[i]);
+}
+
+Test(users_suite, 00_page_with_continuation, .timeout = 5) {
+    TEST_CLIENT tcs[USER_COUNT];
+    users_init(tcs);
+    users_page(&tcs[0], "limit=3", "al\t1500\nali\t1500\nalice\t1500", 1);
+    users_page(&tcs[0], "after=alice\tlimit=3", "alicia\t1500\nbob\t1500\ncarol\t1500", 1);
+    users_page(&tcs[0], "limit=3\tafter=carol", "dave\t1500", 0);
+    users_page(&tcs[0], "after=dave", "", 0);
+    // A name that is not logged in still marks a place.
+    users_page(&tcs[0], "after=b\tlimit=1", "bob\t1500", 1);
+}
+
+Test(users_suite, 01_prefix_bounds, .timeout = 5) {
+    TEST_CLIENT tcs[USER_COUNT];
+    users_init(tcs);
+    users_page(&tcs[0], "prefix=ali", "ali\t1500\nalice\t1500\nalicia\t1500", 0);
+    users_page(&tcs[0], "prefix=alic\tlimit=1", "alice\t1500", 1);
+    users_page(&tcs[0], "prefix=alic\tafter=alice", "alicia\t1500", 0);
+    users_page(&tcs[0], "prefix=al\tafter=alicia", "", 0);
+    users_page(&tcs[0], "prefix=b", "bob\t1500", 0);
+    users_page(&tcs[0], "prefix=alz", "", 0);
+    users_page(&tcs[0], "prefix=dave", "dave\t1500", 0);
+    users_page(&tcs[0], "prefix=daves", "", 0);
+}
+
+Test(users_suite, 02_malformed_field_nacked, .timeout = 5) {
+    static char *bad[] = {
+	"limit", "limit=", "limit=0", "limit=x", "min=1.5", "max=99999999999", "colour=red", "prefix=a\tmin"
+    };
+    TEST_CLIENT tcs[USER_COUNT];
+    JEUX_PACKET_HEADER reply;
+    char *data;
+    users_init(tcs);
+    for(int i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+	cr_assert_eq(test_request(&tcs[0], JEUX_USERS_PKT, 0, 0, bad[i], &reply, &data), JEUX_NACK_PKT,
+		     "USERS [%s] was not refused", bad[i]);
+	free(data);
+    }
+    users_page(&tcs[0], "limit=1", "al\t1500", 1);
+}
+
+/*
+ * Compare two "name<TAB>rating" lines by rating, and by name among equal
+ * ratings.
+ */
+static int compare_by_rating(const void *a, const void *b) {
+    const char *x = *(char **)a, *y = *(char **)b;
+    int rx = atoi(strchr(x, '\t') + 1), ry = atoi(strchr(y, '\t') + 1);
+    if(rx != ry)
+	return rx < ry ? -1 : 1;
+    return strcmp(x, y);
+}
+
+Test(users_suite, 03_rating_band, .timeout = 5) {
+    TEST_CLIENT tcs[USER_COUNT];
+    JEUX_PACKET_HEADER reply;
+    char *data;
+    users_init(tcs);
+    PLAYER *players[USER_COUNT];
+    for(int i = 0; i < USER_COUNT; i++)
+	players[i] = client_get_player(tcs[i].client);
+    player_post_result(players[2], players[4], 1);
+    player_post_result(players[5], players[6], 1);
+    player_post_result(players[2], players[5], 1);
+    player_post_result(players[4], players[6], 0);
+    player_post_result(players[0], players[1], 2);
+    creg_users_changed(client_registry);
+
+    // The users in the band, in order of rating, from the whole listing.
+    int min = 1480, max = 1510;
+    cr_assert_eq(test_request(&tcs[0], JEUX_USERS_PKT, 0, 0, NULL, &reply, &data), JEUX_ACK_PKT,
+		 "USERS was refused");
+    char *lines[USER_COUNT], *line, *rest = data;
+    int n = 0;
+    while((line = strsep(&rest, "\n"))) {
+	int rating = atoi(strchr(line, '\t') + 1);
+	if(rating >= min && rating <= max)
+	    lines[n++] = line;
+    }
+    cr_assert(n > 2 && n < USER_COUNT, "Band holds %d users", n);
+    qsort(lines, n, sizeof(char *), compare_by_rating);
+
+    // Two at a time, continuing from the last user on each page.
+    char query[128], expected[128];
+    snprintf(query, sizeof(query), "min=%d\tmax=%d\tlimit=2", min, max);
+    for(int i = 0; i < n; i += 2) {
+	snprintf(expected, sizeof(expected), "%s%s%s", lines[i], i + 1 < n ? "\n" : "",
+		 i + 1 < n ? lines[i + 1] : "");
+	users_page(&tcs[0], query, expected, i + 2 < n);
+	const char *last = lines[i + 1 < n ? i + 1 : i];
+	const char *tab = strchr(last, '\t');
+	snprintf(query, sizeof(query), "after=%.*s\tmin=%s\tmax=%d\tlimit=2", (int)(tab - last), last,
+		 tab + 1, max);
+    }
+    // A prefix narrows the band without changing its order.
+    size_t len = 0;
+    expected[0] = '\0';
+    for(int i = 0; i < n; i++) {
+	if(!strncmp(lines[i], "al", 2))
+	    len += snprintf(expected + len, sizeof(expected) - len, "%s%s", len ? "\n" : "", lines[i]);
+    }
+    snprintf(query, sizeof(query), "prefix=al\tmin=%d\tmax=%d", min, max);
+    users_page(&tcs[0], query, expected, 0);
+    users_page(&tcs[0], "min=4000", "", 0);
+    users_page(&tcs[0], "min=1500\tmax=1499", "", 0);
+    free(data);
+}
+
+/*
+ * Check a listing of leaders against the ranks and ratings expected,
+ * best first.
+ */
+static void check_leaders(char *text, int n, const int *ranks, const int *ratings) {
+    char *line, *rest = text;
+    int i = 0;
+    while(*text && (line = strsep(&rest, "\n"))) {
+	int rank, rating;
+	char name[32];
+	cr_assert_eq(sscanf(line, "%d\t%31[^\t]\t%d", &rank, name, &rating), 3, "Bad line [%s]", line);
+	cr_assert(i < n, "Too many leaders");
+	cr_assert_eq(rank, ranks[i], "Leader %d ranked %d, not %d", i, rank, ranks[i]);
+	cr_assert_eq(rating, ratings[i], "Leader %d rated %d, not %d", i, rating, ratings[i]);
+	i++;
+    }
+    cr_assert_eq(i, n, "%d leaders, not %d", i, n);
+}
+
+Test(leaderboard_suite, 00_ties_share_rank, .timeout = 5) {
+    PLAYER *a = player_create("a"), *b = player_create("b");
+    PLAYER *c = player_create("c"), *d = player_create("d");
+    player_post_result(a, b, 1);
+    cr_assert_eq(player_get_rank(a), 1, "Winner is not first");
+    cr_assert_eq(player_get_rank(c), 2, "Tied player is not second");
+    cr_assert_eq(player_get_rank(d), 2, "Tied player is not second");
+    cr_assert_eq(player_get_rank(b), 4, "Loser is not fourth");
+    char buf[256];
+    size_t len = lb_top(10, buf, sizeof(buf));
+    cr_assert_eq(len, strlen(buf) + 1, "Wrong length");
+    check_leaders(buf, 4, (int []){ 1, 2, 2, 4 }, (int []){ 1516, 1500, 1500, 1484 });
+}
+
+Test(leaderboard_suite, 01_ratings_clamped, .timeout = 5) {
+    PLAYER *p = player_create("p");
+    LB_NODE high, top, low, bottom;
+    lb_insert(&high, p, 5000);
+    lb_insert(&top, p, LB_MAX_RATING);
+    lb_insert(&low, p, -50);
+    lb_insert(&bottom, p, LB_MIN_RATING);
+    cr_assert_eq(lb_rank(&high), 1, "Rating above the range is not first");
+    cr_assert_eq(lb_rank(&top), 1, "Rating above the range is not tied with the top");
+    cr_assert_eq(player_get_rank(p), 3, "Rating in the range is not third");
+    cr_assert_eq(lb_rank(&low), 4, "Rating below the range is not last");
+    cr_assert_eq(lb_rank(&bottom), 4, "Rating below the range is not tied with the bottom");
+    char buf[256];
+    lb_top(5, buf, sizeof(buf));
+    // Ratings are listed as they are, but ranked as if clamped.
+    check_leaders(buf, 5, (int []){ 1, 1, 3, 4, 4 },
+		  (int []){ LB_MAX_RATING, 5000, 1500, LB_MIN_RATING, -50 });
+    lb_update(&high, -100);
+    cr_assert_eq(lb_rank(&high), 3, "Rating moved below the range is not with the bottom");
+    cr_assert_eq(lb_rank(&top), 1, "Top rating is not first");
+    lb_remove(&high);
+    lb_remove(&top);
+    lb_remove(&low);
+    lb_remove(&bottom);
+    cr_assert_eq(player_get_rank(p), 1, "Only player is not first");
+}
+
+Test(leaderboard_suite, 02_more_wanted_than_players, .timeout = 5) {
+    player_create("x");
+    player_create("y");
+    player_create("z");
+    char buf[256];
+    size_t len = lb_top(100, buf, sizeof(buf));
+    cr_assert_eq(len, strlen(buf) + 1, "Wrong length");
+    check_leaders(buf, 3, (int []){ 1, 1, 1 }, (int []){ 1500, 1500, 1500 });
+    cr_assert_eq(lb_top(0, buf, sizeof(buf)), 1, "Nobody wanted, but somebody listed");
+    cr_assert_str_eq(buf, "", "Nobody wanted, but somebody listed");
+}
+
+Test(leaderboard_suite, 03_truncated_at_buffer, .timeout = 5) {
+    player_create("aaaa");
+    player_create("bbbb");
+    player_create("cccc");
+    // Each line is "1<TAB>name<TAB>1500", 11 characters, and takes 12 with
+    // its newline or null character.
+    char buf[64];
+    cr_assert_eq(lb_top(3, buf, 12), 12, "Wrong length for one line");
+    cr_assert_eq(strlen(buf), 11, "Partial line listed");
+    cr_assert_eq(lb_top(3, buf, 23), 12, "Wrong length for one line");
+    cr_assert_eq(strlen(buf), 11, "Partial line listed");
+    cr_assert_eq(lb_top(3, buf, 24), 24, "Wrong length for two lines");
+    cr_assert_eq(strlen(buf), 23, "Partial line listed");
+    cr_assert_eq(lb_top(3, buf, 36), 36, "Wrong length for three lines");
+    cr_assert_eq(lb_top(2, buf, 36), 24, "Wrong length for two lines");
+    cr_assert_eq(lb_top(3, buf, 11), 1, "Line listed that does not fit");
+    cr_assert_str_eq(buf, "", "Line listed that does not fit");
+    cr_assert_eq(lb_top(3, buf, 1), 1, "Line listed in no space");
+}
+
+Test(leaderboard_suite, 04_leaders_self, .timeout = 5) {
+    JEUX_PACKET_HEADER reply;
+    char *data;
+    registries_init();
+    TEST_CLIENT a = test_login("a"), b = test_login("b"), c = test_login("c");
+    player_post_result(client_get_player(a.client), client_get_player(c.client), 1);
+
+    cr_assert_eq(test_request(&c, JEUX_LEADERS_PKT, 1, 0, NULL, &reply, &data), JEUX_ACK_PKT,
+		 "LEADERS was refused");
+    cr_assert_str_eq(data, "1\ta\t1516", "LEADERS gave [%s]", data);
+    free(data);
+    cr_assert_eq(test_request(&c, JEUX_LEADERS_PKT, 1, JEUX_LEADERS_SELF, NULL, &reply, &data),
+		 JEUX_ACK_PKT, "LEADERS was refused");
+    cr_assert_str_eq(data, "1\ta\t1516\n3\tc\t1484", "LEADERS gave [%s]", data);
+    free(data);
+    // The requester is added even if already listed.
+    cr_assert_eq(test_request(&b, JEUX_LEADERS_PKT, 0, JEUX_LEADERS_SELF, NULL, &reply, &data),
+		 JEUX_ACK_PKT, "LEADERS was refused");
+    check_leaders(data, 4, (int []){ 1, 2, 3, 2 }, (int []){ 1516, 1500, 1484, 1500 });
+    free(data);
+}